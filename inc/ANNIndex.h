@@ -0,0 +1,96 @@
+#ifndef ANN_INDEX_H
+#define ANN_INDEX_H
+
+// Standard Library Inclusions
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Project Inclusions
+#include "FourierTX.h"
+#include "SystemUtilities.h"
+
+// Definitions
+namespace fs = std::filesystem;
+#define ANN_MAGIC 0x314E4E4150415301ULL
+#define ANN_VERSION 1
+#define ANN_M 16
+#define ANN_M0 (2 * ANN_M)
+#define ANN_EF_CONSTRUCTION 100
+#define ANN_EF_SEARCH 64
+
+//=============================================================================
+// ANNIndex - approximate nearest neighbours of timbre embeddings
+//=============================================================================
+// A hierarchical navigable small world graph (HNSW). Every embedding is a
+// node linked to up to ANN_M close nodes on each level it reaches, and to up
+// to ANN_M0 on level 0, which holds every node. Levels are drawn at random
+// with exponentially fewer nodes on each, so a search descends greedily
+// through the sparse levels to the right region and then explores level 0
+// around it, visiting a few thousand nodes however large the library is.
+//
+// Nodes are added one at a time as files are analyzed. A file that is
+// analyzed again gets a new node; the old one, like the node of a removed
+// file, stays in the graph as a waypoint but is never returned.
+//
+// The graph is saved next to the database with the generation it was built
+// at (see Database::load_similar_index).
+//-----------------------------------------------------------------------------
+class ANNIndex {
+public:
+
+    ANNIndex (void);
+
+    void clear (void);
+    void set_loaded (void);
+    bool is_loaded (void);
+    size_t size (void);
+
+    void insert (int64_t file_id, const float *embedding);
+    void remove (int64_t file_id);
+
+    // ids of up to k files nearest to embedding, nearest first
+    std::vector<int64_t> search (const float *embedding, size_t k, int64_t exclude = 0);
+
+    bool save (const fs::path &path, int64_t generation);
+    int64_t load (const fs::path &path);
+
+private:
+
+    struct Node {
+        int64_t file_id;
+        bool deleted;
+        std::vector<std::vector<uint32_t>> links;
+    };
+
+    // distance and node, ordered by distance
+    using Candidate = std::pair<float, uint32_t>;
+
+    const float *vector_of (uint32_t node) const {
+        return &vectors[static_cast<size_t>(node) * EMBEDDING_DIM];
+    }
+    static float distance (const float *a, const float *b);
+
+    int random_level (void);
+    uint32_t descend (const float *query, uint32_t entry, int from_level, int to_level) const;
+    std::vector<Candidate> search_level (const float *query, uint32_t entry, size_t ef,
+        int level) const;
+    std::vector<uint32_t> select_neighbors (std::vector<Candidate> candidates, size_t m) const;
+    void link (uint32_t from, uint32_t to, int level);
+
+    std::shared_mutex index_mtx;
+    std::vector<Node> nodes;
+    std::vector<float> vectors;
+    std::unordered_map<int64_t, uint32_t> node_of;
+    uint32_t entry_point;
+    int max_level;
+    std::mt19937 rng;
+    bool loaded;
+};
+
+#endif // ANN_INDEX_H
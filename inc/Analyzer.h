@@ -0,0 +1,79 @@
+#ifndef ANALYZER_H
+#define ANALYZER_H
+
+// Standard Library Inclusions
+#include <windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Project Inclusions
+#include "Database.h"
+#include "FileRecord.h"
+#include "FileQuery.h"
+#include "AudioFile.h"
+#include "FourierTX.h"
+#include "Metrics.h"
+#include "SystemUtilities.h"
+#include "ThreadSafeQueue.h"
+
+// Definitions
+namespace fs = std::filesystem;
+#define ANALYZER_BATCH_SIZE 64
+#define ANALYZER_IDLE_MS 2000
+#define ANALYZER_YIELD_MS 20
+
+// Audio analysis of a single file
+void analyze_file (struct AnalysisRecord *);
+
+//=============================================================================
+// Analyzer - background audio analysis of indexed files
+//=============================================================================
+// The scanner only records what can be read from a directory listing, so a
+// file is searchable as soon as it is inserted. The Analyzer then works
+// through the backlog of files with analysis_state = ANALYSIS_PENDING and
+// fills in their audio properties with UPDATEs.
+//
+// A fetch thread pages through the backlog in id order and hands files to
+// worker threads running at background priority. Results are committed in
+// batches by the fetch thread. Every thread backs off while an interactive
+// query is running (see Database::begin_query).
+//-----------------------------------------------------------------------------
+class Analyzer {
+public:
+
+    Analyzer (Database *db);
+    ~Analyzer (void);
+
+    void start (void);
+    void stop (void);
+
+    // new files were inserted; cut any idle wait short
+    void wake (void);
+
+private:
+
+    void yield (void);
+    void commit_results (void);
+    void fetch (void);
+    void work (void);
+
+    Database *db;
+    int num_workers;
+
+    std::atomic<bool> running;
+    std::mutex idle_mtx;
+    std::condition_variable idle_cv;
+    bool woken;
+
+    ThreadSafeQueue<struct AnalysisRecord> work_queue;
+    ThreadSafeQueue<struct AnalysisRecord> result_queue;
+    std::atomic<int> in_flight;
+
+    std::vector<std::thread> threads;
+};
+
+#endif // ANALYZER_H
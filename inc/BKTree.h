@@ -0,0 +1,50 @@
+#ifndef BK_TREE_H
+#define BK_TREE_H
+
+// Standard Library Inclusions
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Levenshtein distance between two words; it is a metric, which the tree
+// relies on
+int edit_distance (std::string_view a, std::string_view b);
+
+//=============================================================================
+// BKTree - metric tree for finding words within an edit distance
+//=============================================================================
+// Each child of a node is keyed by its distance to that node. By the
+// triangle inequality, a word within max_distance of the query can only sit
+// under children whose key is within max_distance of the query's distance to
+// the node, so a search skips most of the tree instead of comparing the
+// query with every word.
+//-----------------------------------------------------------------------------
+class BKTree {
+public:
+
+    BKTree (void);
+
+    void clear (void);
+    void insert (std::string_view word, int64_t id);
+
+    // calls visit with the id and distance of every word within max_distance
+    void search (std::string_view word, int max_distance,
+        const std::function<void (int64_t id, int distance)> &visit) const;
+
+    size_t size (void) const;
+
+private:
+
+    struct Node {
+        std::string word;
+        int64_t id;
+        std::vector<std::pair<int, uint32_t>> children;
+    };
+
+    std::vector<Node> nodes;
+};
+
+#endif // BK_TREE_H
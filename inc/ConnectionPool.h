@@ -0,0 +1,104 @@
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+// Standard Library Inclusions
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// External Inclusions
+#include "sqlite3.h"
+
+// Project Inclusions
+#include "StatementCache.h"
+#include "SystemUtilities.h"
+
+// Definitions
+#define DB_BUSY_TIMEOUT_MS 5000
+#define DB_MMAP_SIZE 268435456
+#define DB_WRITER_CACHE_KB 65536
+#define DB_READER_CACHE_KB 16384
+#define DB_PROGRESS_OPS 1000
+
+// a connection with the statements prepared on it
+struct Connection {
+    sqlite3 *db = nullptr;
+    StatementCache statements;
+};
+
+// Pragmas for connections to the WAL database
+void configure_writer (sqlite3 *db);
+void configure_reader (sqlite3 *db);
+
+// Statements the calling thread runs on reader connections stop with
+// SQLITE_INTERRUPT once *latest no longer equals generation, so a query
+// that has been superseded gives up its connection within a few thousand
+// instructions (see QueryExecutor). nullptr lets them run to completion.
+void set_query_generation (const std::atomic<uint64_t> *latest, uint64_t generation);
+
+//=============================================================================
+// ConnectionPool - read-only connections to a WAL database
+//=============================================================================
+// In WAL mode readers never block the writer and the writer never blocks
+// readers, but only if they use separate connections. The pool opens up to
+// max_connections read-only connections on demand; each is used by one
+// thread at a time, so they are opened without sqlite's connection mutex.
+// When all are in use, checkout waits for one to be returned.
+//-----------------------------------------------------------------------------
+class ConnectionPool {
+public:
+
+    ConnectionPool (void);
+    ~ConnectionPool (void);
+
+    void open (const std::string &db_name, int max_connections);
+    void close (void);
+
+    Connection *checkout (void);
+    void checkin (Connection *connection);
+
+private:
+
+    Connection *connect (void);
+
+    std::string db_name;
+    int max_connections;
+
+    std::mutex pool_mtx;
+    std::condition_variable pool_cv;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::vector<Connection *> idle;
+};
+
+//-----------------------------------------------------------------------------
+// PooledConnection
+// ----------------------------------------------------------------------------
+// A connection checked out of a pool for the current scope.
+//-----------------------------------------------------------------------------
+class PooledConnection {
+public:
+
+    PooledConnection (ConnectionPool *pool);
+    ~PooledConnection (void);
+
+    PooledConnection (const PooledConnection &) = delete;
+    PooledConnection &operator= (const PooledConnection &) = delete;
+
+    Connection *operator-> (void) const {
+        return connection;
+    }
+
+    explicit operator bool (void) const {
+        return connection != nullptr;
+    }
+
+private:
+
+    ConnectionPool *pool;
+    Connection *connection;
+};
+
+#endif // CONNECTION_POOL_H
@@ -3,12 +3,20 @@
 
 // Standard Library Inclusions
 #include <iostream>
+#include <algorithm>
 #include <windows.h>
 #include <string>
 #include <filesystem>
 #include <vector>
 #include <codecvt>
 #include <locale>
+#include <mutex>
+#include <atomic>
+#include <ctime>
+#include <cctype>
+#include <unordered_map>
+#include <functional>
+#include <cstring>
 
 // External Inclusions
 #include "sqlite3.h"
@@ -17,9 +25,66 @@
 #include "SystemUtilities.h"
 #include "ThreadSafeQueue.h"
 #include "FileRecord.h"
+#include "RecordPool.h"
+#include "KnownFiles.h"
+#include "StatementCache.h"
+#include "ConnectionPool.h"
+#include "TagIndex.h"
+#include "TrigramIndex.h"
+#include "IndexSnapshot.h"
+#include "FileQuery.h"
+#include "ANNIndex.h"
+#include "LibraryArchive.h"
+#include "QueryCache.h"
 
 // definitions
 namespace fs = std::filesystem;
+#define DB_READERS 4
+#define DB_SEARCH_LIMIT 500
+#define TAG_LOAD_BATCH 65536
+#define TRIGRAM_LOAD_BATCH 65536
+
+// files written by one multi-row upsert; at INSERT_COLUMNS parameters each
+// this stays under sqlite's default limit of 999
+#define INSERT_COLUMNS 12
+#define INSERT_BATCH_ROWS 64
+#define SEARCH_RANKED_MIN_LENGTH 3
+
+// the bpm and key of a file: the user's value if one was given, else the
+// analyzed one. Queries must spell these exactly as the indexes do.
+#define BPM_EXPR "COALESCE(NULLIF(user_bpm, 0), auto_bpm)"
+#define KEY_EXPR "COALESCE(NULLIF(user_key, 0), auto_key)"
+
+// meta keys of the generations the indexes saved next to the database are
+// checked against: the search indexes (see IndexSnapshot) and the similarity
+// graph (see ANNIndex)
+#define INDEX_GENERATION "index_generation"
+#define SIMILAR_GENERATION "similar_generation"
+
+// meta keys of one-time migrations that are flagged when the database is
+// opened and run later, off the startup path (see run_migrations)
+#define FTS_REBUILD_PENDING "fts_rebuild_pending"
+#define TAGS_MIGRATION_PENDING "tags_migration_pending"
+#define SIMILAR_LOAD_BATCH 4096
+
+// files deleted per transaction when a scan removes the ones that are gone,
+// and the free pages that make returning space to the file system worth it
+#define REMOVE_BATCH_FILES 4096
+#define VACUUM_FREE_PAGES 2048
+
+// where a paged search left off; a default cursor starts at the first page.
+// Unranked pages are found by key rather than offset, so each costs the same
+// however deep into the results it is. Ranked pages are found by position in
+// the order their query's first page read once (see ranked_matches).
+struct SearchCursor {
+	size_t position = 0;
+	int64_t file_id = 0;
+	bool exhausted = false;
+};
+
+// receives each row of a search, in order. The record is reused for the
+// next row, so anything kept must be copied.
+using RowVisitor = std::function<void (const struct FileRecord &file)>;
 
 char *concat_cstrs(int num_strings, ...);
 const char *wchar_to_char(const wchar_t *);
@@ -29,6 +94,7 @@ public:
 	
 	Database (void);
 	Database (const char *db_name);
+	~Database (void);
 	
 	void init (void);
 	
@@ -36,16 +102,128 @@ public:
 	int num_rows (const char *table_name);
 
 	bool entry_exists (const char *table_name, std::wstring *file_path);
+	void load_known_files (const fs::path &root, KnownFiles *known);
+	void load_known_directories (const fs::path &root, KnownDirectories *known);
+	void forget_removed_directories (KnownDirectories *known);
+
+	bool begin_scan (const fs::path &root);
+	void finish_scan (const fs::path &root);
 
 	void insert_file  (struct FileRecord *file);
-	void insert_files (ThreadSafeQueue<struct FileRecord *> *files);
+	int insert_files (ThreadSafeQueue<struct FileRecord *> *files,
+		ThreadSafeQueue<DirectoryTicket *> *completed_dirs = nullptr,
+		RecordPool *pool = nullptr);
+
+	void remove_path (const fs::path &path);
+	void rename_path (const fs::path &old_path, const fs::path &new_path);
+	int remove_files (const std::vector<std::wstring> &file_paths);
+
+	int select_pending_analysis (int64_t after_id, int limit, 
+		std::vector<struct AnalysisRecord> *pending);
+	void update_analysis (const std::vector<struct AnalysisRecord> &results);
+
+	int search_page (const char *query, SearchCursor *cursor, int limit,
+		const RowVisitor &visit);
+	void search_by_name (std::vector<struct FileRecord> *serach_result, const char *query,
+		int limit = DB_SEARCH_LIMIT);
+	void search_by_tags (std::vector<struct FileRecord> *search_result,
+		const std::vector<std::string> &all_of, const std::vector<std::string> &none_of,
+		int limit = DB_SEARCH_LIMIT);
+	void search_by_substring (std::vector<struct FileRecord> *search_result,
+		const char *query, int limit = DB_SEARCH_LIMIT);
+	void search_fuzzy (std::vector<struct FileRecord> *search_result,
+		const char *query, int limit = DB_SEARCH_LIMIT);
+	int query_files (const FileQuery &query, SearchCursor *cursor, int limit,
+		const RowVisitor &visit);
+	void search_similar (std::vector<struct FileRecord> *search_result,
+		const std::string &file_path, int limit = DB_SEARCH_LIMIT);
 
-	void search_by_name (std::vector<struct FileRecord> *serach_result, const char *query);
+	void run_migrations (void);
+	void load_search_indexes (void);
+	void load_similar_index (void);
+
+	int64_t export_library (const fs::path &root, const fs::path &archive_path);
+	int64_t import_library (const fs::path &archive_path, const fs::path &root);
+
+	void begin_query (void);
+	void end_query (void);
+	bool queries_active (void);
 
 private:
 
+	bool column_exists (const char *table_name, const char *column_name);
+	bool init_fts (void);
+	void init_tags (void);
+	bool migrate_tags (void);
+
+	int64_t intern_tag (std::string_view name, IndexChanges *changes);
+	void store_file_tags (int64_t file_id, std::string_view auto_tags,
+		std::string_view user_tags, IndexChanges *changes);
+	int64_t bump_generation (const char *key);
+	int64_t current_generation (const char *key);
+	int64_t meta_value (const char *key);
+	void set_meta (const char *key, int64_t value);
+	void apply_index_changes (IndexChanges *changes);
+	void update_indexes (const IndexChanges &changes);
+	void read_tag_index (void);
+	void read_name_index (void);
+
+	void delete_path_rows (const fs::path &path, IndexChanges *changes);
+	void vacuum_if_needed (void);
+
+	CandidateSet ranked_matches (const std::string &match);
+
+	void select_files (const std::vector<int64_t> &file_ids,
+		std::vector<struct FileRecord> *search_result);
+	bool exec (const char *sql);
+	void rollback (IndexChanges *changes);
+
+	// the only writer connection, in WAL mode
 	sqlite3 *db;
 
+	// every query runs through the cache (see StatementCache)
+	StatementCache statements;
+
+	// read-only connections for queries, so reads never wait on a write
+	// transaction (see ConnectionPool)
+	ConnectionPool readers;
+
+	// serializes every use of the writer by the scanner, watcher and analyzer
+	std::mutex write_mtx;
+
+	// false if sqlite lacks FTS5, or until an index created over an existing
+	// library is filled; searches then scan file names instead
+	std::atomic<bool> fts_enabled;
+
+	// tag ids interned by the writer, and scratch space for store_file_tags,
+	// all guarded by write_mtx
+	std::unordered_map<std::string, int64_t, TagHash, std::equal_to<>> tag_ids;
+	std::vector<int64_t> old_tags;
+	std::vector<int64_t> new_tags;
+
+	// whether freed pages can be returned without a full VACUUM, checked
+	// the first time there are enough of them (see vacuum_if_needed)
+	bool incremental_vacuum = false;
+
+	// posting lists for tag and substring searches
+	TagIndex tag_index;
+	TrigramIndex name_index;
+
+	// matches of recent tag and substring searches, refined as typing
+	// narrows them
+	QueryCache query_cache;
+
+	// the indexes saved next to the database, and the changes committed
+	// since, so they load without reading the tables (see IndexSnapshot)
+	fs::path snapshot_path;
+	DeltaLog delta_log;
+
+	// timbre embeddings of analyzed files, for "more like this" searches
+	ANNIndex similar_index;
+	fs::path similar_path;
+
+	std::atomic<int> active_queries;
+
 };
 
 #endif // DATABASE_H
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef FILE_QUERY_H
+#define FILE_QUERY_H
+
+// Standard Library Inclusions
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Definitions
+// musical keys are stored as 0 when unknown, 1-12 for the major keys and
+// 13-24 for the minor keys, counting semitones up from C
+#define KEY_UNKNOWN 0
+#define KEY_MAJOR(pitch) (1 + (pitch))
+#define KEY_MINOR(pitch) (13 + (pitch))
+
+// the major key sharing a minor key's notes and vice versa, e.g. A minor and
+// C major
+int relative_key (int key);
+
+// inclusive bounds on a numeric column
+struct QueryRange {
+    bool active = false;
+    int64_t min = 0;
+    int64_t max = 0;
+};
+
+//=============================================================================
+// FileQuery - filters combined into one search
+//=============================================================================
+// Each call adds a filter and returns the query, so filters chain:
+//
+//   FileQuery().text("pad").bpm(90, 100).key_or_relative(KEY_MINOR(9))
+//       .duration_ms(0, 2000)
+//
+// A file must pass every filter. Bpm and key filters compare the user's
+// value where one was given and the analyzed value otherwise. The query is
+// run by Database::query_files, which turns each filter into a predicate
+// with an index to serve it.
+//-----------------------------------------------------------------------------
+class FileQuery {
+public:
+
+    FileQuery &text (std::string_view words);
+    FileQuery &with_tag (std::string_view tag);
+    FileQuery &without_tag (std::string_view tag);
+    FileQuery &bpm (int min, int max);
+    FileQuery &key (int key);
+    FileQuery &key_or_relative (int key);
+    FileQuery &duration_ms (int64_t min, int64_t max);
+    FileQuery &file_size (int64_t min, int64_t max);
+
+    std::string words;
+    std::vector<std::string> all_of;
+    std::vector<std::string> none_of;
+    QueryRange bpm_range;
+    std::vector<int> keys;
+    QueryRange duration_range;
+    QueryRange size_range;
+};
+
+#endif // FILE_QUERY_H
@@ -4,27 +4,71 @@
 // Standard Library Inclusions
 #include <filesystem>
 #include <string>
+#include <string_view>
+#include <cstdint>
+#include <vector>
 
 namespace fs = std::filesystem;
 
+struct DirectoryTicket;
+
+// Text is UTF-8 throughout, which is also how sqlite stores it, so records
+// are bound and read back without transcoding. The name is not stored
+// separately; it is the tail of file_path starting at name_offset.
 struct FileRecord {
 
-    std::wstring file_path;
-    std::wstring file_name;
+    std::string file_path;
+    uint32_t name_offset;
+
+    std::string_view file_name (void) const {
+        return std::string_view(file_path).substr(name_offset);
+    }
 
     size_t file_size;
+    int64_t file_mtime;
     
     // user-submitted data
     int num_user_tags;
-    std::wstring user_tags;
+    std::string user_tags;
     int user_bpm;
     int user_key;
 
     // auto-generated data
     int num_auto_tags;
-    std::wstring auto_tags;
+    std::string auto_tags;
+    int auto_bpm;
+    int auto_key;
+
+    // directory the scanner found the file in, not stored
+    DirectoryTicket *ticket = nullptr;
+};
+
+// progress of the background analysis of a file
+enum AnalysisState {
+    ANALYSIS_PENDING = 0,
+    ANALYSIS_DONE = 1,
+    ANALYSIS_FAILED = 2
+};
+
+// results of analyzing the audio of an indexed file
+struct AnalysisRecord {
+
+    int64_t id;
+    std::string file_path;
+
+    // size and mtime the row had when the file was fetched for analysis,
+    // so results for contents that have since changed are not stored
+    size_t file_size;
+    int64_t file_mtime;
+
+    int state;
+    int duration_ms;
     int auto_bpm;
     int auto_key;
+
+    // timbre of the file (see FourierTX::timbre_embedding), empty if it
+    // could not be decoded
+    std::vector<float> embedding;
 };
 
 #endif // FILE_RECORD_H
\ No newline at end of file
@@ -7,10 +7,36 @@
 #include <numbers>
 #include <complex>
 #include <thread>
+#include <chrono>
 
 
 #define _PI 3.14159265358979323846
 
+// timbre embeddings: the mean and spread of log mel band energies over the
+// first EMBEDDING_MAX_SECONDS of a file
+#define MEL_BANDS 16
+#define EMBEDDING_DIM (2 * MEL_BANDS)
+#define EMBEDDING_FFT_SIZE 1024
+#define EMBEDDING_MAX_SECONDS 10
+#define MEL_MIN_HZ 30.0f
+#define MEL_MAX_HZ 16000.0f
+
+// tempo: the strongest period of the onset envelope between TEMPO_MIN_BPM
+// and TEMPO_MAX_BPM, in files of at least TEMPO_MIN_SECONDS
+#define TEMPO_FFT_SIZE 1024
+#define TEMPO_MIN_BPM 60
+#define TEMPO_MAX_BPM 180
+#define TEMPO_PREFERRED_BPM 120
+#define TEMPO_MIN_SECONDS 4
+#define TEMPO_MAX_SECONDS 30
+
+// key: the pitch class profile of KEY_MIN_HZ to KEY_MAX_HZ matched against
+// the Krumhansl-Kessler key profiles
+#define KEY_FFT_SIZE 8192
+#define KEY_MIN_HZ 100.0f
+#define KEY_MAX_HZ 5000.0f
+#define KEY_MAX_SECONDS 30
+
 using Complex = std::complex<float>;
 
 class FourierTX {
@@ -20,7 +46,7 @@ public:
         if (n <= 1) return;
 
         // Bit-reversal permutation
-        /*for (int i = 1, j = 0; i < n; ++i) {
+        for (int i = 1, j = 0; i < n; ++i) {
             int bit = n >> 1;
             while (j & bit) {
                 j ^= bit;
@@ -31,7 +57,7 @@ public:
             if (i < j) {
                 std::swap(a[i], a[j]);
             }
-        }*/
+        }
 
         // Cooley-Tukey iterative in-place FFT
         for (int len = 2; len <= n; len <<= 1) {
@@ -143,6 +169,317 @@ public:
         std::chrono::duration<double, std::milli> duration = end - start;
         //fprintf(stderr, "\r                    \r%f", duration.count());
     }
+
+    // timbre_embedding describes the sound of interleaved samples as
+    // EMBEDDING_DIM floats: the mean and standard deviation of each mel
+    // band's log energy across hann windowed frames. Band means are taken
+    // relative to their average so loudness does not count, and the vector
+    // is scaled to unit length so similar sounds are close in L2 distance.
+    // Leaves embedding empty if there is less than one frame of audio.
+    void timbre_embedding (const std::vector<float> &samples, int num_channels,
+        int sample_rate, std::vector<float> *embedding) {
+
+        embedding->clear();
+        if (num_channels < 1 || sample_rate < 1) {
+            return;
+        }
+
+        const int n = EMBEDDING_FFT_SIZE;
+        const int hop = n / 2;
+        size_t num_frames = samples.size() / num_channels;
+        size_t max_frames = static_cast<size_t>(sample_rate) * EMBEDDING_MAX_SECONDS;
+        if (num_frames > max_frames) {
+            num_frames = max_frames;
+        }
+        if (num_frames < static_cast<size_t>(n)) {
+            return;
+        }
+
+        // mix down to mono
+        std::vector<float> mono(num_frames);
+        for (size_t i = 0; i < num_frames; i++) {
+            float sum = 0.0f;
+            for (int c = 0; c < num_channels; c++) {
+                sum += samples[i * num_channels + c];
+            }
+            mono[i] = sum / num_channels;
+        }
+
+        // triangular filters spaced evenly on the mel scale
+        auto to_mel = [](float hz) { return 2595.0f * std::log10(1.0f + hz / 700.0f); };
+        auto to_hz = [](float mel) { return 700.0f * (std::pow(10.0f, mel / 2595.0f) - 1.0f); };
+        float max_hz = (std::min)(MEL_MAX_HZ, sample_rate / 2.0f);
+        float mel_low = to_mel(MEL_MIN_HZ);
+        float mel_high = to_mel(max_hz);
+        float edges[MEL_BANDS + 2];
+        for (int b = 0; b < MEL_BANDS + 2; b++) {
+            float hz = to_hz(mel_low + (mel_high - mel_low) * b / (MEL_BANDS + 1));
+            edges[b] = hz * n / sample_rate;
+        }
+
+        std::vector<float> window(n);
+        for (int i = 0; i < n; i++) {
+            window[i] = 0.5f - 0.5f * std::cos(2.0f * static_cast<float>(_PI) * i / (n - 1));
+        }
+
+        // running mean and variance of every band (Welford)
+        double mean[MEL_BANDS] = {};
+        double m2[MEL_BANDS] = {};
+        int count = 0;
+
+        std::vector<Complex> frame(n);
+        for (size_t start = 0; start + n <= num_frames; start += hop) {
+            for (int i = 0; i < n; i++) {
+                frame[i] = Complex(mono[start + i] * window[i], 0.0f);
+            }
+            this->fft(frame);
+
+            ++count;
+            for (int b = 0; b < MEL_BANDS; b++) {
+                float low = edges[b], center = edges[b + 1], high = edges[b + 2];
+                double energy = 0.0;
+                for (int k = static_cast<int>(std::ceil(low)); k <= static_cast<int>(high) && k <= n / 2; k++) {
+                    float weight = k <= center 
+                        ? (k - low) / (std::max)(center - low, 1e-6f) 
+                        : (high - k) / (std::max)(high - center, 1e-6f);
+                    if (weight > 0.0f) {
+                        energy += weight * std::norm(frame[k]);
+                    }
+                }
+                double value = std::log(energy + 1e-10);
+                double delta = value - mean[b];
+                mean[b] += delta / count;
+                m2[b] += delta * (value - mean[b]);
+            }
+        }
+
+        double average = 0.0;
+        for (int b = 0; b < MEL_BANDS; b++) {
+            average += mean[b] / MEL_BANDS;
+        }
+
+        embedding->resize(EMBEDDING_DIM);
+        double length = 0.0;
+        for (int b = 0; b < MEL_BANDS; b++) {
+            (*embedding)[b] = static_cast<float>(mean[b] - average);
+            (*embedding)[MEL_BANDS + b] = static_cast<float>(std::sqrt(m2[b] / count));
+        }
+        for (float value : *embedding) {
+            length += static_cast<double>(value) * value;
+        }
+        if (length > 0.0) {
+            float scale = static_cast<float>(1.0 / std::sqrt(length));
+            for (float &value : *embedding) {
+                value *= scale;
+            }
+        }
+    }
+
+    // detect_tempo estimates the tempo of interleaved samples in beats per
+    // minute. Onsets are found as the rise in spectral magnitude from one
+    // frame to the next, and the tempo is the lag at which that envelope
+    // best matches itself. Returns 0 for files too short to have a tempo,
+    // like one-shots, and for envelopes without a clear period.
+    int detect_tempo (const std::vector<float> &samples, int num_channels, int sample_rate) {
+
+        if (num_channels < 1 || sample_rate < 1) {
+            return 0;
+        }
+        const int n = TEMPO_FFT_SIZE;
+        const int hop = n / 2;
+        std::vector<float> mono;
+        mix_down(samples, num_channels, static_cast<size_t>(sample_rate) * TEMPO_MAX_SECONDS, &mono);
+        if (mono.size() < static_cast<size_t>(sample_rate) * TEMPO_MIN_SECONDS) {
+            return 0;
+        }
+
+        // spectral flux of hann windowed frames
+        std::vector<float> window = hann(n);
+        std::vector<float> previous(n / 2 + 1, 0.0f);
+        std::vector<double> envelope;
+        std::vector<Complex> frame(n);
+        for (size_t start = 0; start + n <= mono.size(); start += hop) {
+            for (int i = 0; i < n; i++) {
+                frame[i] = Complex(mono[start + i] * window[i], 0.0f);
+            }
+            this->fft(frame);
+            double flux = 0.0;
+            for (int k = 0; k <= n / 2; k++) {
+                float magnitude = std::log1p(std::abs(frame[k]));
+                if (magnitude > previous[k]) {
+                    flux += magnitude - previous[k];
+                }
+                previous[k] = magnitude;
+            }
+            envelope.push_back(flux);
+        }
+        envelope[0] = 0.0;
+
+        double mean = 0.0;
+        for (double value : envelope) {
+            mean += value / envelope.size();
+        }
+        for (double &value : envelope) {
+            value -= mean;
+        }
+
+        // autocorrelation over the lags of the tempo range
+        double frame_rate = static_cast<double>(sample_rate) / hop;
+        int min_lag = static_cast<int>(std::floor(frame_rate * 60.0 / TEMPO_MAX_BPM));
+        int max_lag = static_cast<int>(std::ceil(frame_rate * 60.0 / TEMPO_MIN_BPM));
+        if (min_lag < 1 || static_cast<size_t>(max_lag) * 2 >= envelope.size()) {
+            return 0;
+        }
+        std::vector<double> correlation(max_lag + 2, 0.0);
+        double energy = 0.0;
+        for (double value : envelope) {
+            energy += value * value;
+        }
+        if (energy <= 0.0) {
+            return 0;
+        }
+        for (int lag = min_lag - 1; lag <= max_lag + 1; lag++) {
+            double sum = 0.0;
+            for (size_t i = lag; i < envelope.size(); i++) {
+                sum += envelope[i] * envelope[i - lag];
+            }
+            correlation[lag] = sum / energy;
+        }
+
+        // a beat also repeats at twice its period, so periods are weighted
+        // towards TEMPO_PREFERRED_BPM to settle between the two
+        int best = 0;
+        double best_score = 0.0;
+        for (int lag = min_lag; lag <= max_lag; lag++) {
+            double octaves = std::log2(60.0 * frame_rate / lag / TEMPO_PREFERRED_BPM);
+            double score = correlation[lag] * std::exp(-0.5 * octaves * octaves);
+            if (best == 0 || score > best_score) {
+                best = lag;
+                best_score = score;
+            }
+        }
+        if (correlation[best] < 0.1) {
+            return 0;
+        }
+
+        // the peak between frames, by a parabola through its neighbours
+        double left = correlation[best - 1], peak = correlation[best], right = correlation[best + 1];
+        double curve = left - 2.0 * peak + right;
+        double lag = best + (curve < 0.0 ? 0.5 * (left - right) / curve : 0.0);
+        return static_cast<int>(std::lround(60.0 * frame_rate / lag));
+    }
+
+    // detect_key estimates the key of interleaved samples. The magnitude of
+    // every frequency bin is added to the pitch class it is nearest to, and
+    // the resulting profile is correlated with the major and minor key
+    // profile of each tonic. Sets pitch to the tonic (0 is C) and minor to
+    // the mode of the best match, or returns false if nothing is tonal
+    // enough to tell.
+    bool detect_key (const std::vector<float> &samples, int num_channels, int sample_rate,
+        int *pitch, bool *minor) {
+
+        static const double major_profile[12] = {
+            6.35, 2.23, 3.48, 2.33, 4.38, 4.09, 2.52, 5.19, 2.39, 3.66, 2.29, 2.88
+        };
+        static const double minor_profile[12] = {
+            6.33, 2.68, 3.52, 5.38, 2.60, 3.53, 2.54, 4.75, 3.98, 2.69, 3.34, 3.17
+        };
+
+        if (num_channels < 1 || sample_rate < 1) {
+            return false;
+        }
+        const int n = KEY_FFT_SIZE;
+        std::vector<float> mono;
+        mix_down(samples, num_channels, static_cast<size_t>(sample_rate) * KEY_MAX_SECONDS, &mono);
+        if (mono.size() < static_cast<size_t>(n)) {
+            return false;
+        }
+
+        // pitch class of every bin in range, -1 outside it
+        std::vector<int> pitch_class(n / 2 + 1, -1);
+        for (int k = 1; k <= n / 2; k++) {
+            float hz = static_cast<float>(k) * sample_rate / n;
+            if (hz >= KEY_MIN_HZ && hz <= KEY_MAX_HZ) {
+                int midi = static_cast<int>(std::lround(69.0 + 12.0 * std::log2(hz / 440.0)));
+                pitch_class[k] = midi % 12;
+            }
+        }
+
+        std::vector<float> window = hann(n);
+        double chroma[12] = {};
+        std::vector<Complex> frame(n);
+        for (size_t start = 0; start + n <= mono.size(); start += n / 2) {
+            for (int i = 0; i < n; i++) {
+                frame[i] = Complex(mono[start + i] * window[i], 0.0f);
+            }
+            this->fft(frame);
+            for (int k = 1; k <= n / 2; k++) {
+                if (pitch_class[k] >= 0) {
+                    chroma[pitch_class[k]] += std::abs(frame[k]);
+                }
+            }
+        }
+
+        double best = -1.0;
+        for (int tonic = 0; tonic < 12; tonic++) {
+            for (int mode = 0; mode < 2; mode++) {
+                const double *profile = mode ? minor_profile : major_profile;
+                double r = correlate(chroma, profile, tonic);
+                if (r > best) {
+                    best = r;
+                    *pitch = tonic;
+                    *minor = (mode == 1);
+                }
+            }
+        }
+        return best >= 0.5;
+    }
+
+private:
+
+    // mix_down averages the channels of up to max_frames interleaved frames
+    static void mix_down (const std::vector<float> &samples, int num_channels, size_t max_frames,
+        std::vector<float> *mono) {
+        size_t num_frames = (std::min)(samples.size() / num_channels, max_frames);
+        mono->resize(num_frames);
+        for (size_t i = 0; i < num_frames; i++) {
+            float sum = 0.0f;
+            for (int c = 0; c < num_channels; c++) {
+                sum += samples[i * num_channels + c];
+            }
+            (*mono)[i] = sum / num_channels;
+        }
+    }
+
+    static std::vector<float> hann (int n) {
+        std::vector<float> window(n);
+        for (int i = 0; i < n; i++) {
+            window[i] = 0.5f - 0.5f * std::cos(2.0f * static_cast<float>(_PI) * i / (n - 1));
+        }
+        return window;
+    }
+
+    // Pearson correlation of a pitch class profile with a key profile whose
+    // tonic is rotated to tonic
+    static double correlate (const double *chroma, const double *profile, int tonic) {
+        double chroma_mean = 0.0, profile_mean = 0.0;
+        for (int i = 0; i < 12; i++) {
+            chroma_mean += chroma[i] / 12.0;
+            profile_mean += profile[i] / 12.0;
+        }
+        double sum = 0.0, chroma_sq = 0.0, profile_sq = 0.0;
+        for (int i = 0; i < 12; i++) {
+            double x = chroma[(tonic + i) % 12] - chroma_mean;
+            double y = profile[i] - profile_mean;
+            sum += x * y;
+            chroma_sq += x * x;
+            profile_sq += y * y;
+        }
+        if (chroma_sq <= 0.0 || profile_sq <= 0.0) {
+            return 0.0;
+        }
+        return sum / std::sqrt(chroma_sq * profile_sq);
+    }
 };
 
 #endif // Fourier_TX_h
\ No newline at end of file
@@ -0,0 +1,149 @@
+#ifndef INDEX_SNAPSHOT_H
+#define INDEX_SNAPSHOT_H
+
+// Standard Library Inclusions
+#include <windows.h>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Project Inclusions
+#include "SystemUtilities.h"
+#include "TagIndex.h"
+#include "TrigramIndex.h"
+
+// Definitions
+namespace fs = std::filesystem;
+#define SNAPSHOT_MAGIC 0x31504E5350415301ULL
+#define SNAPSHOT_VERSION 1
+#define DELTA_MAGIC 0x41544C44u
+#define DELTA_LOG_COMPACT_BYTES (64ULL * 1024 * 1024)
+
+// in-memory index updates made by one transaction. generation is the value
+// of the database's index generation once the transaction commits.
+struct IndexChanges {
+    int64_t generation = 0;
+    std::vector<std::pair<int64_t, std::string>> tags_named;
+    std::vector<TagPosting> tags_added;
+    std::vector<TagPosting> tags_removed;
+    std::vector<std::pair<int64_t, std::string>> names_added;
+    std::vector<int64_t> files_removed;
+
+    void clear (void);
+};
+
+//=============================================================================
+// IndexSnapshot - the in-memory search indexes saved as flat arrays
+//=============================================================================
+// Loading TagIndex and TrigramIndex from sqlite means reading every tag row
+// and splitting every name again. A snapshot instead stores their contents
+// in a columnar layout that is memory mapped and copied into place:
+//
+//   header      magic, version, generation, then the offset and element count
+//               of every section
+//   tags        tag ids, name offsets and the concatenated tag names
+//   postings    tag ids, list offsets and the concatenated file ids of the
+//               TagIndex posting lists
+//   names       file ids, name offsets and the concatenated folded names
+//   trigrams    trigram keys, list offsets and the concatenated file ids of
+//               the TrigramIndex posting lists
+//
+// Every section starts on an 8 byte boundary, so arrays are used in place.
+// A snapshot is written whole to a temporary file and renamed over the old
+// one, so a crash never leaves a partial snapshot behind.
+//-----------------------------------------------------------------------------
+enum SnapshotSection {
+    SECTION_TAG_IDS,
+    SECTION_TAG_NAME_OFFSETS,
+    SECTION_TAG_NAMES,
+    SECTION_LIST_TAG_IDS,
+    SECTION_LIST_OFFSETS,
+    SECTION_LIST_FILE_IDS,
+    SECTION_FILE_IDS,
+    SECTION_NAME_OFFSETS,
+    SECTION_NAMES,
+    SECTION_TRIGRAMS,
+    SECTION_TRIGRAM_OFFSETS,
+    SECTION_TRIGRAM_FILE_IDS,
+    NUM_SNAPSHOT_SECTIONS
+};
+
+struct SnapshotHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t num_sections;
+    int64_t generation;
+    uint64_t offsets[NUM_SNAPSHOT_SECTIONS];
+    uint64_t counts[NUM_SNAPSHOT_SECTIONS];
+};
+
+class IndexSnapshot {
+public:
+
+    IndexSnapshot (void);
+    ~IndexSnapshot (void);
+
+    bool open (const fs::path &path);
+    void close (void);
+
+    int64_t generation (void) const;
+    void restore (TagIndex *tags, TrigramIndex *names) const;
+
+    static bool write (const fs::path &path, int64_t generation, 
+        TagIndex *tags, TrigramIndex *names);
+
+private:
+
+    bool validate (void) const;
+
+    template <typename T>
+    const T *section (SnapshotSection s) const {
+        return reinterpret_cast<const T *>(view + header->offsets[s]);
+    }
+
+    HANDLE file_handle;
+    HANDLE map_handle;
+    const uint8_t *view;
+    size_t view_size;
+    const SnapshotHeader *header;
+};
+
+//=============================================================================
+// DeltaLog - index changes committed since the last snapshot
+//=============================================================================
+// Every transaction that changes the indexes appends one record, so the
+// snapshot plus the log always reproduces the indexes without sqlite.
+// Records carry consecutive generations and a checksum; replay stops at a
+// gap or at a record torn by a crash, and the caller then compares the
+// generation it reached with the database's to decide whether the indexes
+// can be trusted.
+//-----------------------------------------------------------------------------
+class DeltaLog {
+public:
+
+    DeltaLog (void);
+    ~DeltaLog (void);
+
+    bool open (const fs::path &path);
+    void close (void);
+
+    void append (const IndexChanges &changes);
+    int64_t replay (int64_t after_generation, 
+        const std::function<void (IndexChanges &)> &apply);
+    void truncate (void);
+
+    uint64_t size (void) const;
+
+private:
+
+    fs::path path;
+    std::ofstream file;
+    uint64_t file_size;
+    std::vector<uint8_t> buffer;
+};
+
+#endif // INDEX_SNAPSHOT_H
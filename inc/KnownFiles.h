@@ -0,0 +1,147 @@
+#ifndef KNOWN_FILES_H
+#define KNOWN_FILES_H
+
+// Standard Library Inclusions
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//=============================================================================
+// KnownFiles - snapshot of the indexed files under a scan root
+//=============================================================================
+// The table is filled once by Database::load_known_files before the walkers
+// start and is read-only afterwards, so lookups from walker threads take no
+// locks. Each lookup marks its slot as seen; slots that are never seen by the
+// end of a scan belong to files that no longer exist on disk, unless the
+// walker skipped their directory because it was unchanged (see
+// KnownDirectories).
+//-----------------------------------------------------------------------------
+
+enum class FileStatus {
+    NEW,
+    MODIFIED,
+    UNCHANGED
+};
+
+class KnownFiles {
+public:
+
+    KnownFiles (void);
+
+    // loading (single threaded)
+    void reserve (size_t num_files);
+    void add (const wchar_t *file_path, size_t path_len, int64_t size, int64_t mtime);
+
+    // lookup (lock-free, safe from many threads)
+    FileStatus check (const std::wstring &file_path, int64_t size, int64_t mtime);
+
+    // directories that were skipped by the walker, and directories that
+    // could not be listed, whose whole subtree went unseen
+    void mark_pruned (const std::wstring &dir_path);
+    void mark_pruned_tree (const std::wstring &dir_path);
+
+    // files that were loaded but never checked
+    void for_each_missing (const std::function<void (const std::wstring &)> &visit);
+
+    size_t size (void) const;
+
+private:
+
+    struct Slot {
+        uint64_t hash;
+        uint64_t dir_hash;
+        uint32_t path_offset;
+        uint32_t path_len;
+        int64_t size;
+        int64_t mtime;
+    };
+
+    size_t find_slot (uint64_t hash, const wchar_t *file_path, size_t path_len) const;
+    void grow (size_t capacity);
+
+    std::vector<Slot> slots;
+    std::unique_ptr<std::atomic<uint8_t>[]> seen;
+    std::wstring paths;
+    size_t num_entries;
+    size_t mask;
+
+    std::mutex pruned_mtx;
+    std::unordered_set<uint64_t> pruned;
+    std::vector<std::wstring> pruned_trees;
+};
+
+//=============================================================================
+// KnownDirectories - snapshot of the directory states under a scan root
+//=============================================================================
+// A directory's modification time changes whenever an entry is created,
+// removed or renamed in it. If the stored time still matches, the walker
+// skips listing the directory and descends into its recorded subdirectories
+// instead. Like KnownFiles, the snapshot is read-only during a walk.
+//
+// A directory's state is only stored once every file queued from it has been
+// inserted (see DirectoryTicket), in the same transaction as its last file.
+// The directories table is therefore a journal of completed work: if a scan
+// is interrupted, the next scan prunes every completed directory and only
+// lists the ones that were still in flight.
+//-----------------------------------------------------------------------------
+
+struct DirectoryState {
+    std::wstring dir_path;
+    std::wstring parent_path;
+    int64_t mtime;
+    int64_t num_entries;
+};
+
+// A listed directory travels with its queued files through the pipeline.
+// remaining counts the files not yet inserted plus one reference held by the
+// walker until listing is done; whoever releases the last reference hands
+// the ticket to the insert stage, which stores the state and frees it.
+// A ticket is abandoned when some of its files will never be inserted (the
+// scan was cancelled); it is then freed without storing anything, so the
+// directory is listed again by the next scan.
+struct DirectoryTicket {
+    DirectoryState state;
+    std::vector<std::wstring> subdirs;
+    std::atomic<int> remaining;
+    std::atomic<bool> abandoned;
+};
+
+// drops one reference, returns true if it was the last
+bool release_ticket (DirectoryTicket *ticket);
+
+class KnownDirectories {
+public:
+
+    // loading (single threaded)
+    void add (const DirectoryState &state);
+    void link (void);
+
+    // lookup (lock-free, safe from many threads)
+    bool unchanged (const std::wstring &dir_path, int64_t mtime,
+        std::vector<std::wstring> *subdirs);
+
+    // directories that were loaded but never reached
+    void for_each_removed (const std::function<void (const std::wstring &)> &visit);
+
+private:
+
+    struct Entry {
+        std::wstring parent_path;
+        int64_t mtime;
+        int64_t num_entries;
+        std::vector<std::wstring> subdirs;
+        std::atomic<uint8_t> visited;
+    };
+
+    std::unordered_map<std::wstring, Entry> dirs;
+};
+
+uint64_t hash_path (const wchar_t *file_path, size_t path_len);
+
+#endif // KNOWN_FILES_H
@@ -0,0 +1,113 @@
+#ifndef LIBRARY_ARCHIVE_H
+#define LIBRARY_ARCHIVE_H
+
+// Standard Library Inclusions
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Project Inclusions
+#include "FileRecord.h"
+#include "SystemUtilities.h"
+
+// Definitions
+namespace fs = std::filesystem;
+#define ARCHIVE_MAGIC 0x314256494C504153ULL
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_BLOCK_BYTES (256 * 1024)
+#define ARCHIVE_MAX_BLOCK_BYTES (64 * 1024 * 1024)
+
+// one exported file: its record with file_path relative to the exported
+// root, using '/' as the separator, and its analysis results
+struct ArchiveRecord {
+    struct FileRecord file;
+    int duration_ms;
+    int analysis_state;
+    std::vector<float> embedding;
+};
+
+//=============================================================================
+// LibraryArchive - portable export of the indexed library
+//=============================================================================
+// The database stores absolute paths, so it cannot be moved to a machine
+// where the samples live under another root. An archive holds the files under
+// one root with paths relative to it, and is imported under any other root
+// in place of a rescan and reanalysis.
+//
+//   header      magic, version
+//   blocks      each a header of payload size, record count and CRC32 of the
+//               payload, then the payload
+//   end         a block header with no records
+//
+// Records are written in path order. Each path is front coded against the
+// previous one in its block, keeping only the length of the shared prefix
+// and the rest, so the directories a block shares are stored once. Numbers
+// are varints, mtimes are zigzag deltas from the previous record, and every
+// block starts afresh so it can be checked and decoded on its own.
+// An archive is written to a temporary file and renamed into place.
+//-----------------------------------------------------------------------------
+struct ArchiveHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct ArchiveBlockHeader {
+    uint32_t payload_size;
+    uint32_t num_records;
+    uint32_t checksum;
+};
+
+uint32_t crc32 (const void *data, size_t size);
+
+class ArchiveWriter {
+public:
+
+    ~ArchiveWriter (void);
+
+    bool open (const fs::path &path);
+    void add (const struct ArchiveRecord &record);
+    bool finish (void);
+
+private:
+    void flush_block (void);
+
+    fs::path path;
+    fs::path temp_path;
+    std::ofstream out;
+
+    std::string block;
+    uint32_t block_records = 0;
+    std::string previous_path;
+    int64_t previous_mtime = 0;
+};
+
+class ArchiveReader {
+public:
+
+    bool open (const fs::path &path);
+
+    // false once the archive ends or turns out to be damaged; failed()
+    // tells the two apart
+    bool next (struct ArchiveRecord *record);
+    bool failed (void) const;
+
+private:
+    bool read_block (void);
+    bool decode (struct ArchiveRecord *record);
+
+    std::ifstream in;
+    bool done = false;
+    bool damaged = false;
+
+    std::string block;
+    size_t position = 0;
+    uint32_t block_records = 0;
+    std::string previous_path;
+    int64_t previous_mtime = 0;
+};
+
+#endif // LIBRARY_ARCHIVE_H
@@ -0,0 +1,133 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// Standard Library Inclusions
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+//=============================================================================
+// Metrics - lock-free instrumentation of the scan pipeline
+//=============================================================================
+// Every metric is a fixed set of atomics, so recording never takes a lock and
+// the registry can be read or dumped as JSON at any time, including while a
+// scan is running.
+//-----------------------------------------------------------------------------
+
+// monotonically increasing count
+class Counter {
+public:
+    void add (uint64_t n = 1);
+    uint64_t get (void) const;
+    void reset (void);
+
+private:
+    std::atomic<uint64_t> value{0};
+};
+
+// current level with its high-water mark
+class Gauge {
+public:
+    void set (int64_t level);
+    int64_t get (void) const;
+    int64_t peak (void) const;
+    void reset (void);
+
+private:
+    std::atomic<int64_t> value{0};
+    std::atomic<int64_t> max_value{0};
+};
+
+// HDR-style histogram of nanosecond latencies. Values below 2^SUB_BITS are
+// counted exactly; above that each power of two is split into 2^SUB_BITS
+// linear sub-buckets, bounding the relative error of any percentile to about
+// 1 / 2^SUB_BITS.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_NUM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+class LatencyHistogram {
+public:
+    void record (uint64_t nanoseconds);
+    uint64_t count (void) const;
+    uint64_t max_latency (void) const;
+    double mean (void) const;
+    uint64_t percentile (double p) const;
+    void reset (void);
+
+private:
+    static int bucket_index (uint64_t value);
+    static uint64_t bucket_value (int index);
+
+    std::atomic<uint64_t> buckets[HISTOGRAM_NUM_BUCKETS] = {};
+    std::atomic<uint64_t> total_count{0};
+    std::atomic<uint64_t> total_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+};
+
+// stages of scan_directory and the analyzer
+enum ScanStage {
+    STAGE_WALK,
+    STAGE_REQUIRES_PROCESSING,
+    STAGE_PARSE,
+    STAGE_ANALYZE,
+    STAGE_INSERT,
+    NUM_SCAN_STAGES
+};
+
+// items passed through a stage and the latency of each unit of work
+struct StageMetrics {
+    Counter items;
+    LatencyHistogram latency;
+};
+
+class Metrics {
+public:
+
+    Metrics (void);
+
+    StageMetrics stages[NUM_SCAN_STAGES];
+
+    Gauge proc_queue_depth;
+    Gauge insrt_queue_depth;
+    Gauge analysis_queue_depth;
+
+    Counter dirs_pruned;
+    Counter files_new;
+    Counter files_modified;
+    Counter files_missing;
+    Counter records_allocated;
+
+    // clear every metric and restart the throughput clock
+    void reset (void);
+
+    std::string to_json (void) const;
+
+private:
+    std::atomic<int64_t> start_ns;
+};
+
+// process wide registry
+extern Metrics metrics;
+
+//-----------------------------------------------------------------------------
+// ScopedTimer
+// ----------------------------------------------------------------------------
+// Records the lifetime of the timer as one item of a stage.
+//-----------------------------------------------------------------------------
+class ScopedTimer {
+public:
+    ScopedTimer (ScanStage stage, uint64_t items = 1);
+    ~ScopedTimer (void);
+
+    // for work whose size is only known once it is done
+    void set_items (uint64_t items);
+
+private:
+    ScanStage stage;
+    uint64_t items;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif // METRICS_H
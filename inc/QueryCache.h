@@ -0,0 +1,70 @@
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+// Standard Library Inclusions
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Definitions
+#define QUERY_CACHE_BYTES (32 * 1024 * 1024)
+
+// the ids of every file a query matched, shared by the cache and the
+// searches reading it; in id order, except ranked name searches keep theirs
+// best match first (see Database::ranked_matches)
+using CandidateSet = std::shared_ptr<const std::vector<int64_t>>;
+
+//=============================================================================
+// QueryCache - candidate sets of recent searches
+//=============================================================================
+// Typing refines a search one keystroke at a time: "kic" becomes "kick", a
+// tag is added to a tag search. Every file the refined search matches was
+// matched by the earlier one, so instead of searching the whole index again
+// its candidates are filtered, which reads only the few the earlier search
+// left.
+//
+// Entries are keyed by a string each search kind builds from its query, and
+// kept in least recently used order within max_bytes. Any change to the
+// indexes empties the cache; the epoch makes sure a set computed before the
+// change is not stored after it.
+//-----------------------------------------------------------------------------
+class QueryCache {
+public:
+
+    QueryCache (size_t max_bytes = QUERY_CACHE_BYTES);
+
+    CandidateSet find (const std::string &key);
+
+    // the smallest set among the cached queries that refines accepts
+    CandidateSet find_refinable (const std::function<bool (const std::string &key)> &refines);
+
+    // stores ids for key unless the cache was cleared since epoch() was read
+    void insert (const std::string &key, CandidateSet ids, uint64_t epoch);
+
+    uint64_t epoch (void);
+    void clear (void);
+
+private:
+
+    struct Entry {
+        std::string key;
+        CandidateSet ids;
+        size_t bytes;
+    };
+
+    std::mutex cache_mtx;
+
+    // most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> by_key;
+    size_t num_bytes;
+    size_t max_bytes;
+    uint64_t current_epoch;
+};
+
+#endif // QUERY_CACHE_H
@@ -0,0 +1,57 @@
+#ifndef QUERY_EXECUTOR_H
+#define QUERY_EXECUTOR_H
+
+// Standard Library Inclusions
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Project Inclusions
+#include "ConnectionPool.h"
+
+//=============================================================================
+// QueryExecutor - interactive queries off the ui thread
+//=============================================================================
+// Runs one query at a time on its own thread, so the ui never waits on the
+// database. Each submitted query is given a new generation and supersedes
+// every earlier one: a query that has not started yet is dropped, and the
+// statements of the one running are interrupted at their next progress check
+// (see set_query_generation). A query learns it was superseded through
+// is_current, and must not publish its results once it is not.
+//-----------------------------------------------------------------------------
+class QueryExecutor {
+public:
+
+    using Query = std::function<void (uint64_t generation)>;
+
+    QueryExecutor (void);
+    ~QueryExecutor (void);
+
+    void start (void);
+    void stop (void);
+
+    // schedules query in place of any earlier one and returns its generation
+    uint64_t submit (Query query);
+
+    // false once a later query has been submitted
+    bool is_current (uint64_t generation) const;
+
+private:
+    void run (void);
+
+    std::thread thread;
+    std::mutex executor_mtx;
+    std::condition_variable executor_cv;
+    bool running;
+
+    // guarded by executor_mtx
+    Query pending;
+    uint64_t pending_generation;
+
+    std::atomic<uint64_t> latest;
+};
+
+#endif // QUERY_EXECUTOR_H
@@ -0,0 +1,50 @@
+#ifndef RECORD_POOL_H
+#define RECORD_POOL_H
+
+// Standard Library Inclusions
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Project Inclusions
+#include "FileRecord.h"
+#include "Metrics.h"
+
+// Definitions
+#define RECORD_SLAB_SIZE 512
+
+//=============================================================================
+// RecordPool - recycled FileRecords for the scan pipeline
+//=============================================================================
+// FileRecords are allocated RECORD_SLAB_SIZE at a time and never freed until
+// the pool is destroyed. The processing stage acquires records and the insert
+// stage hands them back a whole transaction at a time, so the two threads
+// meet on the pool's lock once per batch instead of in malloc/free for every
+// file. A recycled record keeps the capacity of its strings, so once the
+// pool is warm, filling a record usually allocates nothing at all.
+//
+// acquire must only be called from one thread (the processing stage);
+// release may be called from any thread.
+//-----------------------------------------------------------------------------
+class RecordPool {
+public:
+
+    RecordPool (void);
+
+    struct FileRecord *acquire (void);
+    void release (std::vector<struct FileRecord *> *records);
+
+private:
+
+    void grow (void);
+
+    std::vector<std::unique_ptr<struct FileRecord[]>> slabs;
+
+    // records owned by the acquiring thread, taken without locking
+    std::vector<struct FileRecord *> local;
+
+    std::mutex free_mtx;
+    std::vector<struct FileRecord *> free_list;
+};
+
+#endif // RECORD_POOL_H
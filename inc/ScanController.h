@@ -0,0 +1,69 @@
+#ifndef SCAN_CONTROLLER_H
+#define SCAN_CONTROLLER_H
+
+// Standard Library Inclusions
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Definitions
+namespace fs = std::filesystem;
+
+class Database;
+
+//=============================================================================
+// ScanController - run a scan in the background and steer it
+//=============================================================================
+// start runs scan_directories on its own thread and returns immediately, so
+// the ui is never blocked by a scan. Every stage of the pipeline calls
+// checkpoint between units of work: walkers before each directory and
+// entry, the processing stage before each file and the insert stage before
+// each transaction. A paused scan blocks in checkpoint. A cancelled scan
+// stops walking, drops the files still waiting to be processed and commits
+// the ones already processed, so the database is left exactly as an
+// interrupted scan would leave it and the next scan resumes from there.
+//-----------------------------------------------------------------------------
+class ScanController {
+public:
+
+    // called on the scan thread when a scan ends; false if it was cancelled
+    typedef std::function<void (bool completed)> FinishedCallback;
+
+    ScanController (Database *db);
+    ~ScanController (void);
+
+    bool start (const std::vector<fs::path> &roots, FinishedCallback on_finished = nullptr);
+    void pause (void);
+    void resume (void);
+    void cancel (void);
+
+    // blocks until the current scan has ended
+    void wait (void);
+
+    bool is_running (void) const;
+    bool is_paused (void) const;
+    bool is_cancelled (void) const;
+
+    // called by the pipeline; blocks while paused, false once cancelled
+    bool checkpoint (void);
+
+private:
+
+    void run (std::vector<fs::path> roots, FinishedCallback on_finished);
+
+    Database *db;
+    std::thread scan_thread;
+
+    std::atomic<bool> running;
+    std::atomic<bool> paused;
+    std::atomic<bool> cancelled;
+
+    std::mutex state_mtx;
+    std::condition_variable state_cv;
+};
+
+#endif // SCAN_CONTROLLER_H
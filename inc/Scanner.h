@@ -5,22 +5,47 @@
 #include <iostream>
 #include <cwctype>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <filesystem>
 #include <thread>
+#include <memory>
 #include <mutex>
 
 // Project Inclusions
 #include "Database.h"
+#include "KnownFiles.h"
 #include "SystemUtilities.h"
 #include "ThreadSafeQueue.h"
 #include "FileRecord.h"
+#include "RecordPool.h"
+#include "StorageDevice.h"
+#include "ScanController.h"
 #include "AudioFile.h"
 #include "FourierTX.h"
+#include "Metrics.h"
 
 // Definitions
 namespace fs = std::filesystem;
 #define TRANSACTION_SIZE 2048
+#define TRANSACTION_TIMEOUT_MS 1000
+
+// Snapshot of what is already indexed under a scan root. Listed directories
+// are journalled through completed_dirs when it is set (see DirectoryTicket).
+struct ScanIndex {
+    fs::path root;
+    StorageDevice *device = nullptr;
+    ScanController *control = nullptr;
+    KnownFiles files;
+    KnownDirectories dirs;
+    ThreadSafeQueue<DirectoryTicket *> *completed_dirs = nullptr;
+};
+
+// A file queued for processing and the directory it was listed in
+struct ScanItem {
+    fs::directory_entry entry;
+    DirectoryTicket *ticket = nullptr;
+};
 
 // Delimiter check function
 bool char_is_delimiter (char);
@@ -29,40 +54,56 @@ bool char_is_delimiter (char);
 char to_lower (char);
 
 // Tag generation function
-std::vector<std::string> generate_auto_tags (const std::string &);
+std::vector<std::wstring> generate_auto_tags (std::wstring);
 
 // Tag concatenation function
-std::string concatenate_tags (const std::vector<std::string> &);
+std::wstring concatenate_tags (const std::vector<std::wstring> &);
+
+// Tag generation into an existing string
+int write_auto_tags (std::string_view, std::string *);
 
 // File processing function
-struct FileRecord *process_file (const fs::directory_entry &);
+void process_file (const fs::directory_entry &, struct FileRecord *);
 
 // File extension validation
-inline bool validate_file_extension (const fs::directory_entry *);
+bool validate_file_extension (const fs::directory_entry *);
 
 // Sub-directory finding function
 std::vector<fs::path> find_sub_dirs (const fs::path &);
 
+// Modification time of a directory entry
+int64_t file_mtime (const fs::directory_entry &);
+
 // File processing requirement check
-bool requires_processing (Database *, const fs::directory_entry *);
+bool requires_processing (KnownFiles *, const fs::directory_entry *);
 
 // File queueing functions
-void queue_files (Database *, const fs::path &,
-                ThreadSafeQueue<fs::directory_entry> *);
+void queue_files (ScanIndex *, const fs::path &,
+                ThreadSafeQueue<ScanItem> *);
 
-void queue_all_files (Database *, const fs::path &, 
-                ThreadSafeQueue<fs::directory_entry> *);
+void queue_device_files (Database *, std::vector<ScanIndex *>,
+                ThreadSafeQueue<ScanItem> *);
+
+// Removal of the indexed files a walk of index->root did not come across
+int remove_missing_files (Database *, ScanIndex *);
 
 // Processing queued files function
 void process_queued_files (Database *,
-        ThreadSafeQueue<fs::directory_entry> *,
+        ScanController *,
+        RecordPool *,
+        ThreadSafeQueue<ScanItem> *,
         ThreadSafeQueue<struct FileRecord *> *);
 
 // Insert processed files function
 void insert_processed_files (Database *,
-    ThreadSafeQueue<struct FileRecord *> *);
-
-// Directory scanning function
+    ScanController *,
+    RecordPool *,
+    ThreadSafeQueue<struct FileRecord *> *,
+    ThreadSafeQueue<DirectoryTicket *> *);
+
+// Directory scanning functions
+void scan_directories (Database *, const std::vector<fs::path> &,
+    ScanController * = nullptr);
 void scan_directory (Database *, const fs::path &);
 
 #endif // SCANNER_H
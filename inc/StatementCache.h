@@ -0,0 +1,93 @@
+#ifndef STATEMENT_CACHE_H
+#define STATEMENT_CACHE_H
+
+// Standard Library Inclusions
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// External Inclusions
+#include "sqlite3.h"
+
+// Project Inclusions
+#include "SystemUtilities.h"
+
+//=============================================================================
+// StatementCache - prepared statements reused across calls
+//=============================================================================
+// Statements are keyed by their SQL text, so every call with the same query
+// shape shares the same compiled statements. A prepared statement can only
+// be stepped by one thread at a time, so ownership is explicit:
+//  - an idle statement belongs to the cache
+//  - checkout hands a statement to the calling thread, preparing a new one
+//    if every statement for that SQL is checked out by other threads
+//  - checkin resets the statement, clears its bindings and gives it back
+// The cache lock is only held to move a pointer in or out of the idle list,
+// never while a statement runs. CachedStatement does the checkout and
+// checkin for the duration of a scope.
+//
+// Every statement is finalized when the cache is closed, which must happen
+// before the connection is closed.
+//-----------------------------------------------------------------------------
+class StatementCache {
+public:
+
+    StatementCache (void);
+    ~StatementCache (void);
+
+    void open (sqlite3 *db);
+    void close (void);
+
+    sqlite3_stmt *checkout (std::string_view sql);
+    void checkin (std::string_view sql, sqlite3_stmt *stmt);
+
+private:
+
+    // lets std::string keys be found by string_view without a copy
+    struct SqlHash {
+        using is_transparent = void;
+        size_t operator() (std::string_view sql) const {
+            return std::hash<std::string_view>{}(sql);
+        }
+    };
+
+    sqlite3 *db;
+    std::mutex cache_mtx;
+    std::unordered_map<std::string, std::vector<sqlite3_stmt *>,
+        SqlHash, std::equal_to<>> idle;
+};
+
+//-----------------------------------------------------------------------------
+// CachedStatement
+// ----------------------------------------------------------------------------
+// A statement checked out for the current scope. Converts to sqlite3_stmt *
+// so it can be passed straight to the sqlite3_bind/step/column functions.
+//-----------------------------------------------------------------------------
+class CachedStatement {
+public:
+
+    CachedStatement (StatementCache *cache, std::string_view sql);
+    ~CachedStatement (void);
+
+    CachedStatement (const CachedStatement &) = delete;
+    CachedStatement &operator= (const CachedStatement &) = delete;
+
+    operator sqlite3_stmt * (void) const {
+        return stmt;
+    }
+
+    explicit operator bool (void) const {
+        return stmt != nullptr;
+    }
+
+private:
+
+    StatementCache *cache;
+    std::string_view sql;
+    sqlite3_stmt *stmt;
+};
+
+#endif // STATEMENT_CACHE_H
@@ -0,0 +1,64 @@
+#ifndef STORAGE_DEVICE_H
+#define STORAGE_DEVICE_H
+
+// Standard Library Inclusions
+#include <windows.h>
+#include <winioctl.h>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Project Inclusions
+#include "SystemUtilities.h"
+
+// Definitions
+namespace fs = std::filesystem;
+
+// Directory walkers allowed to list a device at once. Solid state devices
+// serve many outstanding requests in parallel; a spinning disk seeks between
+// every directory being listed, so more than a couple of walkers only slows
+// it down.
+#define DEVICE_WALKERS_NVME 12
+#define DEVICE_WALKERS_SSD 6
+#define DEVICE_WALKERS_HDD 2
+#define DEVICE_WALKERS_UNKNOWN 4
+
+enum class DeviceKind {
+    UNKNOWN,
+    HDD,
+    SSD,
+    NVME
+};
+
+//=============================================================================
+// StorageDevice - the scan roots that live on one physical device
+//=============================================================================
+// Roots are grouped by the disk behind their volume, so two partitions of
+// the same spinning disk share one walker budget. Volumes that span several
+// disks (e.g. RAID) are grouped by volume instead.
+//-----------------------------------------------------------------------------
+struct StorageDevice {
+    std::wstring id;
+    DeviceKind kind;
+    int max_walkers;
+    std::vector<fs::path> roots;
+
+    // walkers that may still be started; the thread walking the device's
+    // roots is one of the max_walkers
+    std::atomic<int> free_walkers;
+};
+
+// Walker budget
+bool take_walker (StorageDevice *device);
+void release_walker (StorageDevice *device);
+
+// Device detection for a single path
+void probe_device (const fs::path &path, StorageDevice *device);
+
+// Root grouping
+std::vector<std::unique_ptr<StorageDevice>> group_by_device (
+    const std::vector<fs::path> &roots);
+
+#endif // STORAGE_DEVICE_H
@@ -5,6 +5,12 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdarg>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace fs = std::filesystem;
 
 void errlog (const char *msg, ...);
 
@@ -12,4 +18,8 @@ void panicf (const char* msg, ...);
 
 void quit (void);
 
+void path_to_utf8 (const fs::path &path, std::string *utf8);
+
+fs::path utf8_to_path (std::string_view utf8);
+
 #endif // SYSTEM_UTILITIES_H
\ No newline at end of file
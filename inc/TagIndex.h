@@ -0,0 +1,104 @@
+#ifndef TAG_INDEX_H
+#define TAG_INDEX_H
+
+// Standard Library Inclusions
+#include <cstdint>
+#include <functional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Project Inclusions
+#include "BKTree.h"
+
+// Definitions
+#define FUZZY_EXACT_LENGTH 2
+#define FUZZY_CLOSE_LENGTH 4
+
+// a tag attached to a file, as stored in the file_tags table
+struct TagPosting {
+    int64_t tag_id;
+    int64_t file_id;
+};
+
+// lets maps keyed by tag name be searched with a string_view
+struct TagHash {
+    using is_transparent = void;
+    size_t operator() (std::string_view tag) const {
+        return std::hash<std::string_view>{}(tag);
+    }
+};
+
+//=============================================================================
+// TagIndex - in-memory inverted index of the file_tags table
+//=============================================================================
+// Every tag maps to a posting list: the sorted ids of the files carrying it.
+// A query that requires some tags and excludes others is then an
+// intersection of the shortest lists followed by a difference with the
+// excluded ones, and never touches the files that do not qualify.
+//
+// The index is filled by Database::load_search_indexes and afterwards
+// follows the database through apply, which takes the tags added and removed
+// by one committed transaction. Adding or removing a posting twice has no effect,
+// so a batch that races with the initial load is harmless.
+//
+// Tag names are also kept in a BKTree, so a misspelt word finds the tags it
+// was meant to be by edit distance, and through them the files.
+//-----------------------------------------------------------------------------
+class TagIndex {
+public:
+
+    TagIndex (void);
+
+    // loading
+    void clear (void);
+    void add_tag (int64_t tag_id, std::string_view name);
+    void load (const std::vector<TagPosting> &postings);
+    void set_loaded (void);
+    bool is_loaded (void);
+
+    // changes committed by the writer
+    void apply (const std::vector<TagPosting> &added, 
+        const std::vector<TagPosting> &removed);
+
+    // ids of the files carrying every tag in all_of and none in none_of
+    std::vector<int64_t> match (const std::vector<std::string> &all_of,
+        const std::vector<std::string> &none_of);
+
+    // the candidates, in their order, carrying every tag in all_of and none
+    // in none_of
+    std::vector<int64_t> filter (const std::vector<int64_t> &candidates,
+        const std::vector<std::string> &all_of, const std::vector<std::string> &none_of);
+
+    // ids of up to limit files with a tag resembling each word, closest first
+    std::vector<int64_t> match_fuzzy (const std::vector<std::string> &words,
+        size_t limit);
+
+    size_t num_files (const std::string &tag);
+
+    // snapshots (see IndexSnapshot)
+    void for_each_tag (const std::function<void (int64_t tag_id, std::string_view name)> &visit);
+    void for_each_list (const std::function<void (int64_t tag_id, 
+        const std::vector<int64_t> &file_ids)> &visit);
+    void restore_tags (const int64_t *tag_ids, const uint64_t *name_offsets,
+        const char *names, size_t num_tags);
+    void restore_lists (const int64_t *tag_ids, const uint64_t *offsets,
+        const int64_t *file_ids, size_t num_lists);
+
+private:
+
+    using PostingList = std::vector<int64_t>;
+
+    const PostingList *find (const std::string &tag) const;
+    static void group (std::vector<TagPosting> *postings);
+
+    std::shared_mutex index_mtx;
+    std::unordered_map<std::string, int64_t, TagHash, std::equal_to<>> tag_ids;
+    std::unordered_map<int64_t, PostingList> lists;
+    BKTree vocabulary;
+    bool loaded;
+};
+
+#endif // TAG_INDEX_H
@@ -4,6 +4,9 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+
+#include "Metrics.h"
 
 template <typename T>
 class ThreadSafeQueue {
@@ -17,6 +20,13 @@ public:
     // Wait and pop a value from the queue
     void wait_pop(T& value);
 
+    // Wait and pop a value while producing, return false once drained
+    bool wait_pop_producing(T& value);
+
+    // Wait until the queue holds n values or stops producing
+    void wait_for_size(int n);
+    bool wait_for_size(int n, std::chrono::milliseconds timeout);
+
     // Get the size of the queue
     int size() const;
 
@@ -32,11 +42,15 @@ public:
     // Stop producing state
     void stop_producing();
 
+    // Report the queue's depth to a gauge on every push and pop
+    void track_depth(Gauge *gauge);
+
 private:
     mutable std::mutex mutex;
     std::queue<T> queue;
     std::condition_variable cv;
     bool producing = false;
+    Gauge *depth = nullptr;
 };
 
 // push a value on the queue
@@ -45,6 +59,9 @@ template <typename T>
 void ThreadSafeQueue<T>::push (T value) {
     std::lock_guard<std::mutex> lock(mutex);
     queue.push(std::move(value));
+    if (depth) {
+        depth->set(queue.size());
+    }
     cv.notify_one();
 }
 
@@ -58,6 +75,9 @@ bool ThreadSafeQueue<T>::try_pop (T& value) {
     }
     value = std::move(queue.front());
     queue.pop();
+    if (depth) {
+        depth->set(queue.size());
+    }
     return true;
 }
 
@@ -67,6 +87,46 @@ void ThreadSafeQueue<T>::wait_pop (T& value) {
     cv.wait(lock, [this]() { return !queue.empty(); });
     value = std::move(queue.front());
     queue.pop();
+    if (depth) {
+        depth->set(queue.size());
+    }
+}
+
+// wait for a value as long as the queue is producing
+// return false if the queue is empty and no longer producing
+template <typename T>
+bool ThreadSafeQueue<T>::wait_pop_producing (T& value) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]() { return !queue.empty() || !producing; });
+    if (queue.empty()) {
+        return false;
+    }
+    value = std::move(queue.front());
+    queue.pop();
+    if (depth) {
+        depth->set(queue.size());
+    }
+    return true;
+}
+
+// block until at least n values are queued or producing stops
+template <typename T>
+void ThreadSafeQueue<T>::wait_for_size (int n) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this, n]() { 
+        return static_cast<int>(queue.size()) >= n || !producing; 
+    });
+}
+
+// as above, giving up after timeout
+// return whether n values are queued
+template <typename T>
+bool ThreadSafeQueue<T>::wait_for_size (int n, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait_for(lock, timeout, [this, n]() { 
+        return static_cast<int>(queue.size()) >= n || !producing; 
+    });
+    return static_cast<int>(queue.size()) >= n;
 }
 
 template <typename T>
@@ -109,4 +169,13 @@ void ThreadSafeQueue<T>::stop_producing (void) {
     cv.notify_all();
 }
 
+template <typename T>
+void ThreadSafeQueue<T>::track_depth (Gauge *gauge) {
+    std::lock_guard<std::mutex> lock(mutex);
+    depth = gauge;
+    if (depth) {
+        depth->set(queue.size());
+    }
+}
+
 #endif
\ No newline at end of file
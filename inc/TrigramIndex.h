@@ -0,0 +1,92 @@
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+// Standard Library Inclusions
+#include <cstdint>
+#include <functional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Definitions
+#define TRIGRAM_SHORT_SCAN_LIMIT 100000
+
+//=============================================================================
+// TrigramIndex - in-memory substring index over file names
+//=============================================================================
+// Every run of three bytes in a lowercased file name is a trigram, and each
+// trigram has a sorted posting list of the ids of the files containing it.
+// Any name containing a query must contain each of the query's trigrams, so
+// intersecting their lists gives a small set of candidates, which are then
+// checked against the stored names. Results are exact substring matches, at
+// the cost of a few list intersections rather than a scan of every name.
+//
+// Names are folded to ASCII lowercase and indexed as UTF-8 bytes, so a
+// trigram may hold part of a multi-byte character; both sides are split the
+// same way, so matching is unaffected.
+//
+// The index is filled by Database::load_search_indexes and then follows the
+// database through apply, like TagIndex.
+//-----------------------------------------------------------------------------
+class TrigramIndex {
+public:
+
+    TrigramIndex (void);
+
+    // loading
+    void clear (void);
+    void load (const std::vector<std::pair<int64_t, std::string>> &files);
+    void set_loaded (void);
+    bool is_loaded (void);
+
+    // changes committed by the writer
+    void apply (const std::vector<std::pair<int64_t, std::string>> &added,
+        const std::vector<int64_t> &removed);
+
+    // ids of up to limit files whose name contains query, in id order
+    std::vector<int64_t> match (std::string_view query, size_t limit);
+
+    // the candidates, in their order, whose name contains query
+    std::vector<int64_t> filter (const std::vector<int64_t> &candidates,
+        std::string_view query);
+
+    // lowercases ASCII letters, as names and queries are matched
+    static void fold (std::string_view text, std::string *folded);
+
+    size_t size (void);
+
+    // snapshots (see IndexSnapshot); names are stored folded
+    void for_each_name (const std::function<void (uint32_t file_id, std::string_view folded)> &visit);
+    void for_each_list (const std::function<void (uint32_t trigram, 
+        const std::vector<uint32_t> &file_ids)> &visit);
+    void restore_names (const uint32_t *file_ids, const uint64_t *name_offsets,
+        const char *names, size_t num_names);
+    void restore_lists (const uint32_t *trigrams, const uint64_t *offsets,
+        const uint32_t *file_ids, size_t num_lists);
+
+private:
+
+    using PostingList = std::vector<uint32_t>;
+
+    struct Posting {
+        uint32_t trigram;
+        uint32_t file_id;
+    };
+
+    static void trigrams (std::string_view folded, std::vector<uint32_t> *keys);
+    void index_name (uint32_t file_id, std::string_view name, 
+        std::vector<Posting> *postings);
+
+    std::shared_mutex index_mtx;
+
+    // lowercased names by file id, empty for ids not in the index
+    std::vector<std::string> names;
+    std::unordered_map<uint32_t, PostingList> lists;
+    size_t num_names;
+    bool loaded;
+};
+
+#endif // TRIGRAM_INDEX_H
@@ -0,0 +1,89 @@
+#ifndef WATCHER_H
+#define WATCHER_H
+
+// Standard Library Inclusions
+#include <windows.h>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <thread>
+#include <vector>
+
+// Project Inclusions
+#include "Database.h"
+#include "FileRecord.h"
+#include "Scanner.h"
+#include "SystemUtilities.h"
+#include "ThreadSafeQueue.h"
+
+// Definitions
+namespace fs = std::filesystem;
+
+// Events are applied once no new event has arrived for WATCH_SETTLE_MS, or
+// WATCH_MAX_DELAY_MS after the oldest pending event, whichever comes first.
+#define WATCH_SETTLE_MS 500
+#define WATCH_MAX_DELAY_MS 2000
+#define WATCH_BUFFER_SIZE 65536
+
+//=============================================================================
+// Watcher - keep the index current as files change under the scanned roots
+//=============================================================================
+// Each root is watched recursively with ReadDirectoryChangesW. Events are
+// coalesced per path and then fed into a long running copy of the scan
+// pipeline (proc_queue -> process_queued_files -> insrt_queue ->
+// insert_processed_files). Deletions and renames are applied to the database
+// directly; a rename moves the rows in place so nothing stored for them is
+// lost.
+//-----------------------------------------------------------------------------
+
+enum class WatchAction {
+    ADDED,
+    MODIFIED,
+    REMOVED
+};
+
+class Watcher {
+public:
+
+    Watcher (Database *db);
+    ~Watcher (void);
+
+    // register roots before calling start
+    bool watch (const fs::path &root);
+
+    void start (void);
+    void stop (void);
+
+private:
+
+    struct WatchedRoot {
+        fs::path path;
+        HANDLE dir_handle;
+        OVERLAPPED overlapped;
+        std::vector<DWORD> buffer;
+    };
+
+    bool request_changes (WatchedRoot *root);
+    void read_changes (WatchedRoot *root);
+    void record (const fs::path &path, WatchAction action);
+    void rename (const fs::path &old_path, const fs::path &new_path);
+    void rescan (const fs::path &root);
+    void flush (void);
+    void run (void);
+
+    Database *db;
+    std::vector<WatchedRoot *> roots;
+    HANDLE stop_event;
+    bool running;
+
+    // only touched by the watch thread
+    std::map<fs::path, WatchAction> pending;
+    std::chrono::steady_clock::time_point oldest_pending;
+
+    RecordPool record_pool;
+    ThreadSafeQueue<ScanItem> proc_queue;
+    ThreadSafeQueue<struct FileRecord *> insrt_queue;
+    std::vector<std::thread> threads;
+};
+
+#endif // WATCHER_H
@@ -0,0 +1,426 @@
+#include "ANNIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <queue>
+
+struct ANNHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint64_t num_nodes;
+    uint32_t entry_point;
+    int32_t max_level;
+    int64_t generation;
+};
+
+ANNIndex::ANNIndex (void) {
+    this->entry_point = 0;
+    this->max_level = -1;
+    this->loaded = false;
+}
+
+void ANNIndex::clear (void) {
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    nodes.clear();
+    vectors.clear();
+    node_of.clear();
+    entry_point = 0;
+    max_level = -1;
+    loaded = false;
+}
+
+void ANNIndex::set_loaded (void) {
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    loaded = true;
+}
+
+bool ANNIndex::is_loaded (void) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+    return loaded;
+}
+
+size_t ANNIndex::size (void) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+    return node_of.size();
+}
+
+// squared L2 distance; embeddings are unit length, so this orders
+// neighbours the same way cosine distance does
+float ANNIndex::distance (const float *a, const float *b) {
+    float sum = 0.0f;
+    for (int i = 0; i < EMBEDDING_DIM; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+//-----------------------------------------------------------------------------
+// ANNIndex::random_level
+// ----------------------------------------------------------------------------
+// Draws the top level of a new node: each level holds about 1 / ANN_M of the
+// nodes of the level below.
+//-----------------------------------------------------------------------------
+int ANNIndex::random_level (void) {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    double u = 1.0 - uniform(rng);
+    int level = static_cast<int>(-std::log(u) / std::log(static_cast<double>(ANN_M)));
+    return level < 16 ? level : 16;
+}
+
+//-----------------------------------------------------------------------------
+// ANNIndex::descend
+// ----------------------------------------------------------------------------
+// Walks greedily towards query on each level from from_level down to
+// to_level, and returns the closest node reached.
+//-----------------------------------------------------------------------------
+uint32_t ANNIndex::descend (const float *query, uint32_t entry, int from_level, 
+    int to_level) const {
+
+    uint32_t current = entry;
+    float current_distance = distance(query, vector_of(current));
+    for (int level = from_level; level >= to_level; level--) {
+        bool moved = true;
+        while (moved) {
+            moved = false;
+            for (uint32_t neighbor : nodes[current].links[level]) {
+                float d = distance(query, vector_of(neighbor));
+                if (d < current_distance) {
+                    current = neighbor;
+                    current_distance = d;
+                    moved = true;
+                }
+            }
+        }
+    }
+    return current;
+}
+
+//-----------------------------------------------------------------------------
+// ANNIndex::search_level
+// ----------------------------------------------------------------------------
+// Best-first search of one level from entry, keeping the ef closest nodes
+// found. Stops once the closest unexplored node is further than all of them.
+// Returns them nearest first.
+//-----------------------------------------------------------------------------
+std::vector<ANNIndex::Candidate> ANNIndex::search_level (const float *query, uint32_t entry,
+    size_t ef, int level) const {
+
+    std::vector<bool> visited(nodes.size());
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> frontier;
+    std::priority_queue<Candidate> found;
+
+    float d = distance(query, vector_of(entry));
+    frontier.push({d, entry});
+    found.push({d, entry});
+    visited[entry] = true;
+
+    while (!frontier.empty()) {
+        Candidate closest = frontier.top();
+        if (found.size() >= ef && closest.first > found.top().first) {
+            break;
+        }
+        frontier.pop();
+
+        const Node &node = nodes[closest.second];
+        if (level >= static_cast<int>(node.links.size())) {
+            continue;
+        }
+        for (uint32_t neighbor : node.links[level]) {
+            if (visited[neighbor]) {
+                continue;
+            }
+            visited[neighbor] = true;
+
+            d = distance(query, vector_of(neighbor));
+            if (found.size() < ef || d < found.top().first) {
+                frontier.push({d, neighbor});
+                found.push({d, neighbor});
+                if (found.size() > ef) {
+                    found.pop();
+                }
+            }
+        }
+    }
+
+    std::vector<Candidate> nearest(found.size());
+    for (size_t i = nearest.size(); i-- > 0; ) {
+        nearest[i] = found.top();
+        found.pop();
+    }
+    return nearest;
+}
+
+//-----------------------------------------------------------------------------
+// ANNIndex::select_neighbors
+// ----------------------------------------------------------------------------
+// Picks up to m of the candidates to link to, nearest first, skipping any
+// that is closer to an already picked neighbour than to the node itself, so
+// links spread in different directions instead of into one cluster. Skipped
+// candidates fill any places left.
+//-----------------------------------------------------------------------------
+std::vector<uint32_t> ANNIndex::select_neighbors (std::vector<Candidate> candidates, 
+    size_t m) const {
+
+    std::sort(candidates.begin(), candidates.end());
+
+    std::vector<uint32_t> selected;
+    std::vector<uint32_t> skipped;
+    for (const Candidate &candidate : candidates) {
+        if (selected.size() == m) {
+            break;
+        }
+        bool diverse = true;
+        for (uint32_t chosen : selected) {
+            if (distance(vector_of(candidate.second), vector_of(chosen)) < candidate.first) {
+                diverse = false;
+                break;
+            }
+        }
+        (diverse ? selected : skipped).push_back(candidate.second);
+    }
+    for (size_t i = 0; i < skipped.size() && selected.size() < m; i++) {
+        selected.push_back(skipped[i]);
+    }
+    return selected;
+}
+
+//-----------------------------------------------------------------------------
+// ANNIndex::link
+// ----------------------------------------------------------------------------
+// Adds a link from one node to another on level, re-selecting the node's
+// neighbours if it now has more than the level allows.
+//-----------------------------------------------------------------------------
+void ANNIndex::link (uint32_t from, uint32_t to, int level) {
+
+    std::vector<uint32_t> &links = nodes[from].links[level];
+    links.push_back(to);
+
+    size_t max_links = level == 0 ? ANN_M0 : ANN_M;
+    if (links.size() <= max_links) {
+        return;
+    }
+
+    std::vector<Candidate> candidates;
+    candidates.reserve(links.size());
+    for (uint32_t neighbor : links) {
+        candidates.push_back({distance(vector_of(from), vector_of(neighbor)), neighbor});
+    }
+    links = select_neighbors(std::move(candidates), max_links);
+}
+
+//-----------------------------------------------------------------------------
+// ANNIndex::insert
+// ----------------------------------------------------------------------------
+// Adds the embedding of a file. A file already in the index keeps its node
+// if the embedding is unchanged; otherwise the old node is retired.
+//-----------------------------------------------------------------------------
+void ANNIndex::insert (int64_t file_id, const float *embedding) {
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+
+    auto existing = node_of.find(file_id);
+    if (existing != node_of.end()) {
+        if (memcmp(vector_of(existing->second), embedding, EMBEDDING_DIM * sizeof(float)) == 0) {
+            return;
+        }
+        nodes[existing->second].deleted = true;
+    }
+
+    uint32_t node = static_cast<uint32_t>(nodes.size());
+    int level = random_level();
+    nodes.push_back({file_id, false, std::vector<std::vector<uint32_t>>(level + 1)});
+    vectors.insert(vectors.end(), embedding, embedding + EMBEDDING_DIM);
+    node_of[file_id] = node;
+
+    if (max_level < 0) {
+        entry_point = node;
+        max_level = level;
+        return;
+    }
+
+    const float *query = vector_of(node);
+    uint32_t current = descend(query, entry_point, max_level, level + 1);
+    for (int l = (std::min)(level, max_level); l >= 0; l--) {
+        std::vector<Candidate> candidates = search_level(query, current, ANN_EF_CONSTRUCTION, l);
+        nodes[node].links[l] = select_neighbors(candidates, ANN_M);
+        for (uint32_t neighbor : nodes[node].links[l]) {
+            link(neighbor, node, l);
+        }
+        current = candidates.front().second;
+    }
+
+    if (level > max_level) {
+        max_level = level;
+        entry_point = node;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// ANNIndex::remove
+// ----------------------------------------------------------------------------
+// Retires the node of a file. It keeps its links so the graph stays
+// connected, but is no longer returned by search.
+//-----------------------------------------------------------------------------
+void ANNIndex::remove (int64_t file_id) {
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+
+    auto existing = node_of.find(file_id);
+    if (existing != node_of.end()) {
+        nodes[existing->second].deleted = true;
+        node_of.erase(existing);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// ANNIndex::search
+// ----------------------------------------------------------------------------
+// Returns the ids of up to k live files nearest to embedding, nearest first,
+// leaving out exclude (the file a "more like this" search starts from).
+//-----------------------------------------------------------------------------
+std::vector<int64_t> ANNIndex::search (const float *embedding, size_t k, int64_t exclude) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+
+    std::vector<int64_t> file_ids;
+    if (max_level < 0 || k == 0) {
+        return file_ids;
+    }
+
+    uint32_t current = descend(embedding, entry_point, max_level, 1);
+    size_t ef = (std::max)(static_cast<size_t>(ANN_EF_SEARCH), k + 1);
+    for (const Candidate &candidate : search_level(embedding, current, ef, 0)) {
+        const Node &node = nodes[candidate.second];
+        if (node.deleted || node.file_id == exclude) {
+            continue;
+        }
+        file_ids.push_back(node.file_id);
+        if (file_ids.size() == k) {
+            break;
+        }
+    }
+    return file_ids;
+}
+
+//-----------------------------------------------------------------------------
+// ANNIndex::save
+// ----------------------------------------------------------------------------
+// Writes the graph as of generation to a temporary file and renames it over
+// path: the header, every embedding, then each node's file id, state and
+// links per level.
+//-----------------------------------------------------------------------------
+bool ANNIndex::save (const fs::path &path, int64_t generation) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+
+    fs::path temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+
+        ANNHeader header = {};
+        header.magic = ANN_MAGIC;
+        header.version = ANN_VERSION;
+        header.dim = EMBEDDING_DIM;
+        header.num_nodes = nodes.size();
+        header.entry_point = entry_point;
+        header.max_level = max_level;
+        header.generation = generation;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(vectors.data()), vectors.size() * sizeof(float));
+
+        for (const Node &node : nodes) {
+            uint8_t deleted = node.deleted ? 1 : 0;
+            uint8_t num_levels = static_cast<uint8_t>(node.links.size());
+            out.write(reinterpret_cast<const char *>(&node.file_id), sizeof(node.file_id));
+            out.write(reinterpret_cast<const char *>(&deleted), sizeof(deleted));
+            out.write(reinterpret_cast<const char *>(&num_levels), sizeof(num_levels));
+            for (const std::vector<uint32_t> &links : node.links) {
+                uint32_t count = static_cast<uint32_t>(links.size());
+                out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+                out.write(reinterpret_cast<const char *>(links.data()), count * sizeof(uint32_t));
+            }
+        }
+        if (!out.good()) {
+            errlog("ANNIndex::save: Failed to write the index.\n");
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(temp_path, path, ec);
+    if (ec) {
+        errlog("ANNIndex::save: Failed to replace the index.\n");
+        fs::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// ANNIndex::load
+// ----------------------------------------------------------------------------
+// Replaces the graph with the one saved at path and returns the generation
+// it was saved at, or -1 if there is no usable file.
+//-----------------------------------------------------------------------------
+int64_t ANNIndex::load (const fs::path &path) {
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        return -1;
+    }
+
+    ANNHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        header.magic != ANN_MAGIC || header.version != ANN_VERSION ||
+        header.dim != EMBEDDING_DIM || header.num_nodes >= UINT32_MAX ||
+        (header.num_nodes > 0 && header.entry_point >= header.num_nodes)) {
+        return -1;
+    }
+
+    std::vector<float> loaded_vectors(header.num_nodes * EMBEDDING_DIM);
+    std::vector<Node> loaded_nodes(header.num_nodes);
+    if (!in.read(reinterpret_cast<char *>(loaded_vectors.data()), 
+        loaded_vectors.size() * sizeof(float))) {
+        return -1;
+    }
+    for (Node &node : loaded_nodes) {
+        uint8_t deleted, num_levels;
+        if (!in.read(reinterpret_cast<char *>(&node.file_id), sizeof(node.file_id)) ||
+            !in.read(reinterpret_cast<char *>(&deleted), sizeof(deleted)) ||
+            !in.read(reinterpret_cast<char *>(&num_levels), sizeof(num_levels))) {
+            return -1;
+        }
+        node.deleted = deleted != 0;
+        node.links.resize(num_levels);
+        for (std::vector<uint32_t> &links : node.links) {
+            uint32_t count;
+            if (!in.read(reinterpret_cast<char *>(&count), sizeof(count)) || count > ANN_M0) {
+                return -1;
+            }
+            links.resize(count);
+            if (!in.read(reinterpret_cast<char *>(links.data()), count * sizeof(uint32_t))) {
+                return -1;
+            }
+            for (uint32_t neighbor : links) {
+                if (neighbor >= header.num_nodes) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    nodes = std::move(loaded_nodes);
+    vectors = std::move(loaded_vectors);
+    node_of.clear();
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+        if (!nodes[i].deleted) {
+            node_of[nodes[i].file_id] = i;
+        }
+    }
+    entry_point = header.entry_point;
+    max_level = nodes.empty() ? -1 : header.max_level;
+    return header.generation;
+}
@@ -0,0 +1,262 @@
+#include "Analyzer.h"
+
+//=============================================================================
+// analysis
+//=============================================================================
+
+// analyze_file decodes a file and records its audio properties
+// files that cannot be decoded are marked as failed so they are not retried
+void analyze_file (struct AnalysisRecord *record) {
+
+    ScopedTimer timer(STAGE_ANALYZE);
+
+    fs::path path = utf8_to_path(record->file_path);
+    record->state = ANALYSIS_FAILED;
+    record->duration_ms = 0;
+    record->auto_bpm = 0;
+    record->auto_key = 0;
+    record->embedding.clear();
+
+    // the file may have been removed since it was indexed
+    std::error_code ec;
+    if (!fs::is_regular_file(path, ec)) {
+        return;
+    }
+
+    // only wav files can be decoded so far
+    if (path.extension().string() != std::string(".wav")) {
+        return;
+    }
+
+    try {
+        WAV wav(path);
+        wav.parse();
+
+        int sample_rate = wav.get_sample_rate();
+        int num_channels = wav.get_num_channels();
+        int64_t num_samples = wav.get_num_samples();
+        if (sample_rate > 0 && num_channels > 0 && num_samples > 0) {
+            int64_t num_frames = num_samples / num_channels;
+            record->duration_ms = static_cast<int>(num_frames * 1000 / sample_rate);
+
+            FourierTX fourier;
+            const std::vector<float> &samples = *wav.get_samples();
+            record->auto_bpm = fourier.detect_tempo(samples, num_channels, sample_rate);
+
+            int pitch;
+            bool minor;
+            if (fourier.detect_key(samples, num_channels, sample_rate, &pitch, &minor)) {
+                record->auto_key = minor ? KEY_MINOR(pitch) : KEY_MAJOR(pitch);
+            }
+
+            fourier.timbre_embedding(samples, num_channels, sample_rate, &record->embedding);
+
+            record->state = ANALYSIS_DONE;
+        }
+
+        wav.close();
+    }
+    catch (...) {
+        errlog("analyze_file: Exception thrown\n");
+    }
+}
+
+//=============================================================================
+// Analyzer
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+// Analyzer::Analyzer
+// ----------------------------------------------------------------------------
+// Creates an analyzer for db using half of the available cores.
+//-----------------------------------------------------------------------------
+Analyzer::Analyzer (Database *db) {
+    this->db = db;
+    this->running = false;
+    this->woken = false;
+    this->in_flight = 0;
+
+    this->num_workers = static_cast<int>(std::thread::hardware_concurrency() / 2);
+    if (this->num_workers < 1) {
+        this->num_workers = 1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Analyzer::~Analyzer
+// ----------------------------------------------------------------------------
+// Stops any running threads.
+//-----------------------------------------------------------------------------
+Analyzer::~Analyzer (void) {
+    stop();
+}
+
+//-----------------------------------------------------------------------------
+// Analyzer::start
+// ----------------------------------------------------------------------------
+// Starts the fetch thread and the worker threads.
+//-----------------------------------------------------------------------------
+void Analyzer::start (void) {
+
+    if (running) {
+        return;
+    }
+    running = true;
+
+    work_queue.track_depth(&metrics.analysis_queue_depth);
+    work_queue.start_producing();
+    result_queue.start_producing();
+
+    for (int i = 0; i < num_workers; i++) {
+        threads.emplace_back(&Analyzer::work, this);
+    }
+    threads.emplace_back(&Analyzer::fetch, this);
+}
+
+//-----------------------------------------------------------------------------
+// Analyzer::stop
+// ----------------------------------------------------------------------------
+// Stops all threads and commits the results that are already computed. Files
+// still queued are left pending and are picked up on the next start.
+//-----------------------------------------------------------------------------
+void Analyzer::stop (void) {
+
+    if (!running) {
+        return;
+    }
+    running = false;
+
+    wake();
+    work_queue.stop_producing();
+    result_queue.stop_producing();
+
+    for (auto &t : threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    threads.clear();
+
+    commit_results();
+
+    struct AnalysisRecord record;
+    while (work_queue.try_pop(record)) {
+        --in_flight;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Analyzer::wake
+// ----------------------------------------------------------------------------
+// Ends the idle wait of the fetch thread so new files are analyzed without
+// waiting for ANALYZER_IDLE_MS.
+//-----------------------------------------------------------------------------
+void Analyzer::wake (void) {
+    {
+        std::lock_guard<std::mutex> lock(idle_mtx);
+        woken = true;
+    }
+    idle_cv.notify_all();
+}
+
+//-----------------------------------------------------------------------------
+// Analyzer::yield
+// ----------------------------------------------------------------------------
+// Blocks while an interactive query is running.
+//-----------------------------------------------------------------------------
+void Analyzer::yield (void) {
+    while (running && db->queries_active()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ANALYZER_YIELD_MS));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Analyzer::commit_results
+// ----------------------------------------------------------------------------
+// Writes every finished result in one transaction.
+//-----------------------------------------------------------------------------
+void Analyzer::commit_results (void) {
+
+    std::vector<struct AnalysisRecord> results;
+    struct AnalysisRecord record;
+    while (result_queue.try_pop(record)) {
+        results.push_back(std::move(record));
+    }
+
+    if (!results.empty()) {
+        db->update_analysis(results);
+        in_flight -= static_cast<int>(results.size());
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Analyzer::fetch
+// ----------------------------------------------------------------------------
+// Fetch thread. Pages through the backlog, keeping the workers supplied and
+// committing their results. Once the end of the backlog is reached and all
+// results are committed, it waits to be woken and starts again from the
+// lowest id, which also picks up modified files that were reset to pending.
+//-----------------------------------------------------------------------------
+void Analyzer::fetch (void) {
+
+    int64_t last_id = 0;
+    std::vector<struct AnalysisRecord> batch;
+
+    while (running) {
+        yield();
+        commit_results();
+
+        // workers are still busy with the previous batch
+        if (work_queue.size() >= ANALYZER_BATCH_SIZE) {
+            result_queue.wait_for_size(ANALYZER_BATCH_SIZE, std::chrono::milliseconds(250));
+            continue;
+        }
+
+        batch.clear();
+        if (db->select_pending_analysis(last_id, ANALYZER_BATCH_SIZE, &batch) > 0) {
+            last_id = batch.back().id;
+            in_flight += static_cast<int>(batch.size());
+            for (auto &record : batch) {
+                work_queue.push(std::move(record));
+            }
+            continue;
+        }
+
+        // wait for the files in flight before starting over
+        if (in_flight > 0) {
+            result_queue.wait_for_size(1, std::chrono::milliseconds(250));
+            continue;
+        }
+
+        last_id = 0;
+        std::unique_lock<std::mutex> lock(idle_mtx);
+        idle_cv.wait_for(lock, std::chrono::milliseconds(ANALYZER_IDLE_MS), [this]() {
+            return woken || !running;
+        });
+        woken = false;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Analyzer::work
+// ----------------------------------------------------------------------------
+// Worker thread. Runs in background mode, which lowers both its cpu and i/o
+// priority, so analysis never competes with the ui or the scanner.
+//-----------------------------------------------------------------------------
+void Analyzer::work (void) {
+
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+    struct AnalysisRecord record;
+    while (work_queue.wait_pop_producing(record)) {
+        yield();
+        if (!running) {
+            --in_flight;
+            continue;
+        }
+        analyze_file(&record);
+        result_queue.push(std::move(record));
+    }
+
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+}
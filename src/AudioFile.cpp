@@ -50,6 +50,18 @@ int AudioFile::close (void) {
     return 1;
 }
 
+int AudioFile::get_sample_rate (void) {
+    return sample_rate;
+}
+
+int AudioFile::get_num_samples (void) {
+    return static_cast<int>(samples.size());
+}
+
+int AudioFile::get_num_channels (void) {
+    return num_channels;
+}
+
 void AudioFile::print_file_path (void) {
     std::cerr << this->file_path << std::endl;
 }
@@ -148,7 +160,12 @@ void WAV::parse (void) {
 
     int data_len = file->read_int(4);
 
-    int bps = (bit_depth / 8) / n_channels;
+    this->sample_rate = sample_rate;
+    this->num_channels = n_channels;
+
+    // samples of all channels are interleaved, so bytes per sample only
+    // depends on bit depth
+    int bps = bit_depth / 8;
     if (bps <= 0 || bps > 4) { 
         print_file_path();
         errlog("WAV::parse: failed to calculate bytes per sample\n");
@@ -0,0 +1,119 @@
+#include "BKTree.h"
+
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// edit_distance
+// ----------------------------------------------------------------------------
+// Counts the insertions, deletions and substitutions needed to turn a into
+// b, keeping two rows of the usual dynamic programming table. Works on
+// bytes; names are mostly ASCII.
+//-----------------------------------------------------------------------------
+int edit_distance (std::string_view a, std::string_view b) {
+
+    if (a.size() < b.size()) {
+        std::swap(a, b);
+    }
+
+    std::vector<int> previous(b.size() + 1);
+    std::vector<int> current(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++) {
+        previous[j] = static_cast<int>(j);
+    }
+
+    for (size_t i = 1; i <= a.size(); i++) {
+        current[0] = static_cast<int>(i);
+        for (size_t j = 1; j <= b.size(); j++) {
+            int cost = (a[i - 1] == b[j - 1]) ? 0 : 1;
+            current[j] = std::min({
+                previous[j] + 1,
+                current[j - 1] + 1,
+                previous[j - 1] + cost
+            });
+        }
+        previous.swap(current);
+    }
+    return previous[b.size()];
+}
+
+//=============================================================================
+// BKTree
+//=============================================================================
+
+BKTree::BKTree (void) {
+}
+
+void BKTree::clear (void) {
+    nodes.clear();
+}
+
+size_t BKTree::size (void) const {
+    return nodes.size();
+}
+
+//-----------------------------------------------------------------------------
+// BKTree::insert
+// ----------------------------------------------------------------------------
+// Adds a word, walking down the child at each node's distance until there is
+// none. A word already in the tree keeps its node and takes the new id.
+//-----------------------------------------------------------------------------
+void BKTree::insert (std::string_view word, int64_t id) {
+
+    if (nodes.empty()) {
+        nodes.push_back({std::string(word), id, {}});
+        return;
+    }
+
+    uint32_t index = 0;
+    while (true) {
+        int distance = edit_distance(word, nodes[index].word);
+        if (distance == 0) {
+            nodes[index].id = id;
+            return;
+        }
+
+        auto &children = nodes[index].children;
+        auto child = std::find_if(children.begin(), children.end(),
+            [distance](const std::pair<int, uint32_t> &c) {
+                return c.first == distance;
+            });
+        if (child == children.end()) {
+            uint32_t added = static_cast<uint32_t>(nodes.size());
+            children.emplace_back(distance, added);
+            nodes.push_back({std::string(word), id, {}});
+            return;
+        }
+        index = child->second;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// BKTree::search
+// ----------------------------------------------------------------------------
+// Visits every word within max_distance of word. Only children keyed within
+// max_distance of a node's own distance are descended into.
+//-----------------------------------------------------------------------------
+void BKTree::search (std::string_view word, int max_distance,
+    const std::function<void (int64_t id, int distance)> &visit) const {
+
+    if (nodes.empty()) {
+        return;
+    }
+
+    std::vector<uint32_t> pending = {0};
+    while (!pending.empty()) {
+        const Node &node = nodes[pending.back()];
+        pending.pop_back();
+
+        int distance = edit_distance(word, node.word);
+        if (distance <= max_distance) {
+            visit(node.id, distance);
+        }
+        for (const auto &child : node.children) {
+            if (child.first >= distance - max_distance && 
+                child.first <= distance + max_distance) {
+                pending.push_back(child.second);
+            }
+        }
+    }
+}
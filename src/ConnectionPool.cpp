@@ -0,0 +1,204 @@
+#include "ConnectionPool.h"
+
+//=============================================================================
+// pragmas
+//=============================================================================
+
+// run a pragma, logging but otherwise ignoring failures since every pragma
+// here is a tuning rather than a requirement
+static void pragma (sqlite3 *db, const char *sql) {
+    if (sqlite3_exec(db, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        errlog("pragma: Failed to run %s\n", sql);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// configure_writer
+// ----------------------------------------------------------------------------
+// Switches the database to WAL journaling and tunes the writer connection.
+// With WAL, synchronous=NORMAL only syncs at checkpoints: a commit can be
+// lost on power failure but the database is never corrupted, and the scan
+// journal makes a lost commit harmless.
+//-----------------------------------------------------------------------------
+void configure_writer (sqlite3 *db) {
+    char sql[64];
+
+    pragma(db, "PRAGMA journal_mode = WAL;");
+    pragma(db, "PRAGMA synchronous = NORMAL;");
+    pragma(db, "PRAGMA temp_store = MEMORY;");
+
+    snprintf(sql, sizeof(sql), "PRAGMA cache_size = -%d;", DB_WRITER_CACHE_KB);
+    pragma(db, sql);
+    snprintf(sql, sizeof(sql), "PRAGMA mmap_size = %lld;", static_cast<long long>(DB_MMAP_SIZE));
+    pragma(db, sql);
+
+    sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+}
+
+//=============================================================================
+// cancellation
+//=============================================================================
+
+// the generation of the query running on this thread, and where the latest
+// generation is published
+static thread_local const std::atomic<uint64_t> *query_latest = nullptr;
+static thread_local uint64_t query_generation = 0;
+
+void set_query_generation (const std::atomic<uint64_t> *latest, uint64_t generation) {
+    query_latest = latest;
+    query_generation = generation;
+}
+
+// progress handler of every reader: sqlite calls it on the thread stepping
+// the statement, and a nonzero result interrupts the statement
+static int query_progress (void *) {
+    return query_latest && 
+        query_latest->load(std::memory_order_relaxed) != query_generation;
+}
+
+//-----------------------------------------------------------------------------
+// configure_reader
+// ----------------------------------------------------------------------------
+// Tunes a read-only connection. Reads through the memory map avoid copying
+// pages into each connection's own cache. Statements check every
+// DB_PROGRESS_OPS instructions whether their query was cancelled.
+//-----------------------------------------------------------------------------
+void configure_reader (sqlite3 *db) {
+    char sql[64];
+
+    pragma(db, "PRAGMA query_only = 1;");
+    pragma(db, "PRAGMA temp_store = MEMORY;");
+
+    snprintf(sql, sizeof(sql), "PRAGMA cache_size = -%d;", DB_READER_CACHE_KB);
+    pragma(db, sql);
+    snprintf(sql, sizeof(sql), "PRAGMA mmap_size = %lld;", static_cast<long long>(DB_MMAP_SIZE));
+    pragma(db, sql);
+
+    sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+    sqlite3_progress_handler(db, DB_PROGRESS_OPS, query_progress, nullptr);
+}
+
+//=============================================================================
+// ConnectionPool
+//=============================================================================
+
+ConnectionPool::ConnectionPool (void) {
+    this->max_connections = 0;
+}
+
+ConnectionPool::~ConnectionPool (void) {
+    close();
+}
+
+//-----------------------------------------------------------------------------
+// ConnectionPool::open
+// ----------------------------------------------------------------------------
+// Sets the database readers connect to. No connection is opened until the
+// first checkout.
+//-----------------------------------------------------------------------------
+void ConnectionPool::open (const std::string &db_name, int max_connections) {
+    std::lock_guard<std::mutex> lock(pool_mtx);
+    this->db_name = db_name;
+    this->max_connections = max_connections;
+}
+
+//-----------------------------------------------------------------------------
+// ConnectionPool::close
+// ----------------------------------------------------------------------------
+// Closes every connection. Must not be called while connections are checked
+// out.
+//-----------------------------------------------------------------------------
+void ConnectionPool::close (void) {
+    std::lock_guard<std::mutex> lock(pool_mtx);
+    for (auto &connection : connections) {
+        connection->statements.close();
+        sqlite3_close(connection->db);
+    }
+    connections.clear();
+    idle.clear();
+    max_connections = 0;
+}
+
+//-----------------------------------------------------------------------------
+// ConnectionPool::checkout
+// ----------------------------------------------------------------------------
+// Returns an idle connection, opening a new one while under the limit and
+// waiting for one otherwise. Returns nullptr if the pool is closed or a
+// connection cannot be opened.
+//-----------------------------------------------------------------------------
+Connection *ConnectionPool::checkout (void) {
+
+    std::unique_lock<std::mutex> lock(pool_mtx);
+    pool_cv.wait(lock, [this]() {
+        return !idle.empty() ||
+               static_cast<int>(connections.size()) < max_connections ||
+               max_connections == 0;
+    });
+
+    if (!idle.empty()) {
+        Connection *connection = idle.back();
+        idle.pop_back();
+        return connection;
+    }
+    if (max_connections == 0) {
+        return nullptr;
+    }
+
+    Connection *connection = connect();
+    if (connection) {
+        connections.emplace_back(connection);
+    }
+    return connection;
+}
+
+//-----------------------------------------------------------------------------
+// ConnectionPool::checkin
+// ----------------------------------------------------------------------------
+// Returns a connection to the pool.
+//-----------------------------------------------------------------------------
+void ConnectionPool::checkin (Connection *connection) {
+    {
+        std::lock_guard<std::mutex> lock(pool_mtx);
+        idle.push_back(connection);
+    }
+    pool_cv.notify_one();
+}
+
+//-----------------------------------------------------------------------------
+// ConnectionPool::connect
+// ----------------------------------------------------------------------------
+// Opens a read-only connection. Called with the pool locked, which only
+// delays other checkouts while the pool is still growing.
+//-----------------------------------------------------------------------------
+Connection *ConnectionPool::connect (void) {
+
+    int flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX;
+
+    sqlite3 *db = nullptr;
+    if (sqlite3_open_v2(db_name.c_str(), &db, flags, NULL) != SQLITE_OK) {
+        errlog("ConnectionPool::connect: Cannot open database.\n");
+        sqlite3_close(db);
+        return nullptr;
+    }
+    configure_reader(db);
+
+    Connection *connection = new Connection;
+    connection->db = db;
+    connection->statements.open(db);
+    return connection;
+}
+
+//=============================================================================
+// PooledConnection
+//=============================================================================
+
+PooledConnection::PooledConnection (ConnectionPool *pool) {
+    this->pool = pool;
+    this->connection = pool->checkout();
+}
+
+PooledConnection::~PooledConnection (void) {
+    if (connection) {
+        pool->checkin(connection);
+    }
+}
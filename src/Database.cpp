@@ -60,20 +60,36 @@ char *concat_cstrs (int num_strings, ...){
 //-----------------------------------------------------------------------------
 Database::Database (void) {
     this->db = nullptr;
+    this->active_queries = 0;
+    this->fts_enabled = false;
 }
 
 //-----------------------------------------------------------------------------
 // Database::Database (const char *)
 // ----------------------------------------------------------------------------
-// Opens or creates an sqlite database named db_name.
+// Opens or creates an sqlite database named db_name in WAL mode. This
+// connection is the only writer; reads go through a pool of read-only
+// connections so they never wait on the scanner's transactions. The writer
+// is opened without sqlite's connection mutex since write_mtx already
+// serializes every use of it.
 //-----------------------------------------------------------------------------
 Database::Database (const char *db_name) {
     int flags = SQLITE_OPEN_READWRITE | 
                 SQLITE_OPEN_CREATE | 
-                SQLITE_OPEN_FULLMUTEX;
+                SQLITE_OPEN_NOMUTEX;
     
+    this->active_queries = 0;
+    this->fts_enabled = false;
     if (sqlite3_open_v2(db_name, &this->db, flags, NULL) == SQLITE_OK) {
+        configure_writer(this->db);
+        this->statements.open(this->db);
         this->init();
+        this->readers.open(db_name, DB_READERS);
+
+        fs::path db_path = utf8_to_path(db_name);
+        this->snapshot_path = fs::path(db_path).concat(".snapshot");
+        this->delta_log.open(fs::path(db_path).concat(".delta"));
+        this->similar_path = fs::path(db_path).concat(".ann");
     } 
     else {
         errlog("Database::Database: Cannot open database.\n");
@@ -81,6 +97,54 @@ Database::Database (const char *db_name) {
     }
 }
 
+//-----------------------------------------------------------------------------
+// Database::~Database
+// ----------------------------------------------------------------------------
+// Saves the similarity graph if it was loaded, closes the readers, then
+// finalizes the cached statements and closes the writer.
+//-----------------------------------------------------------------------------
+Database::~Database (void) {
+    if (this->db && similar_index.is_loaded()) {
+        std::lock_guard<std::mutex> lock(write_mtx);
+        similar_index.save(similar_path, current_generation(SIMILAR_GENERATION));
+    }
+    readers.close();
+    statements.close();
+    if (this->db) {
+        sqlite3_close(this->db);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Database::exec
+// ----------------------------------------------------------------------------
+// Runs a statement without parameters or results, such as BEGIN or COMMIT,
+// on the writer. Callers hold write_mtx.
+//-----------------------------------------------------------------------------
+bool Database::exec (const char *sql) {
+    CachedStatement stmt(&statements, sql);
+    if (!stmt || sqlite3_step(stmt) != SQLITE_DONE) {
+        errlog("Database::exec: Failed to execute %s\n", sql);
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Database::rollback
+// ----------------------------------------------------------------------------
+// Rolls back the open transaction and discards the index changes it made.
+// Tags first named in it are forgotten by the tag_ids cache, since their rows
+// are gone and their ids may be handed to other tags. Callers hold write_mtx.
+//-----------------------------------------------------------------------------
+void Database::rollback (IndexChanges *changes) {
+    exec("ROLLBACK;");
+    for (const auto &tag : changes->tags_named) {
+        tag_ids.erase(tag.second);
+    }
+    changes->clear();
+}
+
 //-----------------------------------------------------------------------------
 // Database::init
 // ----------------------------------------------------------------------------
@@ -101,7 +165,10 @@ void Database::init (void) {
         "num_user_tags INTEGER,"\
         "user_tags TEXT NOT NULL,"\
         "user_bpm INTEGER,"\
-        "user_key INTEGER"\
+        "user_key INTEGER,"\
+        "file_mtime INTEGER NOT NULL DEFAULT 0,"\
+        "duration_ms INTEGER NOT NULL DEFAULT 0,"\
+        "analysis_state INTEGER NOT NULL DEFAULT 0"\
         ");";
 
     char *err_msg = nullptr;
@@ -109,278 +176,2710 @@ void Database::init (void) {
         sqlite3_free(err_msg);
         errlog("Database::init: Error creating table.\n");
     }
+
+    // state of every directory listed by the scanner
+    const char *dir_sql = "CREATE TABLE IF NOT EXISTS directories"\
+        "("\
+        "dir_path TEXT PRIMARY KEY,"\
+        "parent_path TEXT NOT NULL,"\
+        "dir_mtime INTEGER NOT NULL DEFAULT 0,"\
+        "num_entries INTEGER NOT NULL DEFAULT 0"\
+        ");";
+
+    if (sqlite3_exec(this->db, dir_sql, nullptr, nullptr, &err_msg) != SQLITE_OK) {
+        sqlite3_free(err_msg);
+        errlog("Database::init: Error creating directories table.\n");
+    }
+
+    // scan journal: a root whose finished time is 0 was interrupted
+    const char *scan_sql = "CREATE TABLE IF NOT EXISTS scans"\
+        "("\
+        "root_path TEXT PRIMARY KEY,"\
+        "started INTEGER NOT NULL DEFAULT 0,"\
+        "finished INTEGER NOT NULL DEFAULT 0"\
+        ");";
+
+    if (sqlite3_exec(this->db, scan_sql, nullptr, nullptr, &err_msg) != SQLITE_OK) {
+        sqlite3_free(err_msg);
+        errlog("Database::init: Error creating scans table.\n");
+    }
+
+    // columns added to audio_files after databases were already in use
+    struct {
+        const char *name;
+        const char *sql;
+    } added_columns[] = {
+        {"file_mtime", "ALTER TABLE audio_files "\
+            "ADD COLUMN file_mtime INTEGER NOT NULL DEFAULT 0;"},
+        {"duration_ms", "ALTER TABLE audio_files "\
+            "ADD COLUMN duration_ms INTEGER NOT NULL DEFAULT 0;"},
+        {"analysis_state", "ALTER TABLE audio_files "\
+            "ADD COLUMN analysis_state INTEGER NOT NULL DEFAULT 0;"},
+        {"embedding", "ALTER TABLE audio_files "\
+            "ADD COLUMN embedding BLOB;"},
+    };
+    for (const auto &column : added_columns) {
+        if (!column_exists("audio_files", column.name) &&
+            sqlite3_exec(this->db, column.sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+            errlog("Database::init: Error adding %s column.\n", column.name);
+        }
+    }
+
+    // the analysis backlog is found through a partial index that only holds
+    // files still waiting to be analyzed
+    const char *pending_sql = "CREATE INDEX IF NOT EXISTS audio_files_pending "\
+        "ON audio_files(id) WHERE analysis_state = 0;";
+    if (sqlite3_exec(this->db, pending_sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        errlog("Database::init: Error creating analysis index.\n");
+    }
+
+    // each range filter of query_files has an index led by its own column
+    // and carrying the other filters' columns, so a compound filter is
+    // checked inside whichever index the planner picks before a row is read
+    const char *range_sql = "CREATE INDEX IF NOT EXISTS audio_files_bpm "\
+        "ON audio_files(" BPM_EXPR ", " KEY_EXPR ", duration_ms);"\
+        "CREATE INDEX IF NOT EXISTS audio_files_key "\
+        "ON audio_files(" KEY_EXPR ", " BPM_EXPR ", duration_ms);"\
+        "CREATE INDEX IF NOT EXISTS audio_files_duration "\
+        "ON audio_files(duration_ms, " BPM_EXPR ", " KEY_EXPR ");"\
+        "CREATE INDEX IF NOT EXISTS audio_files_size ON audio_files(file_size);";
+    if (sqlite3_exec(this->db, range_sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        errlog("Database::init: Error creating range indexes.\n");
+    }
+
+    // counts the transactions that changed the search indexes, so a saved
+    // snapshot can tell whether it is current (see load_search_indexes)
+    const char *meta_sql = "CREATE TABLE IF NOT EXISTS meta"\
+        "("\
+        "key TEXT PRIMARY KEY,"\
+        "value INTEGER NOT NULL"\
+        ");";
+    if (sqlite3_exec(this->db, meta_sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        errlog("Database::init: Error creating meta table.\n");
+    }
+
+    this->fts_enabled = init_fts();
+    init_tags();
 }
 
 //-----------------------------------------------------------------------------
-// Database::table_is_valid
+// Database::init_tags
 // ----------------------------------------------------------------------------
-// Checks if a database table exists.
+// Sets up the normalized tag tables: every distinct tag is interned once in
+// tags, and file_tags holds one row per tag of a file, keyed by tag first so
+// a tag's files are read in order (see TagIndex). The source column tells
+// auto tags (0) from user tags (1). Rows follow their file out through a
+// delete trigger. A library indexed before these tables existed has its tag
+// strings split into them once, by run_migrations (see migrate_tags).
 //-----------------------------------------------------------------------------
-bool Database::table_is_valid  (const char *table_name) {
-    
-    // prepare statement to select 1 element from db and table
-    char *sql = concat_cstrs(3, "SELECT 1 FROM ", table_name, " LIMIT 1;");
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(this->db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        errlog("Database::table_is_valid: Failed to prepare statement.\n");
+void Database::init_tags (void) {
+
+    bool exists = false;
+    {
+        CachedStatement stmt(&statements, "SELECT 1 FROM sqlite_master "\
+            "WHERE type = 'table' AND name = 'file_tags';");
+        exists = (stmt && sqlite3_step(stmt) == SQLITE_ROW);
+    }
+
+    const char *tags_sql = "CREATE TABLE IF NOT EXISTS tags"\
+        "("\
+        "id INTEGER PRIMARY KEY,"\
+        "name TEXT NOT NULL UNIQUE"\
+        ");"\
+        "CREATE TABLE IF NOT EXISTS file_tags"\
+        "("\
+        "tag_id INTEGER NOT NULL,"\
+        "file_id INTEGER NOT NULL,"\
+        "source INTEGER NOT NULL,"\
+        "PRIMARY KEY (tag_id, file_id, source)"\
+        ") WITHOUT ROWID;"\
+        "CREATE INDEX IF NOT EXISTS file_tags_file ON file_tags(file_id);"\
+        "CREATE TRIGGER IF NOT EXISTS audio_files_tags_delete "\
+        "AFTER DELETE ON audio_files BEGIN "\
+        "DELETE FROM file_tags WHERE file_id = old.id; "\
+        "END;";
+
+    // the migration is flagged in the same transaction the tables are made
+    std::string sql = std::string("BEGIN TRANSACTION;") + tags_sql;
+    if (!exists) {
+        sql += "INSERT INTO meta (key, value) VALUES ('" TAGS_MIGRATION_PENDING "', 1) "\
+            "ON CONFLICT(key) DO UPDATE SET value = 1;";
+    }
+    sql += "COMMIT;";
+
+    char *err_msg = nullptr;
+    if (sqlite3_exec(this->db, sql.c_str(), nullptr, nullptr, &err_msg) != SQLITE_OK) {
+        sqlite3_free(err_msg);
+        sqlite3_exec(this->db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        errlog("Database::init_tags: Error creating tag tables.\n");
     }
-    
-    delete[] sql;
-    
-    // execute statement: db table is valid if execution return matches row
-    bool valid = (sqlite3_step(stmt) == SQLITE_ROW);
-    sqlite3_finalize(stmt);
-    return valid;
 }
 
 //-----------------------------------------------------------------------------
-// Database::num_rows
+// Database::migrate_tags
 // ----------------------------------------------------------------------------
-// Returns the number of rows in a database table.
+// Splits the tag strings of every file into the tag tables, for a library
+// indexed before they existed. Files stored since the tables were made
+// already have their rows, which store_file_tags leaves as they are.
+// Called by run_migrations with write_mtx held. Returns false if it failed.
 //-----------------------------------------------------------------------------
-int Database::num_rows (const char *table_name) {
-    // prepare statement to select the count of all rows in the table
-    sqlite3_stmt* stmt;
-    
-    char *sql = concat_cstrs(2, "SELECT COUNT(*) FROM ", table_name);
-    if (sqlite3_prepare_v2(this->db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        errlog("Database::num_rows: Failed to prepare statement.\n");
+bool Database::migrate_tags (void) {
+
+    CachedStatement stmt(&statements, 
+        "SELECT id, auto_tags, user_tags FROM audio_files;");
+    if (!stmt) {
+        errlog("Database::migrate_tags: Failed to prepare statement.\n");
+        return false;
     }
-    
-    delete[] sql;
 
-    // execute the SELECT command
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        int row_count = sqlite3_column_int(stmt, 0);
-        sqlite3_finalize(stmt);
-        return row_count;
-    } else {
-        sqlite3_finalize(stmt);
-        errlog("Database::num_rows: Failed to execute sql statement.\n");
-        return 0;
+    // the postings are not logged; the new generation leaves any snapshot
+    // behind, so the indexes are next read from the tables
+    IndexChanges changes;
+    exec("BEGIN TRANSACTION;");
+    bump_generation(INDEX_GENERATION);
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char *auto_tags = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+        int auto_size = sqlite3_column_bytes(stmt, 1);
+        const char *user_tags = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2));
+        int user_size = sqlite3_column_bytes(stmt, 2);
+        store_file_tags(
+            sqlite3_column_int64(stmt, 0),
+            std::string_view(auto_tags ? auto_tags : "", auto_size),
+            std::string_view(user_tags ? user_tags : "", user_size),
+            &changes
+        );
+
+        // tags_named is kept so a rollback can forget the interned ids
+        changes.tags_added.clear();
+        changes.tags_removed.clear();
     }
+    sqlite3_reset(stmt);
+    if (result != SQLITE_DONE) {
+        errlog("Database::migrate_tags: Error reading tags.\n");
+        rollback(&changes);
+        return false;
+    }
+    set_meta(TAGS_MIGRATION_PENDING, 0);
+    exec("COMMIT;");
+    return true;
 }
 
 //-----------------------------------------------------------------------------
-// Database::entry_exists
+// Database::intern_tag
 // ----------------------------------------------------------------------------
-// determines if an entry already exists in a database table file paths are 
-// used as unique identifiers of table entries
+// Returns the id of a tag, adding it to the tags table if it is new. Ids are
+// cached, so a known tag costs no query. Tags missing from the cache are
+// added to changes so the TagIndex learns their names. Called with write_mtx
+// held.
 //-----------------------------------------------------------------------------
-bool 
-Database::entry_exists (const char *table_name, std::wstring *file_path){
+int64_t Database::intern_tag (std::string_view name, IndexChanges *changes) {
 
-    // prepare the SQL statement to select 1 entry with matching file_path
-    sqlite3_stmt* stmt;
-    char *sql = concat_cstrs(
-        3, 
-        "SELECT 1 FROM ", 
-        table_name, 
-        " WHERE file_path = ? LIMIT 1;"
-    );
-    if (sqlite3_prepare_v2(this->db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        errlog("Database::entry_exists: Failed to prepare SELECT statement\n");
+    auto cached = tag_ids.find(name);
+    if (cached != tag_ids.end()) {
+        return cached->second;
     }
-    
-    delete[] sql;
 
-    // bind the file path to the select statment
-    int result = sqlite3_bind_text16(
-        stmt, 
-        1, 
-        file_path->c_str(), 
-        -1, 
-        SQLITE_TRANSIENT);
-    if (result != SQLITE_OK) {
-        errlog("Database:entry_exists: Failed to bind values.\n");
+    CachedStatement stmt(&statements, "INSERT INTO tags (name) VALUES (?) "\
+        "ON CONFLICT(name) DO UPDATE SET name = excluded.name RETURNING id;");
+    if (!stmt) {
+        errlog("Database::intern_tag: Failed to prepare statement.\n");
+        return 0;
     }
+    sqlite3_bind_text(stmt, 1, name.data(), static_cast<int>(name.size()), SQLITE_STATIC);
 
-    // execute the SQL statement to check if the file exists
-    bool exists = (sqlite3_step(stmt) == SQLITE_ROW);
-    sqlite3_finalize(stmt);
-    return exists;
+    int64_t tag_id = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        tag_id = sqlite3_column_int64(stmt, 0);
+        tag_ids.emplace(std::string(name), tag_id);
+        changes->tags_named.emplace_back(tag_id, std::string(name));
+    }
+    else {
+        errlog("Database::intern_tag: Error inserting tag.\n");
+    }
+    return tag_id;
 }
 
 //-----------------------------------------------------------------------------
-// Database::insert_file
+// select_file_tags
 // ----------------------------------------------------------------------------
-// This function works inserts a single file into the database
+// Reads the sorted, distinct tag ids of a file into tag_ids.
 //-----------------------------------------------------------------------------
-void Database::insert_file (struct FileRecord *file) {
-    // create statement to insert all members of explorer file struct
-    const char *sql = "INSERT OR IGNORE INTO audio_files ("\
-        "file_path,"\
-        "file_name,"\
-        "file_size,"\
-        "num_user_tags,"\
-        "user_tags,"\
-        "num_auto_tags,"\
-        "auto_tags,"\
-        "user_bpm,"\
-        "user_key,"\
-        "auto_bpm,"\
-        "auto_key"\
-        ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
-    sqlite3_stmt *stmt = nullptr;
-    if (sqlite3_prepare_v2(this->db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        errlog("Database::insert_files: Error preparing statement.\n");
+static void select_file_tags (sqlite3_stmt *stmt, int64_t file_id, 
+    std::vector<int64_t> *tag_ids) {
+
+    tag_ids->clear();
+    sqlite3_bind_int64(stmt, 1, file_id);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        tag_ids->push_back(sqlite3_column_int64(stmt, 0));
+    }
+    sqlite3_reset(stmt);
+}
+
+//-----------------------------------------------------------------------------
+// Database::store_file_tags
+// ----------------------------------------------------------------------------
+// Replaces the auto tags of a file and adds its user tags, both given as
+// space separated strings. Stored user tags are kept, since a rescanned file
+// arrives without them. The file's tags before and after are compared and
+// the postings that changed are added to changes for the TagIndex. Called
+// with write_mtx held.
+//-----------------------------------------------------------------------------
+void Database::store_file_tags (int64_t file_id, std::string_view auto_tags,
+    std::string_view user_tags, IndexChanges *changes) {
+
+    CachedStatement select_stmt(&statements, "SELECT DISTINCT tag_id FROM file_tags "\
+        "WHERE file_id = ? ORDER BY tag_id;");
+    CachedStatement delete_stmt(&statements, "DELETE FROM file_tags "\
+        "WHERE file_id = ? AND source = 0;");
+    CachedStatement insert_stmt(&statements, "INSERT OR IGNORE INTO file_tags "\
+        "(tag_id, file_id, source) VALUES (?, ?, ?);");
+    if (!select_stmt || !delete_stmt || !insert_stmt) {
+        errlog("Database::store_file_tags: Failed to prepare statement.\n");
         return;
     }
 
-    // bind the FileRecord data to the INSERT statement arguments
-    sqlite3_bind_text16(stmt, 1, file->file_path.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text16(stmt, 2, file->file_name.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 3, file->file_size);
-    sqlite3_bind_double(stmt, 4, 0);
-    sqlite3_bind_int(stmt, 5, file->num_user_tags);
-    sqlite3_bind_text16(stmt, 6, file->user_tags.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 7, file->num_auto_tags);
-    sqlite3_bind_text16(stmt, 8, file->auto_tags.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 9, file->user_bpm);
-    sqlite3_bind_int(stmt, 10, file->user_key);
-    sqlite3_bind_int(stmt, 11, file->auto_bpm);
-    sqlite3_bind_int(stmt, 12, file->auto_key);
-    
+    select_file_tags(select_stmt, file_id, &old_tags);
+
+    sqlite3_bind_int64(delete_stmt, 1, file_id);
+    if (sqlite3_step(delete_stmt) != SQLITE_DONE) {
+        errlog("Database::store_file_tags: Error deleting tags.\n");
+    }
+
+    // tags are separated by single spaces
+    auto insert_tags = [&](std::string_view tags, int source) {
+        while (!tags.empty()) {
+            size_t end = tags.find(' ');
+            std::string_view tag = tags.substr(0, end);
+            tags.remove_prefix(end == std::string_view::npos ? tags.size() : end + 1);
+            if (tag.empty()) {
+                continue;
+            }
+
+            sqlite3_bind_int64(insert_stmt, 1, intern_tag(tag, changes));
+            sqlite3_bind_int64(insert_stmt, 2, file_id);
+            sqlite3_bind_int(insert_stmt, 3, source);
+            if (sqlite3_step(insert_stmt) != SQLITE_DONE) {
+                errlog("Database::store_file_tags: Error inserting tag.\n");
+            }
+            sqlite3_reset(insert_stmt);
+        }
+    };
+    insert_tags(auto_tags, 0);
+    insert_tags(user_tags, 1);
+
+    select_file_tags(select_stmt, file_id, &new_tags);
+
+    // both lists are sorted, so one merge finds what changed
+    size_t i = 0, j = 0;
+    while (i < old_tags.size() || j < new_tags.size()) {
+        if (j == new_tags.size() || (i < old_tags.size() && old_tags[i] < new_tags[j])) {
+            changes->tags_removed.push_back({old_tags[i++], file_id});
+        }
+        else if (i == old_tags.size() || new_tags[j] < old_tags[i]) {
+            changes->tags_added.push_back({new_tags[j++], file_id});
+        }
+        else {
+            ++i;
+            ++j;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Database::bump_generation
+// ----------------------------------------------------------------------------
+// Advances the generation stored under key and returns it. Called inside
+// every transaction that changes the indexes it tracks, with write_mtx held.
+//-----------------------------------------------------------------------------
+int64_t Database::bump_generation (const char *key) {
+
+    CachedStatement stmt(&statements, "INSERT INTO meta (key, value) "\
+        "VALUES (?, 1) "\
+        "ON CONFLICT(key) DO UPDATE SET value = value + 1 RETURNING value;");
+    if (!stmt) {
+        errlog("Database::bump_generation: Failed to prepare statement.\n");
+        return 0;
+    }
+    sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+
+    int64_t generation = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        generation = sqlite3_column_int64(stmt, 0);
+        sqlite3_step(stmt);
+    }
+    else {
+        errlog("Database::bump_generation: Error updating generation.\n");
+    }
+    return generation;
+}
+
+//-----------------------------------------------------------------------------
+// Database::current_generation
+// ----------------------------------------------------------------------------
+// Returns the generation stored under key, 0 for indexes that have never
+// changed. Called with write_mtx held.
+//-----------------------------------------------------------------------------
+int64_t Database::current_generation (const char *key) {
+    return meta_value(key);
+}
+
+//-----------------------------------------------------------------------------
+// Database::meta_value / set_meta
+// ----------------------------------------------------------------------------
+// Read and write a value of the meta table, 0 if it was never set. Called
+// with write_mtx held, or before the database is shared.
+//-----------------------------------------------------------------------------
+int64_t Database::meta_value (const char *key) {
+
+    CachedStatement stmt(&statements, "SELECT value FROM meta WHERE key = ?;");
+    if (!stmt) {
+        errlog("Database::meta_value: Failed to prepare statement.\n");
+        return 0;
+    }
+    sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+    return sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+}
+
+void Database::set_meta (const char *key, int64_t value) {
+
+    CachedStatement stmt(&statements, "INSERT INTO meta (key, value) VALUES (?, ?) "\
+        "ON CONFLICT(key) DO UPDATE SET value = excluded.value;");
+    if (!stmt) {
+        errlog("Database::set_meta: Failed to prepare statement.\n");
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, value);
     if (sqlite3_step(stmt) != SQLITE_DONE) {
-        errlog("Database::insert_file: Error inserting data.\n");
+        errlog("Database::set_meta: Error updating meta.\n");
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Database::read_tag_index
+// ----------------------------------------------------------------------------
+// Fills the TagIndex from the tag tables. Called by load_search_indexes with
+// write_mtx held.
+//-----------------------------------------------------------------------------
+void Database::read_tag_index (void) {
+
+    CachedStatement tags_stmt(&statements, "SELECT id, name FROM tags;");
+    CachedStatement stmt(&statements, "SELECT tag_id, file_id FROM file_tags "\
+        "ORDER BY tag_id, file_id;");
+    if (!tags_stmt || !stmt) {
+        errlog("Database::read_tag_index: Failed to prepare statement.\n");
+        return;
+    }
+
+    while (sqlite3_step(tags_stmt) == SQLITE_ROW) {
+        const char *name = reinterpret_cast<const char *>(sqlite3_column_text(tags_stmt, 1));
+        tag_index.add_tag(sqlite3_column_int64(tags_stmt, 0), 
+            std::string_view(name ? name : "", sqlite3_column_bytes(tags_stmt, 1)));
     }
 
-    // reset the statement for reuse
-    sqlite3_reset(stmt); 
+    std::vector<TagPosting> batch;
+    batch.reserve(TAG_LOAD_BATCH);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        batch.push_back({sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1)});
+        if (batch.size() == TAG_LOAD_BATCH) {
+            tag_index.load(batch);
+            batch.clear();
+        }
+    }
+    tag_index.load(batch);
 }
 
 //-----------------------------------------------------------------------------
-// Database::insert_files
+// Database::read_name_index
 // ----------------------------------------------------------------------------
-// db_insert_files inserts entries in the audio_files database table data to 
-// insert comes from a vector of FileRecord structs
+// Fills the TrigramIndex with the name of every file. Called by
+// load_search_indexes with write_mtx held.
 //-----------------------------------------------------------------------------
-void Database::insert_files (ThreadSafeQueue<struct FileRecord *> *files
-) {
-    // create statement to insert all members of explorer file struct
-    const char* sql = "INSERT OR IGNORE INTO audio_files ("\
-        "file_path,"\
-        "file_name,"\
-        "file_size,"\
-        "num_user_tags,"\
-        "user_tags,"\
-        "num_auto_tags,"\
-        "auto_tags,"\
-        "user_bpm,"\
-        "user_key,"\
-        "auto_bpm,"\
-        "auto_key"\
-        ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        panicf("db_insert_files: Error preparing statement.\n");
-    } 
+void Database::read_name_index (void) {
 
-    // insert files in a single transaction
-    sqlite3_exec(this->db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
-    while (!files->empty()) {
-        
-        struct FileRecord* file;
-        files->wait_pop(file);
-        
-        sqlite3_bind_text16(stmt, 1, file->file_path.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text16(stmt, 2, file->file_name.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 3, file->file_size);
-        sqlite3_bind_int(stmt, 5, file->num_user_tags);
-        sqlite3_bind_text16(stmt, 6, file->user_tags.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 7, file->num_auto_tags);
-        sqlite3_bind_text16(stmt, 8, file->auto_tags.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 9, file->user_bpm);
-        sqlite3_bind_int(stmt, 10, file->user_key);
-        sqlite3_bind_int(stmt, 11, file->auto_bpm);
-        sqlite3_bind_int(stmt, 12, file->auto_key);
+    CachedStatement stmt(&statements, "SELECT id, file_name FROM audio_files "\
+        "ORDER BY id;");
+    if (!stmt) {
+        errlog("Database::read_name_index: Failed to prepare statement.\n");
+        return;
+    }
 
-        if (sqlite3_step(stmt) != SQLITE_DONE) {
-            fprintf(stderr, "db_insert_file: Error inserting data.\n");
+    std::vector<std::pair<int64_t, std::string>> batch;
+    batch.reserve(TRIGRAM_LOAD_BATCH);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+        batch.emplace_back(sqlite3_column_int64(stmt, 0),
+            std::string(name ? name : "", sqlite3_column_bytes(stmt, 1)));
+        if (batch.size() == TRIGRAM_LOAD_BATCH) {
+            name_index.load(batch);
+            batch.clear();
         }
-        sqlite3_reset(stmt);
-        
-        delete file;
     }
-    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
-    sqlite3_finalize(stmt);
+    name_index.load(batch);
 }
 
 //-----------------------------------------------------------------------------
-// db_search_files_by_name
+// Database::run_migrations
 // ----------------------------------------------------------------------------
-// Function to search files by name
+// Runs the one-time migrations flagged when the database was opened, which
+// rewrite every row and take long on a large library. Meant to run on a
+// background thread at startup, before the search indexes are loaded. Each
+// clears its flag in its own transaction, so an interrupted migration runs
+// again next time.
 //-----------------------------------------------------------------------------
-void Database::search_by_name (std::vector<struct FileRecord> *search_result, const char *query) {
-    // prepare sql statement
-    sqlite3_stmt* stmt;
-    const char *sql = "SELECT "\
-        "file_path, "\
-        "file_name, "\
-        "file_size, "\
-        "num_user_tags, "\
-        "user_tags, "\
-        "num_auto_tags, "\
-        "auto_tags, "\
-        "user_bpm, "\
-        "user_key, "\
-        "auto_bpm, "\
-        "auto_key "\
-        "FROM audio_files WHERE file_name LIKE ?;";
-    
-    if (sqlite3_prepare_v2(this->db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        errlog("Database::search_by_name: Failed to prepare sql statement.\n");
+void Database::run_migrations (void) {
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+
+    // searches scan file names until the full-text index holds every file
+    if (meta_value(FTS_REBUILD_PENDING) != 0) {
+        errlog("Database::run_migrations: Building the full-text index.\n");
+        exec("BEGIN TRANSACTION;");
+        if (exec("INSERT INTO audio_files_fts(audio_files_fts) VALUES ('rebuild');")) {
+            set_meta(FTS_REBUILD_PENDING, 0);
+            exec("COMMIT;");
+            fts_enabled = true;
+        }
+        else {
+            exec("ROLLBACK;");
+        }
     }
-    
-    // Bind the search query with wildcard characters for pattern matching
-    const char *query_param = concat_cstrs(3, "%", query, "%");
-    int result = sqlite3_bind_text(stmt, 1, query_param, -1, SQLITE_STATIC);
-    if (result != SQLITE_OK) {
-        errlog("Database::search_by_name: Failed to bind sql statement.\n");
+
+    // indexes a search loaded in the meantime were read from unfilled tables
+    if (meta_value(TAGS_MIGRATION_PENDING) != 0) {
+        errlog("Database::run_migrations: Moving tags into the tag tables.\n");
+        if (migrate_tags() && tag_index.is_loaded()) {
+            tag_index.clear();
+            read_tag_index();
+            tag_index.set_loaded();
+            query_cache.clear();
+        }
     }
-    delete[] query_param;
+}
 
-    // Execute the statement and process the results
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        struct FileRecord file;
+//-----------------------------------------------------------------------------
+// Database::load_search_indexes
+// ----------------------------------------------------------------------------
+// Loads the in-memory search indexes. Meant to run on a background thread at
+// startup; a search that arrives first loads them itself.
+// The saved snapshot is mapped and copied into the indexes, and the delta
+// log brings it up to date. If that does not reach the database's current
+// generation, because the log was cut short or the database was changed
+// without it, the indexes are read from the tables instead and saved as a
+// new snapshot. Runs with write_mtx held, so no transaction can commit
+// before the indexes go live; from then on every commit applies its own
+// changes to them.
+//-----------------------------------------------------------------------------
+void Database::load_search_indexes (void) {
 
-        // retrieve file path
-        const void *text = sqlite3_column_text16(stmt, 0);
-        int text_size = sqlite3_column_bytes16(stmt, 0);
-        std::wstring path_string(reinterpret_cast<const wchar_t *>(text), text_size / sizeof(wchar_t));
-        file.file_path = path_string;
+    std::lock_guard<std::mutex> lock(write_mtx);
+    if (tag_index.is_loaded() && name_index.is_loaded()) {
+        return;
+    }
+    tag_index.clear();
+    name_index.clear();
 
-        // retrieve file name
-        const void *name_text = sqlite3_column_text16(stmt, 0);
-        int name_text_size = sqlite3_column_bytes16(stmt, 0);
-        std::wstring name_string(reinterpret_cast<const wchar_t *>(text), text_size / sizeof(wchar_t));
-        file.file_name = name_string;
+    int64_t generation = current_generation(INDEX_GENERATION);
+    bool restored = false;
 
-        // retrieve file size
-        file.file_size = sqlite3_column_int(stmt, 2);
-        
-        // retrieve user tags
-        file.num_user_tags = sqlite3_column_int(stmt, 3);
-        const void *utags_text = sqlite3_column_text16(stmt, 0);
-        int utags_text_size = sqlite3_column_bytes16(stmt, 0);
-        std::wstring utags_string(reinterpret_cast<const wchar_t *>(text), utags_text_size / sizeof(wchar_t));
-        file.user_tags = utags_string;
-
-        // retrieve automatically generated tags
-        file.num_auto_tags = sqlite3_column_int(stmt, 3);
-        const void *atags_text = sqlite3_column_text16(stmt, 0);
-        int atags_text_size = sqlite3_column_bytes16(stmt, 0);
-        std::wstring atags_string(reinterpret_cast<const wchar_t *>(text), atags_text_size / sizeof(wchar_t));
-        file.user_tags = atags_string;
-
-        file.user_bpm = sqlite3_column_int(stmt, 7);
-        file.user_key = sqlite3_column_int(stmt, 8);
-        file.auto_bpm = sqlite3_column_int(stmt, 9);
-        file.auto_key = sqlite3_column_int(stmt, 10);
+    IndexSnapshot snapshot;
+    if (snapshot.open(snapshot_path)) {
+        snapshot.restore(&tag_index, &name_index);
+        int64_t replayed = delta_log.replay(snapshot.generation(), 
+            [this](IndexChanges &changes) {
+                update_indexes(changes);
+            });
+        snapshot.close();
 
-        search_result->push_back(file);
+        restored = (replayed == generation);
+        if (!restored) {
+            tag_index.clear();
+            name_index.clear();
+        }
     }
-    
-    sqlite3_finalize(stmt);
-}
\ No newline at end of file
+
+    if (!restored) {
+        read_tag_index();
+        read_name_index();
+        if (IndexSnapshot::write(snapshot_path, generation, &tag_index, &name_index)) {
+            delta_log.truncate();
+        }
+    }
+
+    tag_index.set_loaded();
+    name_index.set_loaded();
+    query_cache.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Database::load_similar_index
+// ----------------------------------------------------------------------------
+// Loads the similarity graph. Meant to run on a background thread at startup;
+// a similarity search that arrives first loads it itself.
+// The graph saved at shutdown is used if it was saved at the current
+// generation. Otherwise it is rebuilt from the stored embeddings, which only
+// happens after a crash or on the first start with embeddings, and saved.
+// Runs with write_mtx held, so no analysis commits while it loads.
+//-----------------------------------------------------------------------------
+void Database::load_similar_index (void) {
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+    if (similar_index.is_loaded()) {
+        return;
+    }
+
+    int64_t generation = current_generation(SIMILAR_GENERATION);
+    if (similar_index.load(similar_path) == generation) {
+        similar_index.set_loaded();
+        return;
+    }
+    similar_index.clear();
+
+    CachedStatement stmt(&statements, "SELECT id, embedding FROM audio_files "\
+        "WHERE embedding IS NOT NULL ORDER BY id;");
+    if (!stmt) {
+        errlog("Database::load_similar_index: Failed to prepare statement.\n");
+        return;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        size_t num_bytes = static_cast<size_t>(sqlite3_column_bytes(stmt, 1));
+        if (num_bytes == EMBEDDING_DIM * sizeof(float)) {
+            similar_index.insert(sqlite3_column_int64(stmt, 0),
+                static_cast<const float *>(sqlite3_column_blob(stmt, 1)));
+        }
+    }
+
+    similar_index.save(similar_path, generation);
+    similar_index.set_loaded();
+}
+
+//-----------------------------------------------------------------------------
+// Database::update_indexes
+// ----------------------------------------------------------------------------
+// Applies one transaction's changes to both in-memory indexes.
+//-----------------------------------------------------------------------------
+void Database::update_indexes (const IndexChanges &changes) {
+
+    for (const auto &tag : changes.tags_named) {
+        tag_index.add_tag(tag.first, tag.second);
+    }
+    if (!changes.tags_added.empty() || !changes.tags_removed.empty()) {
+        tag_index.apply(changes.tags_added, changes.tags_removed);
+    }
+    if (!changes.names_added.empty() || !changes.files_removed.empty()) {
+        name_index.apply(changes.names_added, changes.files_removed);
+    }
+
+    // after the indexes change, so no search can cache what they held before
+    query_cache.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Database::apply_index_changes
+// ----------------------------------------------------------------------------
+// Records the changes of a committed transaction in the delta log, hands
+// them to the in-memory indexes if they are loaded, and clears them. Once
+// the log grows past DELTA_LOG_COMPACT_BYTES the indexes are saved as a new
+// snapshot and the log starts over. Called with write_mtx held.
+//-----------------------------------------------------------------------------
+void Database::apply_index_changes (IndexChanges *changes) {
+
+    delta_log.append(*changes);
+
+    bool loaded = tag_index.is_loaded() && name_index.is_loaded();
+    if (loaded) {
+        update_indexes(*changes);
+    }
+
+    if (loaded && delta_log.size() > DELTA_LOG_COMPACT_BYTES &&
+        IndexSnapshot::write(snapshot_path, changes->generation, &tag_index, &name_index)) {
+        delta_log.truncate();
+    }
+    changes->clear();
+}
+
+//-----------------------------------------------------------------------------
+// Database::init_fts
+// ----------------------------------------------------------------------------
+// Sets up audio_files_fts, a full-text index over the name and tags of every
+// file. It is an external content table: the text lives only in audio_files
+// and triggers keep the index in step with every insert, update and delete.
+// Prefix indexes make short prefix queries as cheap as whole tokens, and the
+// stored rank weights a match in the name above one in the tags. An index
+// created over an existing library is filled from audio_files once, by
+// run_migrations rather than here, so opening the database stays quick.
+// Returns false if sqlite was built without FTS5, or until the index is
+// filled.
+//-----------------------------------------------------------------------------
+bool Database::init_fts (void) {
+
+    bool exists = false;
+    {
+        CachedStatement stmt(&statements, "SELECT 1 FROM sqlite_master "\
+            "WHERE type = 'table' AND name = 'audio_files_fts';");
+        exists = (stmt && sqlite3_step(stmt) == SQLITE_ROW);
+    }
+    if (exists) {
+        return meta_value(FTS_REBUILD_PENDING) == 0;
+    }
+
+    const char *fts_sql = "CREATE VIRTUAL TABLE audio_files_fts USING fts5("\
+        "file_name,"\
+        "auto_tags,"\
+        "user_tags,"\
+        "content = 'audio_files',"\
+        "content_rowid = 'id',"\
+        "tokenize = 'unicode61 remove_diacritics 2',"\
+        "prefix = '1 2 3'"\
+        ");"\
+        "INSERT INTO audio_files_fts(audio_files_fts, rank) "\
+        "VALUES('rank', 'bm25(10.0, 2.0, 4.0)');"\
+        "CREATE TRIGGER audio_files_fts_insert AFTER INSERT ON audio_files BEGIN "\
+        "INSERT INTO audio_files_fts(rowid, file_name, auto_tags, user_tags) "\
+        "VALUES (new.id, new.file_name, new.auto_tags, new.user_tags); "\
+        "END;"\
+        "CREATE TRIGGER audio_files_fts_delete AFTER DELETE ON audio_files BEGIN "\
+        "INSERT INTO audio_files_fts(audio_files_fts, rowid, file_name, auto_tags, user_tags) "\
+        "VALUES ('delete', old.id, old.file_name, old.auto_tags, old.user_tags); "\
+        "END;"\
+        "CREATE TRIGGER audio_files_fts_update "\
+        "AFTER UPDATE OF file_name, auto_tags, user_tags ON audio_files BEGIN "\
+        "INSERT INTO audio_files_fts(audio_files_fts, rowid, file_name, auto_tags, user_tags) "\
+        "VALUES ('delete', old.id, old.file_name, old.auto_tags, old.user_tags); "\
+        "INSERT INTO audio_files_fts(rowid, file_name, auto_tags, user_tags) "\
+        "VALUES (new.id, new.file_name, new.auto_tags, new.user_tags); "\
+        "END;"\
+        "INSERT INTO meta (key, value) VALUES ('" FTS_REBUILD_PENDING "', 1) "\
+        "ON CONFLICT(key) DO UPDATE SET value = 1;";
+
+    // all or nothing, so a failure never leaves the index without triggers
+    char *err_msg = nullptr;
+    sqlite3_exec(this->db, "SAVEPOINT init_fts;", nullptr, nullptr, nullptr);
+    if (sqlite3_exec(this->db, fts_sql, nullptr, nullptr, &err_msg) != SQLITE_OK) {
+        errlog("Database::init_fts: Full-text index unavailable: %s\n", 
+            err_msg ? err_msg : "unknown error");
+        sqlite3_free(err_msg);
+        sqlite3_exec(this->db, "ROLLBACK TO init_fts; RELEASE init_fts;", 
+            nullptr, nullptr, nullptr);
+        return false;
+    }
+    sqlite3_exec(this->db, "RELEASE init_fts;", nullptr, nullptr, nullptr);
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Database::column_exists
+// ----------------------------------------------------------------------------
+// Checks if a table has a column with the given name.
+//-----------------------------------------------------------------------------
+bool Database::column_exists (const char *table_name, const char *column_name) {
+    
+    std::string sql = std::string("PRAGMA table_info(") + table_name + ");";
+
+    CachedStatement stmt(&statements, sql);
+    if (!stmt) {
+        errlog("Database::column_exists: Failed to prepare statement.\n");
+        return false;
+    }
+
+    // column 1 of table_info is the column name
+    bool found = false;
+    while (!found && sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+        found = (name && strcmp(name, column_name) == 0);
+    }
+    return found;
+}
+
+//-----------------------------------------------------------------------------
+// Database::table_is_valid
+// ----------------------------------------------------------------------------
+// Checks if a database table exists.
+//-----------------------------------------------------------------------------
+bool Database::table_is_valid  (const char *table_name) {
+    
+    // prepare statement to select 1 element from db and table
+    std::string sql = std::string("SELECT 1 FROM ") + table_name + " LIMIT 1;";
+    
+    PooledConnection reader(&readers);
+    if (!reader) {
+        errlog("Database::table_is_valid: No reader connection.\n");
+        return false;
+    }
+
+    CachedStatement stmt(&reader->statements, sql);
+    if (!stmt) {
+        errlog("Database::table_is_valid: Failed to prepare statement.\n");
+        return false;
+    }
+    
+    // execute statement: db table is valid if execution return matches row
+    return (sqlite3_step(stmt) == SQLITE_ROW);
+}
+
+//-----------------------------------------------------------------------------
+// Database::num_rows
+// ----------------------------------------------------------------------------
+// Returns the number of rows in a database table.
+//-----------------------------------------------------------------------------
+int Database::num_rows (const char *table_name) {
+    // prepare statement to select the count of all rows in the table
+    std::string sql = std::string("SELECT COUNT(*) FROM ") + table_name;
+
+    PooledConnection reader(&readers);
+    if (!reader) {
+        errlog("Database::num_rows: No reader connection.\n");
+        return 0;
+    }
+
+    CachedStatement stmt(&reader->statements, sql);
+    if (!stmt) {
+        errlog("Database::num_rows: Failed to prepare statement.\n");
+        return 0;
+    }
+
+    // execute the SELECT command
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        return sqlite3_column_int(stmt, 0);
+    } else {
+        errlog("Database::num_rows: Failed to execute sql statement.\n");
+        return 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Database::entry_exists
+// ----------------------------------------------------------------------------
+// determines if an entry already exists in a database table file paths are 
+// used as unique identifiers of table entries
+//-----------------------------------------------------------------------------
+bool 
+Database::entry_exists (const char *table_name, std::wstring *file_path){
+
+    // prepare the SQL statement to select 1 entry with matching file_path
+    std::string sql = std::string("SELECT 1 FROM ") + table_name +
+        " WHERE file_path = ? LIMIT 1;";
+
+    PooledConnection reader(&readers);
+    if (!reader) {
+        errlog("Database::entry_exists: No reader connection.\n");
+        return false;
+    }
+
+    CachedStatement stmt(&reader->statements, sql);
+    if (!stmt) {
+        errlog("Database::entry_exists: Failed to prepare SELECT statement\n");
+        return false;
+    }
+
+    // bind the file path to the select statment
+    int result = sqlite3_bind_text16(
+        stmt, 
+        1, 
+        file_path->c_str(), 
+        -1, 
+        SQLITE_STATIC);
+    if (result != SQLITE_OK) {
+        errlog("Database:entry_exists: Failed to bind values.\n");
+    }
+
+    // execute the SQL statement to check if the file exists
+    return (sqlite3_step(stmt) == SQLITE_ROW);
+}
+
+//-----------------------------------------------------------------------------
+// path_prefix_range
+// ----------------------------------------------------------------------------
+// Computes bounds such that lower <= file_path < upper holds exactly for the
+// paths under root. Selecting by range rather than with LIKE lets sqlite use
+// the unique file_path index.
+//-----------------------------------------------------------------------------
+static void path_prefix_range (const fs::path &root, std::wstring *lower, 
+    std::wstring *upper) {
+
+    // children of root all start with root and a trailing separator; the
+    // upper bound is the same prefix with its last character incremented
+    *lower = (root / "").wstring();
+    *upper = *lower;
+    upper->back() += 1;
+}
+
+//-----------------------------------------------------------------------------
+// Database::load_known_files
+// ----------------------------------------------------------------------------
+// Bulk loads the path, size and modification time of every indexed file under
+// root into a KnownFiles set.
+//-----------------------------------------------------------------------------
+void Database::load_known_files (const fs::path &root, KnownFiles *known) {
+
+    std::wstring lower, upper;
+    path_prefix_range(root, &lower, &upper);
+
+    const char *count_sql = "SELECT COUNT(*) FROM audio_files "\
+        "WHERE file_path >= ? AND file_path < ?;";
+    const char *select_sql = "SELECT file_path, file_size, file_mtime "\
+        "FROM audio_files WHERE file_path >= ? AND file_path < ?;";
+
+    PooledConnection reader(&readers);
+    if (!reader) {
+        errlog("Database::load_known_files: No reader connection.\n");
+        return;
+    }
+
+    // size the set up front so loading never rehashes
+    CachedStatement count_stmt(&reader->statements, count_sql);
+    if (!count_stmt) {
+        errlog("Database::load_known_files: Failed to prepare statement.\n");
+        return;
+    }
+    sqlite3_bind_text16(count_stmt, 1, lower.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text16(count_stmt, 2, upper.c_str(), -1, SQLITE_STATIC);
+    if (sqlite3_step(count_stmt) == SQLITE_ROW) {
+        known->reserve(static_cast<size_t>(sqlite3_column_int64(count_stmt, 0)));
+    }
+
+    CachedStatement stmt(&reader->statements, select_sql);
+    if (!stmt) {
+        errlog("Database::load_known_files: Failed to prepare statement.\n");
+        return;
+    }
+    sqlite3_bind_text16(stmt, 1, lower.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text16(stmt, 2, upper.c_str(), -1, SQLITE_STATIC);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const void *text = sqlite3_column_text16(stmt, 0);
+        int text_size = sqlite3_column_bytes16(stmt, 0);
+        known->add(
+            reinterpret_cast<const wchar_t *>(text),
+            text_size / sizeof(wchar_t),
+            sqlite3_column_int64(stmt, 1),
+            sqlite3_column_int64(stmt, 2)
+        );
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Database::load_known_directories
+// ----------------------------------------------------------------------------
+// Loads the stored state of root and of every directory under it.
+//-----------------------------------------------------------------------------
+void Database::load_known_directories (const fs::path &root, KnownDirectories *known) {
+
+    std::wstring exact = root.wstring();
+    std::wstring lower, upper;
+    path_prefix_range(root, &lower, &upper);
+
+    const char *sql = "SELECT dir_path, parent_path, dir_mtime, num_entries "\
+        "FROM directories WHERE dir_path = ? "\
+        "OR (dir_path >= ? AND dir_path < ?);";
+
+    PooledConnection reader(&readers);
+    if (!reader) {
+        errlog("Database::load_known_directories: No reader connection.\n");
+        return;
+    }
+
+    CachedStatement stmt(&reader->statements, sql);
+    if (!stmt) {
+        errlog("Database::load_known_directories: Failed to prepare statement.\n");
+        return;
+    }
+    sqlite3_bind_text16(stmt, 1, exact.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text16(stmt, 2, lower.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text16(stmt, 3, upper.c_str(), -1, SQLITE_STATIC);
+
+    DirectoryState state;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        state.dir_path.assign(
+            reinterpret_cast<const wchar_t *>(sqlite3_column_text16(stmt, 0)),
+            sqlite3_column_bytes16(stmt, 0) / sizeof(wchar_t)
+        );
+        state.parent_path.assign(
+            reinterpret_cast<const wchar_t *>(sqlite3_column_text16(stmt, 1)),
+            sqlite3_column_bytes16(stmt, 1) / sizeof(wchar_t)
+        );
+        state.mtime = sqlite3_column_int64(stmt, 2);
+        state.num_entries = sqlite3_column_int64(stmt, 3);
+        known->add(state);
+    }
+
+    known->link();
+}
+
+//-----------------------------------------------------------------------------
+// Database::forget_removed_directories
+// ----------------------------------------------------------------------------
+// Deletes the stored state of every directory a completed scan never
+// reached, in a single transaction. States of the directories that were
+// listed are already stored by insert_files.
+//-----------------------------------------------------------------------------
+void Database::forget_removed_directories (KnownDirectories *known) {
+
+    const char *sql = "DELETE FROM directories WHERE dir_path = ?;";
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+
+    CachedStatement stmt(&statements, sql);
+    if (!stmt) {
+        errlog("Database::forget_removed_directories: Failed to prepare statement.\n");
+        return;
+    }
+
+    exec("BEGIN TRANSACTION;");
+
+    known->for_each_removed([&stmt](const std::wstring &dir_path) {
+        sqlite3_bind_text16(stmt, 1, dir_path.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            errlog("Database::forget_removed_directories: Error deleting data.\n");
+        }
+        sqlite3_reset(stmt);
+    });
+
+    exec("COMMIT;");
+}
+
+//-----------------------------------------------------------------------------
+// Database::begin_scan
+// ----------------------------------------------------------------------------
+// Journals the start of a scan of root. Returns true if the previous scan of
+// root never finished, in which case the new scan resumes from the
+// directories that previous scan completed.
+//-----------------------------------------------------------------------------
+bool Database::begin_scan (const fs::path &root) {
+
+    std::wstring root_path = root.wstring();
+    const char *select_sql = "SELECT finished FROM scans WHERE root_path = ?;";
+    const char *upsert_sql = "INSERT OR REPLACE INTO scans "\
+        "(root_path, started, finished) VALUES (?, ?, 0);";
+
+    bool interrupted = false;
+    {
+        PooledConnection reader(&readers);
+        if (!reader) {
+            errlog("Database::begin_scan: No reader connection.\n");
+            return false;
+        }
+        CachedStatement stmt(&reader->statements, select_sql);
+        if (!stmt) {
+            errlog("Database::begin_scan: Failed to prepare statement.\n");
+            return false;
+        }
+        sqlite3_bind_text16(stmt, 1, root_path.c_str(), -1, SQLITE_STATIC);
+        interrupted = (sqlite3_step(stmt) == SQLITE_ROW &&
+                       sqlite3_column_int64(stmt, 0) == 0);
+    }
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+
+    CachedStatement stmt(&statements, upsert_sql);
+    if (!stmt) {
+        errlog("Database::begin_scan: Failed to prepare statement.\n");
+        return interrupted;
+    }
+    sqlite3_bind_text16(stmt, 1, root_path.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(time(nullptr)));
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        errlog("Database::begin_scan: Error inserting data.\n");
+    }
+    return interrupted;
+}
+
+//-----------------------------------------------------------------------------
+// Database::finish_scan
+// ----------------------------------------------------------------------------
+// Journals that the scan of root ran to completion, and refreshes the
+// statistics the query planner uses to pick an index for each filter of
+// query_files.
+//-----------------------------------------------------------------------------
+void Database::finish_scan (const fs::path &root) {
+
+    std::wstring root_path = root.wstring();
+    const char *sql = "UPDATE scans SET finished = ? WHERE root_path = ?;";
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+
+    CachedStatement stmt(&statements, sql);
+    if (!stmt) {
+        errlog("Database::finish_scan: Failed to prepare statement.\n");
+        return;
+    }
+    sqlite3_bind_int64(stmt, 1, static_cast<sqlite3_int64>(time(nullptr)));
+    sqlite3_bind_text16(stmt, 2, root_path.c_str(), -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        errlog("Database::finish_scan: Error updating data.\n");
+    }
+    exec("PRAGMA optimize;");
+}
+
+//-----------------------------------------------------------------------------
+// Database::delete_path_rows
+// ----------------------------------------------------------------------------
+// Deletes the entry for a file, or every entry under a directory, inside the
+// open transaction, and adds what the indexes lose to changes. The tags go
+// first so the postings they held can leave the TagIndex. Called with
+// write_mtx held.
+//-----------------------------------------------------------------------------
+void Database::delete_path_rows (const fs::path &path, IndexChanges *changes) {
+
+    std::wstring exact = path.wstring();
+    std::wstring lower, upper;
+    path_prefix_range(path, &lower, &upper);
+
+    const char *sql = "DELETE FROM audio_files WHERE file_path = ? "\
+        "OR (file_path >= ? AND file_path < ?) "\
+        "RETURNING id;";
+    const char *tags_sql = "DELETE FROM file_tags WHERE file_id IN "\
+        "(SELECT id FROM audio_files WHERE file_path = ? "\
+        "OR (file_path >= ? AND file_path < ?)) "\
+        "RETURNING tag_id, file_id;";
+
+    CachedStatement stmt(&statements, sql);
+    CachedStatement tags_stmt(&statements, tags_sql);
+    if (!stmt || !tags_stmt) {
+        errlog("Database::delete_path_rows: Failed to prepare statement.\n");
+        return;
+    }
+    auto bind_range = [&](sqlite3_stmt *range_stmt) {
+        sqlite3_bind_text16(range_stmt, 1, exact.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text16(range_stmt, 2, lower.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text16(range_stmt, 3, upper.c_str(), -1, SQLITE_STATIC);
+    };
+    bind_range(tags_stmt);
+    bind_range(stmt);
+
+    int result;
+    while ((result = sqlite3_step(tags_stmt)) == SQLITE_ROW) {
+        changes->tags_removed.push_back(
+            {sqlite3_column_int64(tags_stmt, 0), sqlite3_column_int64(tags_stmt, 1)});
+    }
+    if (result != SQLITE_DONE) {
+        errlog("Database::delete_path_rows: Error deleting tags.\n");
+    }
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        changes->files_removed.push_back(sqlite3_column_int64(stmt, 0));
+    }
+    if (result != SQLITE_DONE) {
+        errlog("Database::delete_path_rows: Error deleting data.\n");
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Database::remove_path
+// ----------------------------------------------------------------------------
+// Removes the entry for a file, or every entry under a directory.
+//-----------------------------------------------------------------------------
+void Database::remove_path (const fs::path &path) {
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+
+    IndexChanges changes;
+    exec("BEGIN TRANSACTION;");
+    changes.generation = bump_generation(INDEX_GENERATION);
+    delete_path_rows(path, &changes);
+    if (!changes.files_removed.empty()) {
+        bump_generation(SIMILAR_GENERATION);
+    }
+    exec("COMMIT;");
+
+    if (similar_index.is_loaded()) {
+        for (int64_t file_id : changes.files_removed) {
+            similar_index.remove(file_id);
+        }
+    }
+    apply_index_changes(&changes);
+    vacuum_if_needed();
+}
+
+//-----------------------------------------------------------------------------
+// Database::rename_path
+// ----------------------------------------------------------------------------
+// Moves the entry for a file, or every entry under a directory, from
+// old_path to new_path. Rows keep their ids, so user tags, user bpm and key,
+// analysis results and embeddings all follow the file. Entries that were
+// already at new_path were replaced by the move and are deleted first.
+// A renamed file's new name reaches the TrigramIndex as a removal of the old
+// name and an addition of the new one.
+//-----------------------------------------------------------------------------
+void Database::rename_path (const fs::path &old_path, const fs::path &new_path) {
+
+    const char *select_sql = "SELECT id, file_path FROM audio_files WHERE file_path = ? "\
+        "OR (file_path >= ? AND file_path < ?);";
+    const char *update_sql = "UPDATE audio_files SET file_path = ?, file_name = ? "\
+        "WHERE id = ?;";
+
+    std::wstring exact = old_path.wstring();
+    std::wstring lower, upper;
+    path_prefix_range(old_path, &lower, &upper);
+
+    std::string old_prefix, new_prefix;
+    path_to_utf8(old_path, &old_prefix);
+    path_to_utf8(new_path, &new_prefix);
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+
+    CachedStatement select_stmt(&statements, select_sql);
+    CachedStatement update_stmt(&statements, update_sql);
+    if (!select_stmt || !update_stmt) {
+        errlog("Database::rename_path: Failed to prepare statement.\n");
+        return;
+    }
+
+    IndexChanges changes;
+    exec("BEGIN TRANSACTION;");
+    changes.generation = bump_generation(INDEX_GENERATION);
+    delete_path_rows(new_path, &changes);
+    std::vector<int64_t> replaced = changes.files_removed;
+
+    // the rows are read before any is updated, as updates move them within
+    // the range being read
+    std::vector<std::pair<int64_t, std::string>> moved;
+    sqlite3_bind_text16(select_stmt, 1, exact.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text16(select_stmt, 2, lower.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text16(select_stmt, 3, upper.c_str(), -1, SQLITE_STATIC);
+    while (sqlite3_step(select_stmt) == SQLITE_ROW) {
+        moved.emplace_back(sqlite3_column_int64(select_stmt, 0), std::string(
+            reinterpret_cast<const char *>(sqlite3_column_text(select_stmt, 1)),
+            sqlite3_column_bytes(select_stmt, 1)));
+    }
+    sqlite3_reset(select_stmt);
+
+    for (auto &[file_id, file_path] : moved) {
+        file_path.replace(0, old_prefix.size(), new_prefix);
+        size_t separator = file_path.find_last_of(static_cast<char>(fs::path::preferred_separator));
+        std::string_view file_name = std::string_view(file_path).substr(
+            separator == std::string::npos ? 0 : separator + 1);
+
+        sqlite3_bind_text(update_stmt, 1, file_path.data(), 
+            static_cast<int>(file_path.size()), SQLITE_STATIC);
+        sqlite3_bind_text(update_stmt, 2, file_name.data(), 
+            static_cast<int>(file_name.size()), SQLITE_STATIC);
+        sqlite3_bind_int64(update_stmt, 3, file_id);
+        if (sqlite3_step(update_stmt) != SQLITE_DONE) {
+            errlog("Database::rename_path: Error updating data.\n");
+        }
+        sqlite3_reset(update_stmt);
+
+        changes.files_removed.push_back(file_id);
+        changes.names_added.emplace_back(file_id, std::string(file_name));
+    }
+    if (!replaced.empty()) {
+        bump_generation(SIMILAR_GENERATION);
+    }
+    exec("COMMIT;");
+
+    if (similar_index.is_loaded()) {
+        for (int64_t file_id : replaced) {
+            similar_index.remove(file_id);
+        }
+    }
+    apply_index_changes(&changes);
+}
+
+//-----------------------------------------------------------------------------
+// Database::remove_files
+// ----------------------------------------------------------------------------
+// Deletes the rows of files that no longer exist, as found by a scan,
+// REMOVE_BATCH_FILES per transaction. Their tags are deleted first so their
+// postings leave the TagIndex, their names leave the TrigramIndex and their
+// embeddings the similarity graph. write_mtx is released between batches so
+// other writers are not held up by a large removal. Once done, the freed
+// pages are returned to the file system if there are enough of them.
+// Returns the number of rows deleted.
+//-----------------------------------------------------------------------------
+int Database::remove_files (const std::vector<std::wstring> &file_paths) {
+
+    const char *sql = "DELETE FROM audio_files WHERE file_path = ? RETURNING id;";
+    const char *tags_sql = "DELETE FROM file_tags WHERE file_id = "\
+        "(SELECT id FROM audio_files WHERE file_path = ?) "\
+        "RETURNING tag_id, file_id;";
+
+    int num_removed = 0;
+    for (size_t first = 0; first < file_paths.size(); first += REMOVE_BATCH_FILES) {
+        size_t last = (std::min)(first + REMOVE_BATCH_FILES, file_paths.size());
+
+        std::lock_guard<std::mutex> lock(write_mtx);
+
+        CachedStatement stmt(&statements, sql);
+        CachedStatement tags_stmt(&statements, tags_sql);
+        if (!stmt || !tags_stmt) {
+            errlog("Database::remove_files: Failed to prepare statement.\n");
+            return num_removed;
+        }
+
+        IndexChanges changes;
+        exec("BEGIN TRANSACTION;");
+        changes.generation = bump_generation(INDEX_GENERATION);
+        for (size_t i = first; i < last; i++) {
+            int result;
+            sqlite3_bind_text16(tags_stmt, 1, file_paths[i].c_str(), -1, SQLITE_STATIC);
+            while ((result = sqlite3_step(tags_stmt)) == SQLITE_ROW) {
+                changes.tags_removed.push_back(
+                    {sqlite3_column_int64(tags_stmt, 0), sqlite3_column_int64(tags_stmt, 1)});
+            }
+            if (result != SQLITE_DONE) {
+                errlog("Database::remove_files: Error deleting tags.\n");
+            }
+            sqlite3_reset(tags_stmt);
+
+            sqlite3_bind_text16(stmt, 1, file_paths[i].c_str(), -1, SQLITE_STATIC);
+            while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+                changes.files_removed.push_back(sqlite3_column_int64(stmt, 0));
+            }
+            if (result != SQLITE_DONE) {
+                errlog("Database::remove_files: Error deleting data.\n");
+            }
+            sqlite3_reset(stmt);
+        }
+        if (!changes.files_removed.empty()) {
+            bump_generation(SIMILAR_GENERATION);
+        }
+        exec("COMMIT;");
+
+        if (similar_index.is_loaded()) {
+            for (int64_t file_id : changes.files_removed) {
+                similar_index.remove(file_id);
+            }
+        }
+        num_removed += static_cast<int>(changes.files_removed.size());
+        apply_index_changes(&changes);
+    }
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+    vacuum_if_needed();
+    return num_removed;
+}
+
+//-----------------------------------------------------------------------------
+// Database::vacuum_if_needed
+// ----------------------------------------------------------------------------
+// Returns the free pages left by deleted rows to the file system once there
+// are more than VACUUM_FREE_PAGES of them, then checkpoints the WAL without
+// waiting for readers and releases the writer's cached pages, so neither
+// the file nor the cache keeps the space of rows that are gone. Called with
+// write_mtx held, after removals, so it never runs on the UI thread.
+//
+// Pages are only freed incrementally with auto_vacuum = INCREMENTAL, which
+// is fixed when the file is created. A database made without it is converted
+// here the first time it has pages to free, by a VACUUM that rewrites the
+// whole file and frees them in the process.
+//-----------------------------------------------------------------------------
+void Database::vacuum_if_needed (void) {
+
+    CachedStatement free_stmt(&statements, "PRAGMA freelist_count;");
+    if (!free_stmt || sqlite3_step(free_stmt) != SQLITE_ROW ||
+        sqlite3_column_int64(free_stmt, 0) <= VACUUM_FREE_PAGES) {
+        return;
+    }
+    sqlite3_reset(free_stmt);
+
+    // VACUUM fails while any statement of the connection is still stepping
+    if (!incremental_vacuum) {
+        CachedStatement mode_stmt(&statements, "PRAGMA auto_vacuum;");
+        incremental_vacuum = mode_stmt && sqlite3_step(mode_stmt) == SQLITE_ROW &&
+            sqlite3_column_int(mode_stmt, 0) == 2;
+        sqlite3_reset(mode_stmt);
+    }
+    if (!incremental_vacuum) {
+        errlog("Database::vacuum_if_needed: Converting to incremental vacuum.\n");
+        if (!exec("PRAGMA auto_vacuum = INCREMENTAL;") || !exec("VACUUM;")) {
+            return;
+        }
+        incremental_vacuum = true;
+        errlog("Database::vacuum_if_needed: Conversion done.\n");
+    }
+
+    CachedStatement stmt(&statements, "PRAGMA incremental_vacuum;");
+    if (!stmt) {
+        errlog("Database::vacuum_if_needed: Failed to prepare statement.\n");
+        return;
+    }
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+    }
+    if (result != SQLITE_DONE) {
+        errlog("Database::vacuum_if_needed: Error vacuuming.\n");
+        return;
+    }
+
+    sqlite3_wal_checkpoint_v2(this->db, nullptr, SQLITE_CHECKPOINT_PASSIVE, nullptr, nullptr);
+    sqlite3_db_release_memory(this->db);
+}
+
+//-----------------------------------------------------------------------------
+// insert_sql
+// ----------------------------------------------------------------------------
+// Builds the upsert shared by insert_file and insert_files for num_rows
+// files, each bound with bind_file_record. A file that is already indexed
+// has its size, modification time and auto tags refreshed; it is queued for
+// analysis again only if its size or modification time changed, and user
+// supplied columns are left untouched. A file whose row already holds the
+// same values is not written at all. The id and path of every file inserted
+// or changed are returned (see step_insert).
+//-----------------------------------------------------------------------------
+static std::string insert_sql (int num_rows) {
+    std::string sql = "INSERT INTO audio_files ("\
+        "file_path,"\
+        "file_name,"\
+        "file_size,"\
+        "file_mtime,"\
+        "num_user_tags,"\
+        "user_tags,"\
+        "num_auto_tags,"\
+        "auto_tags,"\
+        "user_bpm,"\
+        "user_key,"\
+        "auto_bpm,"\
+        "auto_key"\
+        ") VALUES ";
+    for (int i = 0; i < num_rows; i++) {
+        sql += i ? ", (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)" : "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+    }
+    sql += " ON CONFLICT(file_path) DO UPDATE SET "\
+        "file_size = excluded.file_size,"\
+        "file_mtime = excluded.file_mtime,"\
+        "num_auto_tags = excluded.num_auto_tags,"\
+        "auto_tags = excluded.auto_tags,"\
+        "analysis_state = CASE WHEN file_size IS NOT excluded.file_size "\
+        "OR file_mtime IS NOT excluded.file_mtime THEN 0 ELSE analysis_state END "\
+        "WHERE file_size IS NOT excluded.file_size "\
+        "OR file_mtime IS NOT excluded.file_mtime "\
+        "OR num_auto_tags IS NOT excluded.num_auto_tags "\
+        "OR auto_tags IS NOT excluded.auto_tags "\
+        "RETURNING id, file_path;";
+    return sql;
+}
+
+//-----------------------------------------------------------------------------
+// bind_file_record
+// ----------------------------------------------------------------------------
+// Binds the members of a FileRecord to the INSERT_COLUMNS arguments of
+// insert_sql starting at first. The record's UTF-8 text is bound as is,
+// without a terminator or a copy.
+//-----------------------------------------------------------------------------
+static void bind_file_record (sqlite3_stmt *stmt, struct FileRecord *file, int first = 1) {
+    std::string_view file_name = file->file_name();
+    sqlite3_bind_text(stmt, first + 0, file->file_path.data(), static_cast<int>(file->file_path.size()), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, first + 1, file_name.data(), static_cast<int>(file_name.size()), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, first + 2, static_cast<sqlite3_int64>(file->file_size));
+    sqlite3_bind_int64(stmt, first + 3, file->file_mtime);
+    sqlite3_bind_int(stmt, first + 4, file->num_user_tags);
+    sqlite3_bind_text(stmt, first + 5, file->user_tags.data(), static_cast<int>(file->user_tags.size()), SQLITE_STATIC);
+    sqlite3_bind_int(stmt, first + 6, file->num_auto_tags);
+    sqlite3_bind_text(stmt, first + 7, file->auto_tags.data(), static_cast<int>(file->auto_tags.size()), SQLITE_STATIC);
+    sqlite3_bind_int(stmt, first + 8, file->user_bpm);
+    sqlite3_bind_int(stmt, first + 9, file->user_key);
+    sqlite3_bind_int(stmt, first + 10, file->auto_bpm);
+    sqlite3_bind_int(stmt, first + 11, file->auto_key);
+}
+
+//-----------------------------------------------------------------------------
+// step_insert
+// ----------------------------------------------------------------------------
+// Runs an insert_sql statement bound with files and adds the id of every file
+// it inserted or changed, paired with its record, to changed. Rows come back
+// in the order they were bound in practice, so each returned path is first
+// compared with the record after the last match. The statement is reset.
+// Returns false if the statement failed.
+//-----------------------------------------------------------------------------
+static bool step_insert (sqlite3_stmt *stmt, struct FileRecord *const *files, 
+    size_t num_files, std::vector<std::pair<int64_t, struct FileRecord *>> *changed) {
+
+    size_t next = 0;
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char *text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+        std::string_view path(text ? text : "", sqlite3_column_bytes(stmt, 1));
+        for (size_t n = 0; n < num_files; n++) {
+            size_t i = (next + n) % num_files;
+            if (files[i]->file_path == path) {
+                changed->emplace_back(sqlite3_column_int64(stmt, 0), files[i]);
+                next = i + 1;
+                break;
+            }
+        }
+    }
+    sqlite3_reset(stmt);
+    return result == SQLITE_DONE;
+}
+
+//-----------------------------------------------------------------------------
+// Database::insert_file
+// ----------------------------------------------------------------------------
+// This function works inserts a single file into the database
+//-----------------------------------------------------------------------------
+void Database::insert_file (struct FileRecord *file) {
+    static const std::string sql = insert_sql(1);
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+
+    CachedStatement stmt(&statements, sql);
+    if (!stmt) {
+        errlog("Database::insert_file: Error preparing statement.\n");
+        return;
+    }
+
+    // bind the FileRecord data to the INSERT statement arguments
+    bind_file_record(stmt, file);
+    
+    std::vector<std::pair<int64_t, struct FileRecord *>> changed;
+    IndexChanges changes;
+    exec("BEGIN TRANSACTION;");
+    if (!step_insert(stmt, &file, 1, &changed)) {
+        errlog("Database::insert_file: Error inserting data.\n");
+        rollback(&changes);
+        return;
+    }
+
+    changes.generation = bump_generation(INDEX_GENERATION);
+    for (const auto &row : changed) {
+        store_file_tags(row.first, file->auto_tags, file->user_tags, &changes);
+        changes.names_added.emplace_back(row.first, std::string(file->file_name()));
+    }
+    exec("COMMIT;");
+    apply_index_changes(&changes);
+}
+
+//-----------------------------------------------------------------------------
+// store_ticket
+// ----------------------------------------------------------------------------
+// Stores the state of a directory whose files are all inserted, and frees its
+// ticket. Its subdirectories are journalled with an mtime of 0 unless they
+// already have a state, so a resumed scan still reaches them through this
+// directory without listing it, and lists them itself. Abandoned tickets are
+// only freed.
+//-----------------------------------------------------------------------------
+static void store_ticket (sqlite3_stmt *dir_stmt, sqlite3_stmt *subdir_stmt,
+    DirectoryTicket *ticket) {
+
+    if (ticket->abandoned.load(std::memory_order_relaxed)) {
+        delete ticket;
+        return;
+    }
+
+    const DirectoryState &state = ticket->state;
+    sqlite3_bind_text16(dir_stmt, 1, state.dir_path.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text16(dir_stmt, 2, state.parent_path.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(dir_stmt, 3, state.mtime);
+    sqlite3_bind_int64(dir_stmt, 4, state.num_entries);
+    if (sqlite3_step(dir_stmt) != SQLITE_DONE) {
+        errlog("store_ticket: Error inserting directory.\n");
+    }
+    sqlite3_reset(dir_stmt);
+
+    for (const auto &subdir : ticket->subdirs) {
+        sqlite3_bind_text16(subdir_stmt, 1, subdir.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text16(subdir_stmt, 2, state.dir_path.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(subdir_stmt) != SQLITE_DONE) {
+            errlog("store_ticket: Error inserting subdirectory.\n");
+        }
+        sqlite3_reset(subdir_stmt);
+    }
+
+    delete ticket;
+}
+
+//-----------------------------------------------------------------------------
+// Database::insert_files
+// ----------------------------------------------------------------------------
+// db_insert_files inserts entries in the audio_files database table data to 
+// insert comes from a vector of FileRecord structs
+// Directories completed by this batch, or waiting in completed_dirs, are
+// journalled in the same transaction, so a directory is only ever recorded
+// as done together with its files.
+// Files are written INSERT_BATCH_ROWS at a time by one multi-row upsert,
+// which runs the statement once per batch instead of once per file.
+// Tags are stored in the same transaction, and tags and names reach the
+// in-memory indexes once it commits. Inserted records are handed back to pool once the transaction is
+// done, or deleted if there is no pool.
+// Returns the number of files taken from the queue.
+//-----------------------------------------------------------------------------
+int Database::insert_files (ThreadSafeQueue<struct FileRecord *> *files,
+    ThreadSafeQueue<DirectoryTicket *> *completed_dirs,
+    RecordPool *pool
+) {
+    const char *dir_sql = "INSERT OR REPLACE INTO directories "\
+        "(dir_path, parent_path, dir_mtime, num_entries) VALUES (?, ?, ?, ?);";
+    const char *subdir_sql = "INSERT OR IGNORE INTO directories "\
+        "(dir_path, parent_path) VALUES (?, ?);";
+
+    static const std::string sql = insert_sql(1);
+    static const std::string batch_sql = insert_sql(INSERT_BATCH_ROWS);
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+
+    CachedStatement stmt(&statements, sql);
+    CachedStatement batch_stmt(&statements, batch_sql);
+    CachedStatement dir_stmt(&statements, dir_sql);
+    CachedStatement subdir_stmt(&statements, subdir_sql);
+    if (!stmt || !batch_stmt || !dir_stmt || !subdir_stmt) {
+        panicf("db_insert_files: Error preparing statement.\n");
+    } 
+
+    int num_inserted = 0;
+    std::vector<struct FileRecord *> inserted;
+    std::vector<struct FileRecord *> batch;
+    std::vector<std::pair<int64_t, struct FileRecord *>> changed;
+    IndexChanges changes;
+
+    // writes the batched files with one multi-row statement, or one at a
+    // time if the batch is not full, then stores the tags and names of the
+    // files that changed and journals the directories they completed
+    auto flush_batch = [&]() {
+        changed.clear();
+        bool batched = false;
+        if (batch.size() == INSERT_BATCH_ROWS) {
+            for (size_t i = 0; i < batch.size(); i++) {
+                bind_file_record(batch_stmt, batch[i], static_cast<int>(i) * INSERT_COLUMNS + 1);
+            }
+            batched = step_insert(batch_stmt, batch.data(), batch.size(), &changed);
+        }
+
+        // a failed statement leaves no rows behind, so a batch that failed
+        // (such as one naming a path twice, which an upsert cannot update
+        // twice) is retried a file at a time. The directory of a file that
+        // still fails is abandoned, so it is never journalled as complete
+        // and the next scan lists it again.
+        if (!batched) {
+            changed.clear();
+            for (struct FileRecord *file : batch) {
+                bind_file_record(stmt, file);
+                if (!step_insert(stmt, &file, 1, &changed)) {
+                    errlog("Database::insert_files: Error inserting data.\n");
+                    if (file->ticket) {
+                        file->ticket->abandoned.store(true, std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+
+        for (const auto &row : changed) {
+            struct FileRecord *file = row.second;
+            store_file_tags(row.first, file->auto_tags, file->user_tags, &changes);
+            changes.names_added.emplace_back(row.first, std::string(file->file_name()));
+        }
+
+        for (struct FileRecord *file : batch) {
+            if (file->ticket && release_ticket(file->ticket)) {
+                store_ticket(dir_stmt, subdir_stmt, file->ticket);
+            }
+            inserted.push_back(file);
+        }
+        batch.clear();
+    };
+
+    // insert files in a single transaction
+    exec("BEGIN TRANSACTION;");
+    changes.generation = bump_generation(INDEX_GENERATION);
+    while (!files->empty()) {
+        
+        struct FileRecord* file;
+        files->wait_pop(file);
+        batch.push_back(file);
+        ++num_inserted;
+
+        if (batch.size() == INSERT_BATCH_ROWS) {
+            flush_batch();
+        }
+    }
+    flush_batch();
+
+    // directories whose last reference was dropped outside this stage
+    DirectoryTicket *ticket;
+    while (completed_dirs && completed_dirs->try_pop(ticket)) {
+        store_ticket(dir_stmt, subdir_stmt, ticket);
+    }
+
+    exec("COMMIT;");
+    apply_index_changes(&changes);
+
+    if (pool) {
+        pool->release(&inserted);
+    }
+    else {
+        for (struct FileRecord *file : inserted) {
+            delete file;
+        }
+    }
+    return num_inserted;
+}
+
+//-----------------------------------------------------------------------------
+// Database::select_pending_analysis
+// ----------------------------------------------------------------------------
+// Fetches up to limit files that still need analysis, in id order starting
+// after after_id. Returns the number of files fetched.
+//-----------------------------------------------------------------------------
+int Database::select_pending_analysis (int64_t after_id, int limit,
+    std::vector<struct AnalysisRecord> *pending) {
+
+    const char *sql = "SELECT id, file_path, file_size, file_mtime FROM audio_files "\
+        "WHERE analysis_state = 0 AND id > ? ORDER BY id LIMIT ?;";
+
+    PooledConnection reader(&readers);
+    if (!reader) {
+        errlog("Database::select_pending_analysis: No reader connection.\n");
+        return 0;
+    }
+
+    CachedStatement stmt(&reader->statements, sql);
+    if (!stmt) {
+        errlog("Database::select_pending_analysis: Failed to prepare statement.\n");
+        return 0;
+    }
+    sqlite3_bind_int64(stmt, 1, after_id);
+    sqlite3_bind_int(stmt, 2, limit);
+
+    int num_selected = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        struct AnalysisRecord record = {};
+        record.id = sqlite3_column_int64(stmt, 0);
+        record.file_path.assign(
+            reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)),
+            sqlite3_column_bytes(stmt, 1)
+        );
+        record.file_size = static_cast<size_t>(sqlite3_column_int64(stmt, 2));
+        record.file_mtime = sqlite3_column_int64(stmt, 3);
+        record.state = ANALYSIS_PENDING;
+        pending->push_back(std::move(record));
+        ++num_selected;
+    }
+    return num_selected;
+}
+
+//-----------------------------------------------------------------------------
+// Database::update_analysis
+// ----------------------------------------------------------------------------
+// Writes a batch of analysis results in a single transaction, then updates
+// the similarity graph with their embeddings if it is loaded. A file that
+// yielded no embedding leaves the graph. A result is only stored if its file
+// is still pending with the size and mtime it was fetched with; a file that
+// a rescan found changed meanwhile keeps its reset state and is analyzed
+// again.
+//-----------------------------------------------------------------------------
+void Database::update_analysis (const std::vector<struct AnalysisRecord> &results) {
+
+    const char *sql = "UPDATE audio_files SET "\
+        "duration_ms = ?,"\
+        "auto_bpm = ?,"\
+        "auto_key = ?,"\
+        "analysis_state = ?,"\
+        "embedding = ? "\
+        "WHERE id = ? AND analysis_state = 0 AND file_size = ? AND file_mtime = ?;";
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+
+    CachedStatement stmt(&statements, sql);
+    if (!stmt) {
+        errlog("Database::update_analysis: Failed to prepare statement.\n");
+        return;
+    }
+
+    std::vector<bool> stored;
+    stored.reserve(results.size());
+
+    exec("BEGIN TRANSACTION;");
+    bump_generation(SIMILAR_GENERATION);
+    for (const struct AnalysisRecord &result : results) {
+        sqlite3_bind_int(stmt, 1, result.duration_ms);
+        sqlite3_bind_int(stmt, 2, result.auto_bpm);
+        sqlite3_bind_int(stmt, 3, result.auto_key);
+        sqlite3_bind_int(stmt, 4, result.state);
+        if (result.embedding.size() == EMBEDDING_DIM) {
+            sqlite3_bind_blob(stmt, 5, result.embedding.data(), 
+                EMBEDDING_DIM * sizeof(float), SQLITE_STATIC);
+        }
+        else {
+            sqlite3_bind_null(stmt, 5);
+        }
+        sqlite3_bind_int64(stmt, 6, result.id);
+        sqlite3_bind_int64(stmt, 7, static_cast<int64_t>(result.file_size));
+        sqlite3_bind_int64(stmt, 8, result.file_mtime);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            errlog("Database::update_analysis: Error updating data.\n");
+        }
+        stored.push_back(sqlite3_changes(this->db) > 0);
+        sqlite3_reset(stmt);
+    }
+    exec("COMMIT;");
+
+    if (similar_index.is_loaded()) {
+        for (size_t i = 0; i < results.size(); i++) {
+            const struct AnalysisRecord &result = results[i];
+            if (!stored[i]) {
+                continue;
+            }
+            if (result.embedding.size() == EMBEDDING_DIM) {
+                similar_index.insert(result.id, result.embedding.data());
+            }
+            else {
+                similar_index.remove(result.id);
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Database::begin_query / end_query / queries_active
+// ----------------------------------------------------------------------------
+// Interactive queries announce themselves so background work can yield to
+// them (see Analyzer).
+//-----------------------------------------------------------------------------
+void Database::begin_query (void) {
+    active_queries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Database::end_query (void) {
+    active_queries.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool Database::queries_active (void) {
+    return active_queries.load(std::memory_order_relaxed) > 0;
+}
+
+//-----------------------------------------------------------------------------
+// column_string
+// ----------------------------------------------------------------------------
+// Copies a text column into a string. Text is read as UTF-8, the encoding
+// sqlite stores it in, so nothing is transcoded.
+//-----------------------------------------------------------------------------
+static void column_string (sqlite3_stmt *stmt, int column, std::string *value) {
+    const char *text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, column));
+    if (text) {
+        value->assign(text, sqlite3_column_bytes(stmt, column));
+    }
+    else {
+        value->clear();
+    }
+}
+
+//-----------------------------------------------------------------------------
+// column_file_record
+// ----------------------------------------------------------------------------
+// Reads a FileRecord from a row whose columns are file_path, file_size,
+// num_user_tags, user_tags, num_auto_tags, auto_tags, user_bpm, user_key,
+// auto_bpm, auto_key and file_mtime, in that order.
+//-----------------------------------------------------------------------------
+static void column_file_record (sqlite3_stmt *stmt, struct FileRecord *file) {
+
+    // retrieve file path; the name is its last component
+    column_string(stmt, 0, &file->file_path);
+    size_t separator = file->file_path.find_last_of("\\/");
+    file->name_offset = static_cast<uint32_t>(
+        separator == std::string::npos ? 0 : separator + 1);
+
+    // retrieve file size
+    file->file_size = static_cast<size_t>(sqlite3_column_int64(stmt, 1));
+    
+    // retrieve user tags
+    file->num_user_tags = sqlite3_column_int(stmt, 2);
+    column_string(stmt, 3, &file->user_tags);
+
+    // retrieve automatically generated tags
+    file->num_auto_tags = sqlite3_column_int(stmt, 4);
+    column_string(stmt, 5, &file->auto_tags);
+
+    file->user_bpm = sqlite3_column_int(stmt, 6);
+    file->user_key = sqlite3_column_int(stmt, 7);
+    file->auto_bpm = sqlite3_column_int(stmt, 8);
+    file->auto_key = sqlite3_column_int(stmt, 9);
+    file->file_mtime = sqlite3_column_int64(stmt, 10);
+}
+
+//-----------------------------------------------------------------------------
+// fts_query
+// ----------------------------------------------------------------------------
+// Turns search text into an FTS5 query matching files that have a token
+// starting with each word of the text. Words are split on ASCII punctuation
+// and spaces, as the unicode61 tokenizer does, and quoted so nothing typed is
+// read as query syntax. The length of the longest word goes to longest_word.
+// Returns false if the text has no words.
+//-----------------------------------------------------------------------------
+static bool fts_query (const char *text, std::string *match, size_t *longest_word) {
+
+    // bytes of multi-byte UTF-8 characters always belong to a word
+    auto is_separator = [](char c) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        return byte < 0x80 && !isalnum(byte);
+    };
+
+    match->clear();
+    *longest_word = 0;
+    for (const char *c = text; *c; ) {
+        while (*c && is_separator(*c)) {
+            ++c;
+        }
+        if (!*c) {
+            break;
+        }
+
+        if (!match->empty()) {
+            match->push_back(' ');
+        }
+        match->push_back('"');
+        const char *word = c;
+        while (*c && !is_separator(*c)) {
+            match->push_back(*c++);
+        }
+        match->append("\"*");
+        if (static_cast<size_t>(c - word) > *longest_word) {
+            *longest_word = static_cast<size_t>(c - word);
+        }
+    }
+    return !match->empty();
+}
+
+#define RANKED_KEY_PREFIX "r:"
+
+//-----------------------------------------------------------------------------
+// Database::ranked_matches
+// ----------------------------------------------------------------------------
+// The ids of every file the full-text query match finds, best matches first.
+// Ranking cannot be resumed from a key, since FTS5 scores and sorts every
+// match before returning the first, so the order is read once and kept in
+// query_cache for the pages that follow. If the indexes change in between,
+// the cache is emptied and the next page reads the order again. Returns
+// null if the query failed or was interrupted (see ConnectionPool), so a
+// partial order is never cached.
+//-----------------------------------------------------------------------------
+CandidateSet Database::ranked_matches (const std::string &match) {
+
+    const char *sql = "SELECT rowid FROM audio_files_fts "\
+        "WHERE audio_files_fts MATCH ? ORDER BY rank, rowid;";
+
+    std::string key = RANKED_KEY_PREFIX + match;
+    CandidateSet file_ids = query_cache.find(key);
+    if (file_ids) {
+        return file_ids;
+    }
+    uint64_t epoch = query_cache.epoch();
+
+    std::vector<int64_t> ranked;
+    PooledConnection reader(&readers);
+    if (!reader) {
+        errlog("Database::ranked_matches: No reader connection.\n");
+        return nullptr;
+    }
+    CachedStatement stmt(&reader->statements, sql);
+    if (!stmt) {
+        errlog("Database::ranked_matches: Failed to prepare sql statement.\n");
+        return nullptr;
+    }
+    sqlite3_bind_text(stmt, 1, match.data(), static_cast<int>(match.size()), SQLITE_STATIC);
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        ranked.push_back(sqlite3_column_int64(stmt, 0));
+    }
+    if (result != SQLITE_DONE) {
+        if (result != SQLITE_INTERRUPT) {
+            errlog("Database::ranked_matches: Error reading matches.\n");
+        }
+        return nullptr;
+    }
+
+    file_ids = std::make_shared<const std::vector<int64_t>>(std::move(ranked));
+    query_cache.insert(key, file_ids, epoch);
+    return file_ids;
+}
+
+//-----------------------------------------------------------------------------
+// Database::search_page
+// ----------------------------------------------------------------------------
+// Visits the next page of up to limit files (-1 for all of them) whose name
+// or tags have a token starting with every word of query, and moves cursor
+// past them. Returns the number of files visited, or -1 if a ranked search
+// failed or was interrupted; once a page comes up short the cursor is marked
+// exhausted.
+// Queries with a word of at least SEARCH_RANKED_MIN_LENGTH bytes are ranked,
+// best matches first. Their order is found once (see ranked_matches) and
+// each page reads its files by position in it. Shorter queries match too
+// much of the library to rank, so their files come in id order straight off
+// the index, and a page stops reading as soon as it is full. Without the
+// full-text index it falls back to a substring match on the name, also in
+// id order.
+//-----------------------------------------------------------------------------
+int Database::search_page (const char *query, SearchCursor *cursor, int limit,
+    const RowVisitor &visit) {
+
+    const char *columns = "SELECT "\
+        "a.file_path, "\
+        "a.file_size, "\
+        "a.num_user_tags, "\
+        "a.user_tags, "\
+        "a.num_auto_tags, "\
+        "a.auto_tags, "\
+        "a.user_bpm, "\
+        "a.user_key, "\
+        "a.auto_bpm, "\
+        "a.auto_key, "\
+        "a.file_mtime, "\
+        "a.id ";
+    std::string unranked_sql = std::string(columns) + 
+        "FROM audio_files_fts JOIN audio_files a ON a.id = audio_files_fts.rowid "\
+        "WHERE audio_files_fts MATCH ? AND audio_files_fts.rowid > ? "\
+        "ORDER BY audio_files_fts.rowid LIMIT ?;";
+    std::string like_sql = std::string(columns) + 
+        "FROM audio_files a WHERE a.file_name LIKE ? AND a.id > ? "\
+        "ORDER BY a.id LIMIT ?;";
+
+    if (cursor->exhausted) {
+        return 0;
+    }
+
+    std::string match;
+    bool ranked = false;
+    if (fts_enabled) {
+        size_t longest_word;
+        if (!fts_query(query, &match, &longest_word)) {
+            cursor->exhausted = true;
+            return 0;
+        }
+        ranked = (longest_word >= SEARCH_RANKED_MIN_LENGTH);
+    }
+    else {
+        match = std::string("%") + query + "%";
+    }
+
+    if (ranked) {
+        // background analysis backs off while this runs
+        begin_query();
+        CandidateSet file_ids = ranked_matches(match);
+        if (!file_ids) {
+            end_query();
+            return -1;
+        }
+        size_t first = (std::min)(cursor->position, file_ids->size());
+        size_t last = limit < 0 ? file_ids->size() :
+            (std::min)(first + static_cast<size_t>(limit), file_ids->size());
+
+        std::vector<struct FileRecord> files;
+        select_files(std::vector<int64_t>(file_ids->begin() + first, 
+            file_ids->begin() + last), &files);
+        for (const struct FileRecord &file : files) {
+            visit(file);
+        }
+        cursor->position = last;
+        if (last == file_ids->size()) {
+            cursor->exhausted = true;
+        }
+        end_query();
+        return static_cast<int>(files.size());
+    }
+    
+    PooledConnection reader(&readers);
+    if (!reader) {
+        errlog("Database::search_page: No reader connection.\n");
+        return 0;
+    }
+
+    const std::string &sql = fts_enabled ? unranked_sql : like_sql;
+    CachedStatement stmt(&reader->statements, sql);
+    if (!stmt) {
+        errlog("Database::search_page: Failed to prepare sql statement.\n");
+        return 0;
+    }
+
+    // background analysis backs off while this runs
+    begin_query();
+    
+    int result = sqlite3_bind_text(stmt, 1, match.data(), static_cast<int>(match.size()), SQLITE_STATIC);
+    if (result != SQLITE_OK) {
+        errlog("Database::search_page: Failed to bind sql statement.\n");
+    }
+    sqlite3_bind_int64(stmt, 2, cursor->file_id);
+    sqlite3_bind_int(stmt, 3, limit);
+
+    // one record is refilled for every row, reusing its strings
+    int num_visited = 0;
+    struct FileRecord file;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        column_file_record(stmt, &file);
+        cursor->file_id = sqlite3_column_int64(stmt, 11);
+        visit(file);
+        ++num_visited;
+    }
+    if (limit < 0 || num_visited < limit) {
+        cursor->exhausted = true;
+    }
+    
+    end_query();
+    return num_visited;
+}
+
+//-----------------------------------------------------------------------------
+// Database::search_by_name
+// ----------------------------------------------------------------------------
+// Collects the first page of search_page, up to limit files (-1 for all of
+// them).
+//-----------------------------------------------------------------------------
+void Database::search_by_name (std::vector<struct FileRecord> *search_result, 
+    const char *query, int limit) {
+
+    SearchCursor cursor;
+    search_page(query, &cursor, limit, [search_result](const struct FileRecord &file) {
+        search_result->push_back(file);
+    });
+}
+
+#define TAG_KEY_PREFIX "t:"
+#define TAG_KEY_LIST_SEPARATOR '\x1f'
+#define TAG_KEY_TAG_SEPARATOR '\x1e'
+
+//-----------------------------------------------------------------------------
+// normalize_tags
+// ----------------------------------------------------------------------------
+// Lowercases tags the way they are stored, then sorts them and drops
+// duplicates, so every search names a tag as the tag tables do.
+//-----------------------------------------------------------------------------
+static std::vector<std::string> normalize_tags (const std::vector<std::string> &tags) {
+    std::vector<std::string> lowered(tags);
+    for (std::string &tag : lowered) {
+        for (char &ch : tag) {
+            if (ch >= 'A' && ch <= 'Z') {
+                ch += 'a' - 'A';
+            }
+        }
+    }
+    std::sort(lowered.begin(), lowered.end());
+    lowered.erase(std::unique(lowered.begin(), lowered.end()), lowered.end());
+    return lowered;
+}
+
+//-----------------------------------------------------------------------------
+// tag_query_key / tag_query_refines
+// ----------------------------------------------------------------------------
+// The QueryCache key of a tag search: its sorted tags to include, then its
+// sorted tags to exclude. A cached tag search can be refined into another
+// if the other includes and excludes at least the same tags.
+//-----------------------------------------------------------------------------
+static std::string tag_query_key (const std::vector<std::string> &all_of,
+    const std::vector<std::string> &none_of) {
+
+    std::string key = TAG_KEY_PREFIX;
+    for (size_t i = 0; i < all_of.size(); i++) {
+        key += i ? std::string(1, TAG_KEY_TAG_SEPARATOR) + all_of[i] : all_of[i];
+    }
+    key += TAG_KEY_LIST_SEPARATOR;
+    for (size_t i = 0; i < none_of.size(); i++) {
+        key += i ? std::string(1, TAG_KEY_TAG_SEPARATOR) + none_of[i] : none_of[i];
+    }
+    return key;
+}
+
+static bool tag_query_refines (const std::string &cached, 
+    const std::vector<std::string> &all_of, const std::vector<std::string> &none_of) {
+
+    if (cached.compare(0, strlen(TAG_KEY_PREFIX), TAG_KEY_PREFIX) != 0) {
+        return false;
+    }
+
+    std::vector<std::string> lists[2];
+    size_t list = 0;
+    std::string tag;
+    for (size_t i = strlen(TAG_KEY_PREFIX); i <= cached.size(); i++) {
+        if (i == cached.size() || cached[i] == TAG_KEY_TAG_SEPARATOR || 
+            cached[i] == TAG_KEY_LIST_SEPARATOR) {
+            if (!tag.empty()) {
+                lists[list].push_back(std::move(tag));
+                tag.clear();
+            }
+            if (i < cached.size() && cached[i] == TAG_KEY_LIST_SEPARATOR) {
+                list = 1;
+            }
+            continue;
+        }
+        tag.push_back(cached[i]);
+    }
+
+    return std::includes(all_of.begin(), all_of.end(), lists[0].begin(), lists[0].end()) &&
+           std::includes(none_of.begin(), none_of.end(), lists[1].begin(), lists[1].end());
+}
+
+//-----------------------------------------------------------------------------
+// Database::search_by_tags
+// ----------------------------------------------------------------------------
+// Finds the files carrying every tag in all_of and none in none_of, in id
+// order, up to limit files (-1 for all of them). The ids come from the
+// TagIndex, which is loaded by load_search_indexes or by the first tag
+// search; only the matching rows are read from the database.
+// A search that adds tags to a recent one filters that search's ids instead
+// of matching again (see QueryCache).
+//-----------------------------------------------------------------------------
+void Database::search_by_tags (std::vector<struct FileRecord> *search_result,
+    const std::vector<std::string> &all_of, const std::vector<std::string> &none_of,
+    int limit) {
+
+    if (!tag_index.is_loaded()) {
+        load_search_indexes();
+    }
+
+    // sorted, equal searches share a cache key
+    std::vector<std::string> all_tags = normalize_tags(all_of);
+    std::vector<std::string> none_tags = normalize_tags(none_of);
+    if (all_tags.empty()) {
+        return;
+    }
+
+    std::string key = tag_query_key(all_tags, none_tags);
+    uint64_t epoch = query_cache.epoch();
+    CandidateSet file_ids = query_cache.find(key);
+    if (!file_ids) {
+        CandidateSet refined = query_cache.find_refinable([&](const std::string &cached) {
+            return tag_query_refines(cached, all_tags, none_tags);
+        });
+        file_ids = std::make_shared<const std::vector<int64_t>>(refined ?
+            tag_index.filter(*refined, all_tags, none_tags) :
+            tag_index.match(all_tags, none_tags));
+        query_cache.insert(key, file_ids, epoch);
+    }
+
+    size_t num_ids = file_ids->size();
+    if (limit >= 0 && static_cast<size_t>(limit) < num_ids) {
+        num_ids = static_cast<size_t>(limit);
+    }
+    select_files(std::vector<int64_t>(file_ids->begin(), file_ids->begin() + num_ids), 
+        search_result);
+}
+
+#define SUBSTRING_KEY_PREFIX "s:"
+
+//-----------------------------------------------------------------------------
+// Database::search_by_substring
+// ----------------------------------------------------------------------------
+// Finds up to limit files (-1 for all of them) whose name contains query
+// anywhere, ignoring ASCII case, in id order. Candidates come from the
+// TrigramIndex, which is loaded by load_search_indexes or by the first
+// substring search, and only the matching rows are read.
+// Every match of a query of three bytes or more is kept in the QueryCache,
+// so a longer query containing it, as typing makes, only checks the names
+// of those matches. Shorter queries only scan part of the names (see
+// TrigramIndex::match) and are not cached.
+//-----------------------------------------------------------------------------
+void Database::search_by_substring (std::vector<struct FileRecord> *search_result,
+    const char *query, int limit) {
+
+    if (!name_index.is_loaded()) {
+        load_search_indexes();
+    }
+
+    size_t max_results = limit < 0 ? SIZE_MAX : static_cast<size_t>(limit);
+
+    std::string folded;
+    TrigramIndex::fold(query, &folded);
+    if (folded.size() < 3) {
+        select_files(name_index.match(query, max_results), search_result);
+        return;
+    }
+
+    std::string key = SUBSTRING_KEY_PREFIX + folded;
+    uint64_t epoch = query_cache.epoch();
+    CandidateSet file_ids = query_cache.find(key);
+    if (!file_ids) {
+        size_t prefix_size = strlen(SUBSTRING_KEY_PREFIX);
+        CandidateSet refined = query_cache.find_refinable([&](const std::string &cached) {
+            return cached.compare(0, prefix_size, SUBSTRING_KEY_PREFIX) == 0 &&
+                   folded.find(std::string_view(cached).substr(prefix_size)) != std::string::npos;
+        });
+        file_ids = std::make_shared<const std::vector<int64_t>>(refined ?
+            name_index.filter(*refined, folded) : name_index.match(folded, SIZE_MAX));
+        query_cache.insert(key, file_ids, epoch);
+    }
+
+    size_t num_ids = (std::min)(file_ids->size(), max_results);
+    select_files(std::vector<int64_t>(file_ids->begin(), file_ids->begin() + num_ids), 
+        search_result);
+}
+
+//-----------------------------------------------------------------------------
+// Database::search_fuzzy
+// ----------------------------------------------------------------------------
+// Finds up to limit files (-1 for all of them) with a tag resembling every
+// word of query, so misspelt words like "snre" still find "snare". Closest
+// matches come first (see TagIndex::match_fuzzy). Words are split on ASCII
+// punctuation and spaces and lowercased, like tags.
+//-----------------------------------------------------------------------------
+void Database::search_fuzzy (std::vector<struct FileRecord> *search_result,
+    const char *query, int limit) {
+
+    std::vector<std::string> words;
+    std::string word;
+    for (const char *c = query; ; c++) {
+        unsigned char byte = static_cast<unsigned char>(*c);
+        if (byte != 0 && (byte >= 0x80 || isalnum(byte))) {
+            word.push_back(static_cast<char>(tolower(byte)));
+            continue;
+        }
+        if (!word.empty()) {
+            words.push_back(std::move(word));
+            word.clear();
+        }
+        if (byte == 0) {
+            break;
+        }
+    }
+    if (words.empty()) {
+        return;
+    }
+
+    if (!tag_index.is_loaded()) {
+        load_search_indexes();
+    }
+
+    size_t max_results = limit < 0 ? SIZE_MAX : static_cast<size_t>(limit);
+    select_files(tag_index.match_fuzzy(words, max_results), search_result);
+}
+
+//-----------------------------------------------------------------------------
+// Database::query_files
+// ----------------------------------------------------------------------------
+// Visits the next page of up to limit files (-1 for all of them) passing
+// every filter of query, in id order, and moves cursor past them. Returns
+// the number of files visited; a short page marks the cursor exhausted.
+// Each filter becomes a predicate one index can answer:
+//   text        the full-text index, or a name match without it
+//   tags        the file_tags primary key, one posting list per tag
+//   bpm, key    the expression indexes over BPM_EXPR and KEY_EXPR
+//   duration    audio_files_duration
+//   size        audio_files_size
+// The planner drives the query from the most selective of them, using the
+// statistics refreshed after each scan, and checks the rest per row.
+//-----------------------------------------------------------------------------
+int Database::query_files (const FileQuery &query, SearchCursor *cursor, int limit,
+    const RowVisitor &visit) {
+
+    if (cursor->exhausted) {
+        return 0;
+    }
+
+    // values to bind, in the order their placeholders are written
+    struct Param {
+        const std::string *text;
+        int64_t value;
+    };
+    std::vector<Param> params;
+    auto bind_value = [&params](int64_t value) {
+        params.push_back({nullptr, value});
+    };
+    auto bind_text = [&params](const std::string &text) {
+        params.push_back({&text, 0});
+    };
+
+    std::string sql = "SELECT "\
+        "a.file_path, "\
+        "a.file_size, "\
+        "a.num_user_tags, "\
+        "a.user_tags, "\
+        "a.num_auto_tags, "\
+        "a.auto_tags, "\
+        "a.user_bpm, "\
+        "a.user_key, "\
+        "a.auto_bpm, "\
+        "a.auto_key, "\
+        "a.file_mtime, "\
+        "a.id "\
+        "FROM audio_files a ";
+    std::string where = "WHERE a.id > ?";
+    bind_value(cursor->file_id);
+
+    std::string match;
+    if (!query.words.empty()) {
+        size_t longest_word;
+        if (!fts_enabled) {
+            match = "%" + query.words + "%";
+            where += " AND a.file_name LIKE ?";
+            bind_text(match);
+        }
+        else if (fts_query(query.words.c_str(), &match, &longest_word)) {
+            sql += "JOIN audio_files_fts ON audio_files_fts.rowid = a.id ";
+            where += " AND audio_files_fts MATCH ?";
+            bind_text(match);
+        }
+    }
+
+    std::vector<std::string> all_tags = normalize_tags(query.all_of);
+    std::vector<std::string> none_tags = normalize_tags(query.none_of);
+    for (const std::string &tag : all_tags) {
+        where += " AND a.id IN (SELECT file_id FROM file_tags "\
+            "WHERE tag_id = (SELECT id FROM tags WHERE name = ?))";
+        bind_text(tag);
+    }
+    for (const std::string &tag : none_tags) {
+        where += " AND a.id NOT IN (SELECT file_id FROM file_tags "\
+            "WHERE tag_id = (SELECT id FROM tags WHERE name = ?))";
+        bind_text(tag);
+    }
+
+    auto add_range = [&](const char *column, const QueryRange &range) {
+        if (range.active) {
+            where += std::string(" AND ") + column + " BETWEEN ? AND ?";
+            bind_value(range.min);
+            bind_value(range.max);
+        }
+    };
+    add_range(BPM_EXPR, query.bpm_range);
+    add_range("a.duration_ms", query.duration_range);
+    add_range("a.file_size", query.size_range);
+
+    if (!query.keys.empty()) {
+        where += " AND " KEY_EXPR " IN (";
+        for (size_t i = 0; i < query.keys.size(); i++) {
+            where += i ? ", ?" : "?";
+            bind_value(query.keys[i]);
+        }
+        where += ")";
+    }
+
+    sql += where + " ORDER BY a.id LIMIT ?;";
+    bind_value(limit);
+
+    PooledConnection reader(&readers);
+    if (!reader) {
+        errlog("Database::query_files: No reader connection.\n");
+        return 0;
+    }
+
+    CachedStatement stmt(&reader->statements, sql);
+    if (!stmt) {
+        errlog("Database::query_files: Failed to prepare sql statement.\n");
+        return 0;
+    }
+
+    // background analysis backs off while this runs
+    begin_query();
+
+    for (size_t i = 0; i < params.size(); i++) {
+        int index = static_cast<int>(i) + 1;
+        if (params[i].text) {
+            sqlite3_bind_text(stmt, index, params[i].text->data(), 
+                static_cast<int>(params[i].text->size()), SQLITE_STATIC);
+        }
+        else {
+            sqlite3_bind_int64(stmt, index, params[i].value);
+        }
+    }
+
+    // one record is refilled for every row, reusing its strings
+    int num_visited = 0;
+    struct FileRecord file;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        column_file_record(stmt, &file);
+        cursor->file_id = sqlite3_column_int64(stmt, 11);
+        visit(file);
+        ++num_visited;
+    }
+    if (limit < 0 || num_visited < limit) {
+        cursor->exhausted = true;
+    }
+
+    end_query();
+    return num_visited;
+}
+
+//-----------------------------------------------------------------------------
+// Database::search_similar
+// ----------------------------------------------------------------------------
+// Finds up to limit analyzed files whose timbre is closest to that of the
+// file at file_path, nearest first. Neighbours come from the ANNIndex, which
+// is loaded by load_similar_index or by the first similarity search, so only
+// the file itself and the matching rows are read. Finds nothing if the file
+// has not been analyzed yet.
+//-----------------------------------------------------------------------------
+void Database::search_similar (std::vector<struct FileRecord> *search_result,
+    const std::string &file_path, int limit) {
+
+    if (!similar_index.is_loaded()) {
+        load_similar_index();
+    }
+
+    int64_t file_id = 0;
+    std::vector<float> embedding;
+    {
+        PooledConnection reader(&readers);
+        if (!reader) {
+            errlog("Database::search_similar: No reader connection.\n");
+            return;
+        }
+
+        CachedStatement stmt(&reader->statements, "SELECT id, embedding "\
+            "FROM audio_files WHERE file_path = ?;");
+        if (!stmt) {
+            errlog("Database::search_similar: Failed to prepare statement.\n");
+            return;
+        }
+        sqlite3_bind_text(stmt, 1, file_path.c_str(), 
+            static_cast<int>(file_path.size()), SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW &&
+            static_cast<size_t>(sqlite3_column_bytes(stmt, 1)) == EMBEDDING_DIM * sizeof(float)) {
+            const float *blob = static_cast<const float *>(sqlite3_column_blob(stmt, 1));
+            file_id = sqlite3_column_int64(stmt, 0);
+            embedding.assign(blob, blob + EMBEDDING_DIM);
+        }
+    }
+    if (embedding.empty() || limit == 0) {
+        return;
+    }
+
+    size_t k = limit < 0 ? similar_index.size() : static_cast<size_t>(limit);
+    select_files(similar_index.search(embedding.data(), k, file_id), search_result);
+}
+
+//-----------------------------------------------------------------------------
+// Database::select_files
+// ----------------------------------------------------------------------------
+// Reads the files with the given ids, in the order given, for the searches
+// answered by an in-memory index. Ids of files that no longer exist are
+// skipped.
+//-----------------------------------------------------------------------------
+void Database::select_files (const std::vector<int64_t> &file_ids,
+    std::vector<struct FileRecord> *search_result) {
+
+    const char *sql = "SELECT "\
+        "file_path, "\
+        "file_size, "\
+        "num_user_tags, "\
+        "user_tags, "\
+        "num_auto_tags, "\
+        "auto_tags, "\
+        "user_bpm, "\
+        "user_key, "\
+        "auto_bpm, "\
+        "auto_key, "\
+        "file_mtime "\
+        "FROM audio_files WHERE id = ?;";
+
+    if (file_ids.empty()) {
+        return;
+    }
+
+    PooledConnection reader(&readers);
+    if (!reader) {
+        errlog("Database::select_files: No reader connection.\n");
+        return;
+    }
+
+    CachedStatement stmt(&reader->statements, sql);
+    if (!stmt) {
+        errlog("Database::select_files: Failed to prepare sql statement.\n");
+        return;
+    }
+
+    // background analysis backs off while this runs
+    begin_query();
+
+    for (int64_t file_id : file_ids) {
+        sqlite3_bind_int64(stmt, 1, file_id);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            struct FileRecord file;
+            column_file_record(stmt, &file);
+            search_result->push_back(std::move(file));
+        }
+        sqlite3_reset(stmt);
+    }
+
+    end_query();
+}
+//-----------------------------------------------------------------------------
+// Database::export_library
+// ----------------------------------------------------------------------------
+// Writes every file under root, with its tags and analysis results, to a
+// LibraryArchive at archive_path. Rows are streamed in path order straight
+// from the file_path index into the archive. Returns the number of files
+// exported, or -1 if the archive could not be written.
+//-----------------------------------------------------------------------------
+int64_t Database::export_library (const fs::path &root, const fs::path &archive_path) {
+
+    const char *sql = "SELECT "\
+        "file_path, "\
+        "file_size, "\
+        "num_user_tags, "\
+        "user_tags, "\
+        "num_auto_tags, "\
+        "auto_tags, "\
+        "user_bpm, "\
+        "user_key, "\
+        "auto_bpm, "\
+        "auto_key, "\
+        "file_mtime, "\
+        "duration_ms, "\
+        "analysis_state, "\
+        "embedding "\
+        "FROM audio_files WHERE file_path >= ? AND file_path < ? "\
+        "ORDER BY file_path;";
+
+    std::wstring lower, upper;
+    path_prefix_range(root, &lower, &upper);
+    std::string prefix;
+    path_to_utf8(root / "", &prefix);
+
+    PooledConnection reader(&readers);
+    if (!reader) {
+        errlog("Database::export_library: No reader connection.\n");
+        return -1;
+    }
+
+    CachedStatement stmt(&reader->statements, sql);
+    if (!stmt) {
+        errlog("Database::export_library: Failed to prepare statement.\n");
+        return -1;
+    }
+    sqlite3_bind_text16(stmt, 1, lower.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text16(stmt, 2, upper.c_str(), -1, SQLITE_STATIC);
+
+    ArchiveWriter writer;
+    if (!writer.open(archive_path)) {
+        return -1;
+    }
+
+    int64_t num_exported = 0;
+    struct ArchiveRecord record;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        column_file_record(stmt, &record.file);
+
+        // archived paths are relative to root and use '/' on every platform
+        record.file.file_path.erase(0, prefix.size());
+        record.file.name_offset -= static_cast<uint32_t>(prefix.size());
+        for (char &ch : record.file.file_path) {
+            if (ch == '\\') {
+                ch = '/';
+            }
+        }
+
+        record.duration_ms = sqlite3_column_int(stmt, 11);
+        record.analysis_state = sqlite3_column_int(stmt, 12);
+        const float *embedding = static_cast<const float *>(sqlite3_column_blob(stmt, 13));
+        size_t num_bytes = static_cast<size_t>(sqlite3_column_bytes(stmt, 13));
+        record.embedding.assign(embedding, embedding + num_bytes / sizeof(float));
+
+        writer.add(record);
+        ++num_exported;
+    }
+
+    return writer.finish() ? num_exported : -1;
+}
+
+//-----------------------------------------------------------------------------
+// Database::import_library
+// ----------------------------------------------------------------------------
+// Loads a LibraryArchive written by export_library, placing its files under
+// root. Files already indexed at the same path are overwritten. Everything
+// is written in one transaction, with tags, names and embeddings reaching
+// the in-memory indexes once it commits, so a damaged archive leaves the
+// database as it was. Returns the number of files imported, or -1.
+//-----------------------------------------------------------------------------
+int64_t Database::import_library (const fs::path &archive_path, const fs::path &root) {
+
+    const char *sql = "INSERT INTO audio_files ("\
+        "file_path,"\
+        "file_name,"\
+        "file_size,"\
+        "file_mtime,"\
+        "num_user_tags,"\
+        "user_tags,"\
+        "num_auto_tags,"\
+        "auto_tags,"\
+        "user_bpm,"\
+        "user_key,"\
+        "auto_bpm,"\
+        "auto_key,"\
+        "duration_ms,"\
+        "analysis_state,"\
+        "embedding"\
+        ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?) "\
+        "ON CONFLICT(file_path) DO UPDATE SET "\
+        "file_size = excluded.file_size,"\
+        "file_mtime = excluded.file_mtime,"\
+        "num_user_tags = excluded.num_user_tags,"\
+        "user_tags = excluded.user_tags,"\
+        "num_auto_tags = excluded.num_auto_tags,"\
+        "auto_tags = excluded.auto_tags,"\
+        "user_bpm = excluded.user_bpm,"\
+        "user_key = excluded.user_key,"\
+        "auto_bpm = excluded.auto_bpm,"\
+        "auto_key = excluded.auto_key,"\
+        "duration_ms = excluded.duration_ms,"\
+        "analysis_state = excluded.analysis_state,"\
+        "embedding = excluded.embedding "\
+        "RETURNING id;";
+
+    ArchiveReader archive;
+    if (!archive.open(archive_path)) {
+        return -1;
+    }
+
+    std::string prefix;
+    path_to_utf8(root / "", &prefix);
+
+    std::lock_guard<std::mutex> lock(write_mtx);
+
+    CachedStatement stmt(&statements, sql);
+    if (!stmt) {
+        errlog("Database::import_library: Failed to prepare statement.\n");
+        return -1;
+    }
+
+    // the graph cannot load while write_mtx is held, so this holds throughout
+    bool similar_loaded = similar_index.is_loaded();
+
+    IndexChanges changes;
+    std::vector<std::pair<int64_t, std::vector<float>>> embeddings;
+    int64_t num_imported = 0;
+
+    exec("BEGIN TRANSACTION;");
+    changes.generation = bump_generation(INDEX_GENERATION);
+    bump_generation(SIMILAR_GENERATION);
+
+    struct ArchiveRecord record;
+    while (archive.next(&record)) {
+        struct FileRecord &file = record.file;
+        for (char &ch : file.file_path) {
+            if (ch == '/') {
+                ch = static_cast<char>(fs::path::preferred_separator);
+            }
+        }
+        file.file_path.insert(0, prefix);
+        file.name_offset += static_cast<uint32_t>(prefix.size());
+
+        bool has_embedding = record.embedding.size() == EMBEDDING_DIM;
+        bind_file_record(stmt, &file);
+        sqlite3_bind_int(stmt, 13, record.duration_ms);
+        sqlite3_bind_int(stmt, 14, record.analysis_state);
+        if (has_embedding) {
+            sqlite3_bind_blob(stmt, 15, record.embedding.data(),
+                EMBEDDING_DIM * sizeof(float), SQLITE_STATIC);
+        }
+        else {
+            sqlite3_bind_null(stmt, 15);
+        }
+
+        if (sqlite3_step(stmt) != SQLITE_ROW) {
+            errlog("Database::import_library: Error inserting data.\n");
+            sqlite3_reset(stmt);
+            rollback(&changes);
+            return -1;
+        }
+        int64_t file_id = sqlite3_column_int64(stmt, 0);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+
+        store_file_tags(file_id, file.auto_tags, file.user_tags, &changes);
+        changes.names_added.emplace_back(file_id, std::string(file.file_name()));
+        if (has_embedding && similar_loaded) {
+            embeddings.emplace_back(file_id, std::move(record.embedding));
+        }
+        ++num_imported;
+    }
+
+    if (archive.failed()) {
+        rollback(&changes);
+        return -1;
+    }
+    exec("COMMIT;");
+    apply_index_changes(&changes);
+
+    for (const auto &embedding : embeddings) {
+        similar_index.insert(embedding.first, embedding.second.data());
+    }
+    return num_imported;
+}
@@ -0,0 +1,89 @@
+#include "FileQuery.h"
+
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// relative_key
+// ----------------------------------------------------------------------------
+// A minor key's relative major is three semitones up; a major key's relative
+// minor is three semitones down. Unknown keys stay unknown.
+//-----------------------------------------------------------------------------
+int relative_key (int key) {
+    if (key >= KEY_MAJOR(0) && key <= KEY_MAJOR(11)) {
+        return KEY_MINOR((key - KEY_MAJOR(0) + 9) % 12);
+    }
+    if (key >= KEY_MINOR(0) && key <= KEY_MINOR(11)) {
+        return KEY_MAJOR((key - KEY_MINOR(0) + 3) % 12);
+    }
+    return KEY_UNKNOWN;
+}
+
+// tags are stored lowercase
+static std::string lowercase (std::string_view tag) {
+    std::string lowered(tag);
+    for (char &ch : lowered) {
+        if (ch >= 'A' && ch <= 'Z') {
+            ch += 'a' - 'A';
+        }
+    }
+    return lowered;
+}
+
+static QueryRange make_range (int64_t min, int64_t max) {
+    QueryRange range;
+    range.active = true;
+    range.min = min;
+    range.max = max;
+    return range;
+}
+
+FileQuery &FileQuery::text (std::string_view words) {
+    this->words = words;
+    return *this;
+}
+
+FileQuery &FileQuery::with_tag (std::string_view tag) {
+    all_of.push_back(lowercase(tag));
+    return *this;
+}
+
+FileQuery &FileQuery::without_tag (std::string_view tag) {
+    none_of.push_back(lowercase(tag));
+    return *this;
+}
+
+FileQuery &FileQuery::bpm (int min, int max) {
+    bpm_range = make_range(min, max);
+    return *this;
+}
+
+//-----------------------------------------------------------------------------
+// FileQuery::key / key_or_relative
+// ----------------------------------------------------------------------------
+// Adds a key a file may be in; keys added by several calls are alternatives.
+// key_or_relative also accepts the relative major or minor.
+//-----------------------------------------------------------------------------
+FileQuery &FileQuery::key (int key) {
+    if (std::find(keys.begin(), keys.end(), key) == keys.end()) {
+        keys.push_back(key);
+    }
+    return *this;
+}
+
+FileQuery &FileQuery::key_or_relative (int key) {
+    this->key(key);
+    if (key != KEY_UNKNOWN) {
+        this->key(relative_key(key));
+    }
+    return *this;
+}
+
+FileQuery &FileQuery::duration_ms (int64_t min, int64_t max) {
+    duration_range = make_range(min, max);
+    return *this;
+}
+
+FileQuery &FileQuery::file_size (int64_t min, int64_t max) {
+    size_range = make_range(min, max);
+    return *this;
+}
@@ -0,0 +1,558 @@
+#include "IndexSnapshot.h"
+
+#include <cstring>
+
+void IndexChanges::clear (void) {
+    generation = 0;
+    tags_named.clear();
+    tags_added.clear();
+    tags_removed.clear();
+    names_added.clear();
+    files_removed.clear();
+}
+
+// size in bytes of one element of each snapshot section
+static const size_t section_element_size[NUM_SNAPSHOT_SECTIONS] = {
+    sizeof(int64_t),    // SECTION_TAG_IDS
+    sizeof(uint64_t),   // SECTION_TAG_NAME_OFFSETS
+    sizeof(char),       // SECTION_TAG_NAMES
+    sizeof(int64_t),    // SECTION_LIST_TAG_IDS
+    sizeof(uint64_t),   // SECTION_LIST_OFFSETS
+    sizeof(int64_t),    // SECTION_LIST_FILE_IDS
+    sizeof(uint32_t),   // SECTION_FILE_IDS
+    sizeof(uint64_t),   // SECTION_NAME_OFFSETS
+    sizeof(char),       // SECTION_NAMES
+    sizeof(uint32_t),   // SECTION_TRIGRAMS
+    sizeof(uint64_t),   // SECTION_TRIGRAM_OFFSETS
+    sizeof(uint32_t)    // SECTION_TRIGRAM_FILE_IDS
+};
+
+static uint64_t align8 (uint64_t n) {
+    return (n + 7) & ~static_cast<uint64_t>(7);
+}
+
+//=============================================================================
+// IndexSnapshot
+//=============================================================================
+
+IndexSnapshot::IndexSnapshot (void) {
+    this->file_handle = INVALID_HANDLE_VALUE;
+    this->map_handle = NULL;
+    this->view = nullptr;
+    this->view_size = 0;
+    this->header = nullptr;
+}
+
+IndexSnapshot::~IndexSnapshot (void) {
+    close();
+}
+
+//-----------------------------------------------------------------------------
+// IndexSnapshot::open
+// ----------------------------------------------------------------------------
+// Maps a snapshot read-only and checks that it is well formed. Returns false
+// if there is no snapshot or it cannot be used.
+//-----------------------------------------------------------------------------
+bool IndexSnapshot::open (const fs::path &path) {
+    close();
+
+    file_handle = CreateFileW(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL
+    );
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || 
+        file_size.QuadPart < static_cast<LONGLONG>(sizeof(SnapshotHeader))) {
+        close();
+        return false;
+    }
+    view_size = static_cast<size_t>(file_size.QuadPart);
+
+    map_handle = CreateFileMappingW(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map_handle == NULL) {
+        close();
+        return false;
+    }
+
+    view = static_cast<const uint8_t *>(MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0));
+    if (view == nullptr) {
+        close();
+        return false;
+    }
+    header = reinterpret_cast<const SnapshotHeader *>(view);
+
+    if (!validate()) {
+        errlog("IndexSnapshot::open: Ignoring a damaged snapshot.\n");
+        close();
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// IndexSnapshot::close
+// ----------------------------------------------------------------------------
+// Unmaps the snapshot. The indexes restored from it keep their own copies.
+//-----------------------------------------------------------------------------
+void IndexSnapshot::close (void) {
+    if (view) {
+        UnmapViewOfFile(view);
+        view = nullptr;
+    }
+    if (map_handle != NULL) {
+        CloseHandle(map_handle);
+        map_handle = NULL;
+    }
+    if (file_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(file_handle);
+        file_handle = INVALID_HANDLE_VALUE;
+    }
+    view_size = 0;
+    header = nullptr;
+}
+
+int64_t IndexSnapshot::generation (void) const {
+    return header ? header->generation : -1;
+}
+
+//-----------------------------------------------------------------------------
+// IndexSnapshot::validate
+// ----------------------------------------------------------------------------
+// Checks the header, that every section lies inside the file, and that every
+// offset array is ordered and ends at the size of the section it indexes, so
+// restore can trust every array it reads.
+//-----------------------------------------------------------------------------
+bool IndexSnapshot::validate (void) const {
+
+    if (header->magic != SNAPSHOT_MAGIC || 
+        header->version != SNAPSHOT_VERSION ||
+        header->num_sections != NUM_SNAPSHOT_SECTIONS) {
+        return false;
+    }
+
+    for (int s = 0; s < NUM_SNAPSHOT_SECTIONS; s++) {
+        uint64_t offset = header->offsets[s];
+        uint64_t count = header->counts[s];
+        if (offset % 8 != 0 || offset > view_size || 
+            count > (view_size - offset) / section_element_size[s]) {
+            return false;
+        }
+    }
+
+    // each offset array has one more entry than the ids it goes with
+    struct {
+        SnapshotSection ids;
+        SnapshotSection offsets;
+        SnapshotSection data;
+    } arrays[] = {
+        {SECTION_TAG_IDS, SECTION_TAG_NAME_OFFSETS, SECTION_TAG_NAMES},
+        {SECTION_LIST_TAG_IDS, SECTION_LIST_OFFSETS, SECTION_LIST_FILE_IDS},
+        {SECTION_FILE_IDS, SECTION_NAME_OFFSETS, SECTION_NAMES},
+        {SECTION_TRIGRAMS, SECTION_TRIGRAM_OFFSETS, SECTION_TRIGRAM_FILE_IDS}
+    };
+    for (const auto &array : arrays) {
+        uint64_t count = header->counts[array.ids];
+        if (header->counts[array.offsets] != count + 1) {
+            return false;
+        }
+        const uint64_t *offsets = section<uint64_t>(array.offsets);
+        if (offsets[0] != 0 || offsets[count] != header->counts[array.data]) {
+            return false;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            if (offsets[i] > offsets[i + 1]) {
+                return false;
+            }
+        }
+    }
+
+    // names are restored by id, which must ascend
+    const uint32_t *file_ids = section<uint32_t>(SECTION_FILE_IDS);
+    for (uint64_t i = 1; i < header->counts[SECTION_FILE_IDS]; i++) {
+        if (file_ids[i - 1] >= file_ids[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// IndexSnapshot::restore
+// ----------------------------------------------------------------------------
+// Copies the snapshot into empty indexes. Every array is handed over as it
+// is; nothing is parsed, folded or split.
+//-----------------------------------------------------------------------------
+void IndexSnapshot::restore (TagIndex *tags, TrigramIndex *names) const {
+
+    tags->restore_tags(
+        section<int64_t>(SECTION_TAG_IDS),
+        section<uint64_t>(SECTION_TAG_NAME_OFFSETS),
+        section<char>(SECTION_TAG_NAMES),
+        header->counts[SECTION_TAG_IDS]
+    );
+    tags->restore_lists(
+        section<int64_t>(SECTION_LIST_TAG_IDS),
+        section<uint64_t>(SECTION_LIST_OFFSETS),
+        section<int64_t>(SECTION_LIST_FILE_IDS),
+        header->counts[SECTION_LIST_TAG_IDS]
+    );
+    names->restore_names(
+        section<uint32_t>(SECTION_FILE_IDS),
+        section<uint64_t>(SECTION_NAME_OFFSETS),
+        section<char>(SECTION_NAMES),
+        header->counts[SECTION_FILE_IDS]
+    );
+    names->restore_lists(
+        section<uint32_t>(SECTION_TRIGRAMS),
+        section<uint64_t>(SECTION_TRIGRAM_OFFSETS),
+        section<uint32_t>(SECTION_TRIGRAM_FILE_IDS),
+        header->counts[SECTION_TRIGRAMS]
+    );
+}
+
+//-----------------------------------------------------------------------------
+// IndexSnapshot::write
+// ----------------------------------------------------------------------------
+// Saves the contents of both indexes as of generation. The sections are
+// gathered in memory, written to a temporary file and renamed over path.
+// The old snapshot must not be open.
+//-----------------------------------------------------------------------------
+bool IndexSnapshot::write (const fs::path &path, int64_t generation, 
+    TagIndex *tags, TrigramIndex *names) {
+
+    std::vector<int64_t> tag_ids;
+    std::vector<uint64_t> tag_name_offsets = {0};
+    std::string tag_names;
+    tags->for_each_tag([&](int64_t tag_id, std::string_view name) {
+        tag_ids.push_back(tag_id);
+        tag_names.append(name);
+        tag_name_offsets.push_back(tag_names.size());
+    });
+
+    std::vector<int64_t> list_tag_ids;
+    std::vector<uint64_t> list_offsets = {0};
+    std::vector<int64_t> list_file_ids;
+    tags->for_each_list([&](int64_t tag_id, const std::vector<int64_t> &file_ids) {
+        list_tag_ids.push_back(tag_id);
+        list_file_ids.insert(list_file_ids.end(), file_ids.begin(), file_ids.end());
+        list_offsets.push_back(list_file_ids.size());
+    });
+
+    std::vector<uint32_t> file_ids;
+    std::vector<uint64_t> name_offsets = {0};
+    std::string folded_names;
+    names->for_each_name([&](uint32_t file_id, std::string_view folded) {
+        file_ids.push_back(file_id);
+        folded_names.append(folded);
+        name_offsets.push_back(folded_names.size());
+    });
+
+    std::vector<uint32_t> trigrams;
+    std::vector<uint64_t> trigram_offsets = {0};
+    std::vector<uint32_t> trigram_file_ids;
+    names->for_each_list([&](uint32_t trigram, const std::vector<uint32_t> &ids) {
+        trigrams.push_back(trigram);
+        trigram_file_ids.insert(trigram_file_ids.end(), ids.begin(), ids.end());
+        trigram_offsets.push_back(trigram_file_ids.size());
+    });
+
+    struct {
+        const void *data;
+        uint64_t count;
+    } sections[NUM_SNAPSHOT_SECTIONS] = {
+        {tag_ids.data(), tag_ids.size()},
+        {tag_name_offsets.data(), tag_name_offsets.size()},
+        {tag_names.data(), tag_names.size()},
+        {list_tag_ids.data(), list_tag_ids.size()},
+        {list_offsets.data(), list_offsets.size()},
+        {list_file_ids.data(), list_file_ids.size()},
+        {file_ids.data(), file_ids.size()},
+        {name_offsets.data(), name_offsets.size()},
+        {folded_names.data(), folded_names.size()},
+        {trigrams.data(), trigrams.size()},
+        {trigram_offsets.data(), trigram_offsets.size()},
+        {trigram_file_ids.data(), trigram_file_ids.size()}
+    };
+
+    SnapshotHeader header = {};
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.num_sections = NUM_SNAPSHOT_SECTIONS;
+    header.generation = generation;
+    uint64_t offset = align8(sizeof(SnapshotHeader));
+    for (int s = 0; s < NUM_SNAPSHOT_SECTIONS; s++) {
+        header.offsets[s] = offset;
+        header.counts[s] = sections[s].count;
+        offset += align8(sections[s].count * section_element_size[s]);
+    }
+
+    fs::path temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        static const char padding[8] = {};
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(padding, align8(sizeof(header)) - sizeof(header));
+        for (int s = 0; s < NUM_SNAPSHOT_SECTIONS; s++) {
+            uint64_t bytes = sections[s].count * section_element_size[s];
+            out.write(static_cast<const char *>(sections[s].data), bytes);
+            out.write(padding, align8(bytes) - bytes);
+        }
+        if (!out.good()) {
+            errlog("IndexSnapshot::write: Failed to write the snapshot.\n");
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(temp_path, path, ec);
+    if (ec) {
+        errlog("IndexSnapshot::write: Failed to replace the snapshot.\n");
+        fs::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+//=============================================================================
+// DeltaLog
+//=============================================================================
+
+// Each record is a fixed header followed by its payload:
+//   generation, then the counts of tags named, tags added, tags removed,
+//   names added and files removed, then the tag names and file names each
+//   as an id, length and bytes, the postings, and the removed file ids.
+struct DeltaRecordHeader {
+    uint32_t magic;
+    uint32_t payload_size;
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+// FNV-1a, enough to tell a record torn by a crash from a whole one
+static uint32_t delta_checksum (const uint8_t *data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+static void put (std::vector<uint8_t> *buffer, const T &value) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+    buffer->insert(buffer->end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+static bool take (const uint8_t **cursor, const uint8_t *end, T *value) {
+    if (static_cast<size_t>(end - *cursor) < sizeof(T)) {
+        return false;
+    }
+    memcpy(value, *cursor, sizeof(T));
+    *cursor += sizeof(T);
+    return true;
+}
+
+DeltaLog::DeltaLog (void) {
+    this->file_size = 0;
+}
+
+DeltaLog::~DeltaLog (void) {
+    close();
+}
+
+//-----------------------------------------------------------------------------
+// DeltaLog::open
+// ----------------------------------------------------------------------------
+// Opens the log at path for appending, creating it if needed.
+//-----------------------------------------------------------------------------
+bool DeltaLog::open (const fs::path &path) {
+    close();
+    this->path = path;
+
+    std::error_code ec;
+    file_size = fs::exists(path, ec) ? fs::file_size(path, ec) : 0;
+    if (ec) {
+        file_size = 0;
+    }
+
+    file.open(path, std::ios::binary | std::ios::app);
+    if (!file.is_open()) {
+        errlog("DeltaLog::open: Cannot open the delta log.\n");
+        return false;
+    }
+    return true;
+}
+
+void DeltaLog::close (void) {
+    if (file.is_open()) {
+        file.close();
+    }
+}
+
+uint64_t DeltaLog::size (void) const {
+    return file_size;
+}
+
+//-----------------------------------------------------------------------------
+// DeltaLog::append
+// ----------------------------------------------------------------------------
+// Appends the changes of one committed transaction and flushes them.
+//-----------------------------------------------------------------------------
+void DeltaLog::append (const IndexChanges &changes) {
+
+    if (!file.is_open()) {
+        return;
+    }
+
+    buffer.clear();
+    buffer.resize(sizeof(DeltaRecordHeader));
+    put(&buffer, changes.generation);
+    put(&buffer, static_cast<uint64_t>(changes.tags_named.size()));
+    put(&buffer, static_cast<uint64_t>(changes.tags_added.size()));
+    put(&buffer, static_cast<uint64_t>(changes.tags_removed.size()));
+    put(&buffer, static_cast<uint64_t>(changes.names_added.size()));
+    put(&buffer, static_cast<uint64_t>(changes.files_removed.size()));
+    auto put_names = [this](const std::vector<std::pair<int64_t, std::string>> &names) {
+        for (const auto &name : names) {
+            put(&buffer, name.first);
+            put(&buffer, static_cast<uint32_t>(name.second.size()));
+            buffer.insert(buffer.end(), name.second.begin(), name.second.end());
+        }
+    };
+    put_names(changes.tags_named);
+    for (const TagPosting &posting : changes.tags_added) {
+        put(&buffer, posting);
+    }
+    for (const TagPosting &posting : changes.tags_removed) {
+        put(&buffer, posting);
+    }
+    put_names(changes.names_added);
+    for (int64_t file_id : changes.files_removed) {
+        put(&buffer, file_id);
+    }
+
+    DeltaRecordHeader header = {};
+    header.magic = DELTA_MAGIC;
+    header.payload_size = static_cast<uint32_t>(buffer.size() - sizeof(header));
+    header.checksum = delta_checksum(buffer.data() + sizeof(header), header.payload_size);
+    memcpy(buffer.data(), &header, sizeof(header));
+
+    file.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+    file.flush();
+    file_size += buffer.size();
+}
+
+//-----------------------------------------------------------------------------
+// DeltaLog::replay
+// ----------------------------------------------------------------------------
+// Applies, in order, the records that follow after_generation. Records at or
+// before it are already in the snapshot and are skipped. Stops at the first
+// damaged record or gap in the generations. Returns the generation of the
+// last record applied, or after_generation if none was.
+//-----------------------------------------------------------------------------
+int64_t DeltaLog::replay (int64_t after_generation, 
+    const std::function<void (IndexChanges &)> &apply) {
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        return after_generation;
+    }
+    std::vector<uint8_t> contents((std::istreambuf_iterator<char>(in)), 
+        std::istreambuf_iterator<char>());
+
+    int64_t generation = after_generation;
+    IndexChanges changes;
+    const uint8_t *cursor = contents.data();
+    const uint8_t *end = contents.data() + contents.size();
+
+    DeltaRecordHeader header;
+    while (take(&cursor, end, &header)) {
+        if (header.magic != DELTA_MAGIC || 
+            header.payload_size > static_cast<size_t>(end - cursor) ||
+            header.checksum != delta_checksum(cursor, header.payload_size)) {
+            break;
+        }
+        const uint8_t *record_end = cursor + header.payload_size;
+
+        changes.clear();
+        uint64_t num_named, num_added, num_removed, num_names, num_files;
+        bool whole = take(&cursor, record_end, &changes.generation) &&
+                     take(&cursor, record_end, &num_named) &&
+                     take(&cursor, record_end, &num_added) &&
+                     take(&cursor, record_end, &num_removed) &&
+                     take(&cursor, record_end, &num_names) &&
+                     take(&cursor, record_end, &num_files);
+
+        auto take_names = [&](uint64_t count, 
+            std::vector<std::pair<int64_t, std::string>> *names) {
+            for (uint64_t i = 0; whole && i < count; i++) {
+                int64_t id;
+                uint32_t length;
+                whole = take(&cursor, record_end, &id) && 
+                        take(&cursor, record_end, &length) &&
+                        length <= static_cast<size_t>(record_end - cursor);
+                if (whole) {
+                    names->emplace_back(id, 
+                        std::string(reinterpret_cast<const char *>(cursor), length));
+                    cursor += length;
+                }
+            }
+        };
+
+        take_names(num_named, &changes.tags_named);
+        TagPosting posting;
+        for (uint64_t i = 0; whole && i < num_added; i++) {
+            whole = take(&cursor, record_end, &posting);
+            changes.tags_added.push_back(posting);
+        }
+        for (uint64_t i = 0; whole && i < num_removed; i++) {
+            whole = take(&cursor, record_end, &posting);
+            changes.tags_removed.push_back(posting);
+        }
+        take_names(num_names, &changes.names_added);
+        for (uint64_t i = 0; whole && i < num_files; i++) {
+            int64_t file_id;
+            whole = take(&cursor, record_end, &file_id);
+            changes.files_removed.push_back(file_id);
+        }
+        cursor = record_end;
+
+        if (!whole) {
+            break;
+        }
+        if (changes.generation <= after_generation) {
+            continue;
+        }
+        if (changes.generation != generation + 1) {
+            break;
+        }
+        apply(changes);
+        generation = changes.generation;
+    }
+    return generation;
+}
+
+//-----------------------------------------------------------------------------
+// DeltaLog::truncate
+// ----------------------------------------------------------------------------
+// Empties the log once a snapshot holds everything in it.
+//-----------------------------------------------------------------------------
+void DeltaLog::truncate (void) {
+    close();
+    {
+        std::ofstream empty(path, std::ios::binary | std::ios::trunc);
+    }
+    file_size = 0;
+    file.open(path, std::ios::binary | std::ios::app);
+}
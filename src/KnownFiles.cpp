@@ -0,0 +1,341 @@
+#include "KnownFiles.h"
+
+#define KNOWN_FILES_MIN_CAPACITY 1024
+
+//-----------------------------------------------------------------------------
+// hash_path
+// ----------------------------------------------------------------------------
+// 64-bit FNV-1a hash of a path. Zero is reserved to mark empty slots.
+//-----------------------------------------------------------------------------
+uint64_t hash_path (const wchar_t *file_path, size_t path_len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < path_len; i++) {
+        hash ^= static_cast<uint64_t>(file_path[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+//-----------------------------------------------------------------------------
+// parent_length
+// ----------------------------------------------------------------------------
+// Length of the parent directory portion of a path, without the trailing
+// separator.
+//-----------------------------------------------------------------------------
+static size_t parent_length (const wchar_t *file_path, size_t path_len) {
+    while (path_len > 0 && 
+           file_path[path_len - 1] != L'\\' && 
+           file_path[path_len - 1] != L'/') {
+        --path_len;
+    }
+    while (path_len > 1 && 
+           (file_path[path_len - 1] == L'\\' || file_path[path_len - 1] == L'/')) {
+        --path_len;
+    }
+    return path_len;
+}
+
+//-----------------------------------------------------------------------------
+// KnownFiles::KnownFiles
+// ----------------------------------------------------------------------------
+// Creates an empty set.
+//-----------------------------------------------------------------------------
+KnownFiles::KnownFiles (void) {
+    this->num_entries = 0;
+    this->mask = 0;
+    grow(KNOWN_FILES_MIN_CAPACITY);
+}
+
+//-----------------------------------------------------------------------------
+// KnownFiles::reserve
+// ----------------------------------------------------------------------------
+// Sizes the table for num_files entries at a load factor of at most 1/2.
+//-----------------------------------------------------------------------------
+void KnownFiles::reserve (size_t num_files) {
+    size_t capacity = KNOWN_FILES_MIN_CAPACITY;
+    while (capacity < num_files * 2) {
+        capacity <<= 1;
+    }
+    if (capacity > slots.size()) {
+        grow(capacity);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// KnownFiles::grow
+// ----------------------------------------------------------------------------
+// Rehashes every entry into a table of the given (power of two) capacity.
+//-----------------------------------------------------------------------------
+void KnownFiles::grow (size_t capacity) {
+    std::vector<Slot> old_slots;
+    old_slots.swap(this->slots);
+
+    this->slots.assign(capacity, Slot{0, 0, 0, 0, 0, 0});
+    this->seen.reset(new std::atomic<uint8_t>[capacity]);
+    for (size_t i = 0; i < capacity; i++) {
+        this->seen[i].store(0, std::memory_order_relaxed);
+    }
+    this->mask = capacity - 1;
+
+    for (const Slot &slot : old_slots) {
+        if (slot.hash == 0) {
+            continue;
+        }
+        size_t idx = slot.hash & mask;
+        while (slots[idx].hash != 0) {
+            idx = (idx + 1) & mask;
+        }
+        slots[idx] = slot;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// KnownFiles::find_slot
+// ----------------------------------------------------------------------------
+// Linear probe for a path. Returns the index of the matching slot, or of the
+// empty slot where the path would be placed.
+//-----------------------------------------------------------------------------
+size_t KnownFiles::find_slot (uint64_t hash, const wchar_t *file_path,
+    size_t path_len) const {
+
+    size_t idx = hash & mask;
+    while (slots[idx].hash != 0) {
+        const Slot &slot = slots[idx];
+        if (slot.hash == hash &&
+            slot.path_len == path_len &&
+            paths.compare(slot.path_offset, path_len, file_path, path_len) == 0) {
+            break;
+        }
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+//-----------------------------------------------------------------------------
+// KnownFiles::add
+// ----------------------------------------------------------------------------
+// Records the size and modification time of an indexed file. Not thread safe;
+// only called while loading.
+//-----------------------------------------------------------------------------
+void KnownFiles::add (const wchar_t *file_path, size_t path_len, int64_t size,
+    int64_t mtime) {
+
+    if ((num_entries + 1) * 2 > slots.size()) {
+        grow(slots.size() * 2);
+    }
+
+    uint64_t hash = hash_path(file_path, path_len);
+    size_t idx = find_slot(hash, file_path, path_len);
+    if (slots[idx].hash != 0) {
+        slots[idx].size = size;
+        slots[idx].mtime = mtime;
+        return;
+    }
+
+    slots[idx].hash = hash;
+    slots[idx].dir_hash = hash_path(file_path, parent_length(file_path, path_len));
+    slots[idx].path_offset = static_cast<uint32_t>(paths.size());
+    slots[idx].path_len = static_cast<uint32_t>(path_len);
+    slots[idx].size = size;
+    slots[idx].mtime = mtime;
+    paths.append(file_path, path_len);
+    ++num_entries;
+}
+
+//-----------------------------------------------------------------------------
+// KnownFiles::check
+// ----------------------------------------------------------------------------
+// Classifies a file found on disk against the indexed snapshot and marks it
+// as seen.
+//-----------------------------------------------------------------------------
+FileStatus KnownFiles::check (const std::wstring &file_path, int64_t size,
+    int64_t mtime) {
+
+    uint64_t hash = hash_path(file_path.c_str(), file_path.size());
+    size_t idx = find_slot(hash, file_path.c_str(), file_path.size());
+
+    const Slot &slot = slots[idx];
+    if (slot.hash == 0) {
+        return FileStatus::NEW;
+    }
+
+    seen[idx].store(1, std::memory_order_relaxed);
+    if (slot.size != size || slot.mtime != mtime) {
+        return FileStatus::MODIFIED;
+    }
+    return FileStatus::UNCHANGED;
+}
+
+//-----------------------------------------------------------------------------
+// KnownFiles::mark_pruned
+// ----------------------------------------------------------------------------
+// Records that the files directly inside dir_path were not listed, so they
+// must not be reported as missing.
+//-----------------------------------------------------------------------------
+void KnownFiles::mark_pruned (const std::wstring &dir_path) {
+    size_t dir_len = dir_path.size();
+    while (dir_len > 1 && (dir_path[dir_len - 1] == L'\\' || dir_path[dir_len - 1] == L'/')) {
+        --dir_len;
+    }
+
+    uint64_t dir_hash = hash_path(dir_path.c_str(), dir_len);
+    std::lock_guard<std::mutex> lock(pruned_mtx);
+    pruned.insert(dir_hash);
+}
+
+//-----------------------------------------------------------------------------
+// KnownFiles::mark_pruned_tree
+// ----------------------------------------------------------------------------
+// Records that dir_path could not be listed, or not completely, so no file
+// anywhere under it may be reported as missing. A drive that went offline or
+// a directory that became unreadable must not cost its files their rows.
+//-----------------------------------------------------------------------------
+void KnownFiles::mark_pruned_tree (const std::wstring &dir_path) {
+    size_t dir_len = dir_path.size();
+    while (dir_len > 1 && (dir_path[dir_len - 1] == L'\\' || dir_path[dir_len - 1] == L'/')) {
+        --dir_len;
+    }
+
+    std::lock_guard<std::mutex> lock(pruned_mtx);
+    pruned_trees.emplace_back(dir_path, 0, dir_len);
+}
+
+//-----------------------------------------------------------------------------
+// in_tree
+// ----------------------------------------------------------------------------
+// Returns true if file_path lies anywhere under dir_path.
+//-----------------------------------------------------------------------------
+static bool in_tree (const std::wstring &file_path, const std::wstring &dir_path) {
+    return file_path.size() > dir_path.size() &&
+           file_path.compare(0, dir_path.size(), dir_path) == 0 &&
+           (file_path[dir_path.size()] == L'\\' || file_path[dir_path.size()] == L'/');
+}
+
+//-----------------------------------------------------------------------------
+// KnownFiles::for_each_missing
+// ----------------------------------------------------------------------------
+// Visits every loaded path that was never passed to check and does not lie
+// in a pruned directory or under a directory that failed to list. Only
+// meaningful once all walkers have finished.
+//-----------------------------------------------------------------------------
+void KnownFiles::for_each_missing (
+    const std::function<void (const std::wstring &)> &visit) {
+
+    std::wstring file_path;
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].hash == 0 || seen[i].load(std::memory_order_relaxed)) {
+            continue;
+        }
+        if (pruned.count(slots[i].dir_hash)) {
+            continue;
+        }
+        file_path.assign(paths, slots[i].path_offset, slots[i].path_len);
+        bool unlisted = false;
+        for (const auto &tree : pruned_trees) {
+            if (in_tree(file_path, tree)) {
+                unlisted = true;
+                break;
+            }
+        }
+        if (!unlisted) {
+            visit(file_path);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// KnownFiles::size
+// ----------------------------------------------------------------------------
+// Returns the number of loaded files.
+//-----------------------------------------------------------------------------
+size_t KnownFiles::size (void) const {
+    return num_entries;
+}
+
+//=============================================================================
+// KnownDirectories
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+// KnownDirectories::add
+// ----------------------------------------------------------------------------
+// Records the stored state of a directory. Not thread safe; only called
+// while loading.
+//-----------------------------------------------------------------------------
+void KnownDirectories::add (const DirectoryState &state) {
+    Entry &entry = dirs[state.dir_path];
+    entry.parent_path = state.parent_path;
+    entry.mtime = state.mtime;
+    entry.num_entries = state.num_entries;
+    entry.visited.store(0, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// KnownDirectories::link
+// ----------------------------------------------------------------------------
+// Builds each directory's list of subdirectories once loading is complete.
+//-----------------------------------------------------------------------------
+void KnownDirectories::link (void) {
+    for (auto &[dir_path, entry] : dirs) {
+        auto parent = dirs.find(entry.parent_path);
+        if (parent != dirs.end()) {
+            parent->second.subdirs.push_back(dir_path);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// KnownDirectories::unchanged
+// ----------------------------------------------------------------------------
+// Returns true if a directory still has its stored modification time, in
+// which case its recorded subdirectories are copied to subdirs. A zero mtime
+// marks a directory that was discovered but never listed.
+//-----------------------------------------------------------------------------
+bool KnownDirectories::unchanged (const std::wstring &dir_path, int64_t mtime,
+    std::vector<std::wstring> *subdirs) {
+
+    auto it = dirs.find(dir_path);
+    if (it == dirs.end()) {
+        return false;
+    }
+
+    Entry &entry = it->second;
+    entry.visited.store(1, std::memory_order_relaxed);
+    if (entry.mtime == 0 || entry.mtime != mtime) {
+        return false;
+    }
+
+    *subdirs = entry.subdirs;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// KnownDirectories::for_each_removed
+// ----------------------------------------------------------------------------
+// Visits every loaded directory the walk never reached. Every directory that
+// still exists is reached either by listing its parent or through its
+// parent's recorded subdirectories.
+//-----------------------------------------------------------------------------
+void KnownDirectories::for_each_removed (
+    const std::function<void (const std::wstring &)> &visit) {
+
+    for (auto &[dir_path, entry] : dirs) {
+        if (!entry.visited.load(std::memory_order_relaxed)) {
+            visit(dir_path);
+        }
+    }
+}
+
+//=============================================================================
+// DirectoryTicket
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+// release_ticket
+// ----------------------------------------------------------------------------
+// Drops one reference to a ticket. The release ordering makes the walker's
+// writes to the ticket visible to the thread that drops the last reference.
+//-----------------------------------------------------------------------------
+bool release_ticket (DirectoryTicket *ticket) {
+    return ticket->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1;
+}
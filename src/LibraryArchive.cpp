@@ -0,0 +1,373 @@
+#include "LibraryArchive.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+// longest embedding a record may carry, to reject damaged lengths
+#define ARCHIVE_MAX_EMBEDDING 1024
+
+//-----------------------------------------------------------------------------
+// crc32
+// ----------------------------------------------------------------------------
+// CRC-32 (IEEE 802.3) of a buffer, a byte at a time from a table built at
+// compile time.
+//-----------------------------------------------------------------------------
+static constexpr std::array<uint32_t, 256> crc32_table = []() {
+    std::array<uint32_t, 256> table = {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+uint32_t crc32 (const void *data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc = crc32_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+//=============================================================================
+// encoding
+//=============================================================================
+
+static void put_varint (std::string *out, uint64_t value) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+
+// small negative numbers stay short: 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+static void put_zigzag (std::string *out, int64_t value) {
+    put_varint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+static void put_string (std::string *out, std::string_view text) {
+    put_varint(out, text.size());
+    out->append(text);
+}
+
+static bool get_varint (const std::string &in, size_t *position, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && *position < in.size(); shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(in[(*position)++]);
+        *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool get_zigzag (const std::string &in, size_t *position, int64_t *value) {
+    uint64_t raw;
+    if (!get_varint(in, position, &raw)) {
+        return false;
+    }
+    *value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+    return true;
+}
+
+static bool get_int (const std::string &in, size_t *position, int *value) {
+    int64_t wide;
+    if (!get_zigzag(in, position, &wide) || wide < INT32_MIN || wide > INT32_MAX) {
+        return false;
+    }
+    *value = static_cast<int>(wide);
+    return true;
+}
+
+static bool get_string (const std::string &in, size_t *position, std::string *text) {
+    uint64_t size;
+    if (!get_varint(in, position, &size) || size > in.size() - *position) {
+        return false;
+    }
+    text->assign(in, *position, static_cast<size_t>(size));
+    *position += static_cast<size_t>(size);
+    return true;
+}
+
+//=============================================================================
+// ArchiveWriter
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+// ArchiveWriter::~ArchiveWriter
+// ----------------------------------------------------------------------------
+// Removes the temporary file of an archive that was never finished.
+//-----------------------------------------------------------------------------
+ArchiveWriter::~ArchiveWriter (void) {
+    if (out.is_open()) {
+        out.close();
+        std::error_code ec;
+        fs::remove(temp_path, ec);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// ArchiveWriter::open
+// ----------------------------------------------------------------------------
+// Starts an archive that replaces path once finished.
+//-----------------------------------------------------------------------------
+bool ArchiveWriter::open (const fs::path &path) {
+
+    this->path = path;
+    this->temp_path = path;
+    this->temp_path += ".tmp";
+
+    out.open(temp_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        errlog("ArchiveWriter::open: Cannot create archive.\n");
+        return false;
+    }
+
+    ArchiveHeader header = {ARCHIVE_MAGIC, ARCHIVE_VERSION, 0};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    block.reserve(ARCHIVE_BLOCK_BYTES + 4096);
+    return out.good();
+}
+
+//-----------------------------------------------------------------------------
+// ArchiveWriter::add
+// ----------------------------------------------------------------------------
+// Appends a record. Records must come in path order for the front coding to
+// pay off. The block is written out once it reaches ARCHIVE_BLOCK_BYTES.
+//-----------------------------------------------------------------------------
+void ArchiveWriter::add (const struct ArchiveRecord &record) {
+
+    const struct FileRecord &file = record.file;
+
+    size_t shared = 0;
+    size_t limit = (std::min)(previous_path.size(), file.file_path.size());
+    while (shared < limit && previous_path[shared] == file.file_path[shared]) {
+        ++shared;
+    }
+    put_varint(&block, shared);
+    put_string(&block, std::string_view(file.file_path).substr(shared));
+
+    put_varint(&block, file.file_size);
+    put_zigzag(&block, file.file_mtime - previous_mtime);
+    put_zigzag(&block, file.num_user_tags);
+    put_string(&block, file.user_tags);
+    put_zigzag(&block, file.num_auto_tags);
+    put_string(&block, file.auto_tags);
+    put_zigzag(&block, file.user_bpm);
+    put_zigzag(&block, file.user_key);
+    put_zigzag(&block, file.auto_bpm);
+    put_zigzag(&block, file.auto_key);
+    put_zigzag(&block, record.duration_ms);
+    put_zigzag(&block, record.analysis_state);
+
+    put_varint(&block, record.embedding.size());
+    block.append(reinterpret_cast<const char *>(record.embedding.data()),
+        record.embedding.size() * sizeof(float));
+
+    previous_path = file.file_path;
+    previous_mtime = file.file_mtime;
+    ++block_records;
+
+    if (block.size() >= ARCHIVE_BLOCK_BYTES) {
+        flush_block();
+    }
+}
+
+void ArchiveWriter::flush_block (void) {
+    if (block_records == 0) {
+        return;
+    }
+
+    ArchiveBlockHeader header;
+    header.payload_size = static_cast<uint32_t>(block.size());
+    header.num_records = block_records;
+    header.checksum = crc32(block.data(), block.size());
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(block.data(), block.size());
+
+    block.clear();
+    block_records = 0;
+    previous_path.clear();
+    previous_mtime = 0;
+}
+
+//-----------------------------------------------------------------------------
+// ArchiveWriter::finish
+// ----------------------------------------------------------------------------
+// Writes the last block and the end marker, and renames the archive into
+// place. Returns false if anything failed to write.
+//-----------------------------------------------------------------------------
+bool ArchiveWriter::finish (void) {
+
+    flush_block();
+
+    ArchiveBlockHeader end = {0, 0, 0};
+    out.write(reinterpret_cast<const char *>(&end), sizeof(end));
+    out.close();
+    if (out.fail()) {
+        errlog("ArchiveWriter::finish: Failed to write archive.\n");
+        std::error_code ec;
+        fs::remove(temp_path, ec);
+        return false;
+    }
+
+    std::error_code ec;
+    fs::rename(temp_path, path, ec);
+    if (ec) {
+        errlog("ArchiveWriter::finish: Failed to replace archive.\n");
+        fs::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+//=============================================================================
+// ArchiveReader
+//=============================================================================
+
+bool ArchiveReader::open (const fs::path &path) {
+
+    in.open(path, std::ios::binary);
+    if (!in.is_open()) {
+        errlog("ArchiveReader::open: Cannot open archive.\n");
+        return false;
+    }
+
+    ArchiveHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        header.magic != ARCHIVE_MAGIC || header.version != ARCHIVE_VERSION) {
+        errlog("ArchiveReader::open: Not a library archive.\n");
+        return false;
+    }
+    return true;
+}
+
+bool ArchiveReader::failed (void) const {
+    return damaged;
+}
+
+//-----------------------------------------------------------------------------
+// ArchiveReader::read_block
+// ----------------------------------------------------------------------------
+// Reads the next block and checks it against its CRC. Returns false at the
+// end marker, or with the archive marked damaged if the block is cut short
+// or does not match.
+//-----------------------------------------------------------------------------
+bool ArchiveReader::read_block (void) {
+
+    ArchiveBlockHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+        errlog("ArchiveReader::read_block: Archive is truncated.\n");
+        damaged = true;
+        return false;
+    }
+    if (header.num_records == 0) {
+        done = true;
+        return false;
+    }
+    if (header.payload_size > ARCHIVE_MAX_BLOCK_BYTES) {
+        errlog("ArchiveReader::read_block: Block is too large.\n");
+        damaged = true;
+        return false;
+    }
+
+    block.resize(header.payload_size);
+    if (!in.read(block.data(), header.payload_size) ||
+        crc32(block.data(), block.size()) != header.checksum) {
+        errlog("ArchiveReader::read_block: Block is damaged.\n");
+        damaged = true;
+        return false;
+    }
+
+    position = 0;
+    block_records = header.num_records;
+    previous_path.clear();
+    previous_mtime = 0;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// ArchiveReader::next
+// ----------------------------------------------------------------------------
+// Decodes the next record into record, reading a new block when the current
+// one is used up.
+//-----------------------------------------------------------------------------
+bool ArchiveReader::next (struct ArchiveRecord *record) {
+
+    if (done || damaged) {
+        return false;
+    }
+    if (block_records == 0 && !read_block()) {
+        return false;
+    }
+    if (!decode(record)) {
+        errlog("ArchiveReader::next: Record is malformed.\n");
+        damaged = true;
+        return false;
+    }
+    --block_records;
+
+    // every record of a block is accounted for by its header
+    if (block_records == 0 && position != block.size()) {
+        errlog("ArchiveReader::next: Block has trailing bytes.\n");
+        damaged = true;
+        return false;
+    }
+    return true;
+}
+
+bool ArchiveReader::decode (struct ArchiveRecord *record) {
+
+    struct FileRecord &file = record->file;
+
+    uint64_t shared, file_size, num_floats;
+    std::string suffix;
+    int64_t mtime_delta;
+    if (!get_varint(block, &position, &shared) || shared > previous_path.size() ||
+        !get_string(block, &position, &suffix)) {
+        return false;
+    }
+    file.file_path.assign(previous_path, 0, static_cast<size_t>(shared));
+    file.file_path += suffix;
+    size_t separator = file.file_path.find_last_of('/');
+    file.name_offset = static_cast<uint32_t>(
+        separator == std::string::npos ? 0 : separator + 1);
+
+    if (!get_varint(block, &position, &file_size) ||
+        !get_zigzag(block, &position, &mtime_delta) ||
+        !get_int(block, &position, &file.num_user_tags) ||
+        !get_string(block, &position, &file.user_tags) ||
+        !get_int(block, &position, &file.num_auto_tags) ||
+        !get_string(block, &position, &file.auto_tags) ||
+        !get_int(block, &position, &file.user_bpm) ||
+        !get_int(block, &position, &file.user_key) ||
+        !get_int(block, &position, &file.auto_bpm) ||
+        !get_int(block, &position, &file.auto_key) ||
+        !get_int(block, &position, &record->duration_ms) ||
+        !get_int(block, &position, &record->analysis_state) ||
+        !get_varint(block, &position, &num_floats) ||
+        num_floats > ARCHIVE_MAX_EMBEDDING ||
+        num_floats * sizeof(float) > block.size() - position) {
+        return false;
+    }
+    file.file_size = static_cast<size_t>(file_size);
+    file.file_mtime = previous_mtime + mtime_delta;
+    file.ticket = nullptr;
+
+    record->embedding.resize(static_cast<size_t>(num_floats));
+    if (num_floats > 0) {
+        memcpy(record->embedding.data(), block.data() + position, num_floats * sizeof(float));
+        position += static_cast<size_t>(num_floats * sizeof(float));
+    }
+
+    previous_path = file.file_path;
+    previous_mtime = file.file_mtime;
+    return true;
+}
@@ -0,0 +1,275 @@
+#include "Metrics.h"
+
+#include <bit>
+#include <cstdio>
+
+Metrics metrics;
+
+static const char *stage_names[NUM_SCAN_STAGES] = {
+    "walk",
+    "requires_processing",
+    "parse",
+    "analyze",
+    "insert"
+};
+
+static int64_t now_ns (void) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//=============================================================================
+// Counter
+//=============================================================================
+
+void Counter::add (uint64_t n) {
+    value.fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t Counter::get (void) const {
+    return value.load(std::memory_order_relaxed);
+}
+
+void Counter::reset (void) {
+    value.store(0, std::memory_order_relaxed);
+}
+
+//=============================================================================
+// Gauge
+//=============================================================================
+
+void Gauge::set (int64_t level) {
+    value.store(level, std::memory_order_relaxed);
+    int64_t peak = max_value.load(std::memory_order_relaxed);
+    while (level > peak &&
+           !max_value.compare_exchange_weak(peak, level, std::memory_order_relaxed)) {
+    }
+}
+
+int64_t Gauge::get (void) const {
+    return value.load(std::memory_order_relaxed);
+}
+
+int64_t Gauge::peak (void) const {
+    return max_value.load(std::memory_order_relaxed);
+}
+
+void Gauge::reset (void) {
+    value.store(0, std::memory_order_relaxed);
+    max_value.store(0, std::memory_order_relaxed);
+}
+
+//=============================================================================
+// LatencyHistogram
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+// LatencyHistogram::bucket_index
+// ----------------------------------------------------------------------------
+// Maps a value to its bucket: the position of its highest set bit selects a
+// power of two and the next HISTOGRAM_SUB_BITS bits select the sub-bucket.
+//-----------------------------------------------------------------------------
+int LatencyHistogram::bucket_index (uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return static_cast<int>(value);
+    }
+    int msb = std::bit_width(value) - 1;
+    int shift = msb - HISTOGRAM_SUB_BITS;
+    int sub = static_cast<int>((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+//-----------------------------------------------------------------------------
+// LatencyHistogram::bucket_value
+// ----------------------------------------------------------------------------
+// The value reported for a bucket: the middle of the range it covers.
+//-----------------------------------------------------------------------------
+uint64_t LatencyHistogram::bucket_value (int index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return static_cast<uint64_t>(index);
+    }
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub = static_cast<uint64_t>(index % HISTOGRAM_SUB_BUCKETS);
+    uint64_t lower = (HISTOGRAM_SUB_BUCKETS + sub) << shift;
+    return lower + ((1ULL << shift) >> 1);
+}
+
+void LatencyHistogram::record (uint64_t nanoseconds) {
+    buckets[bucket_index(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    total_count.fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t peak = max_ns.load(std::memory_order_relaxed);
+    while (nanoseconds > peak &&
+           !max_ns.compare_exchange_weak(peak, nanoseconds, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::count (void) const {
+    return total_count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::max_latency (void) const {
+    return max_ns.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean (void) const {
+    uint64_t n = count();
+    if (n == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(total_ns.load(std::memory_order_relaxed)) / n;
+}
+
+//-----------------------------------------------------------------------------
+// LatencyHistogram::percentile
+// ----------------------------------------------------------------------------
+// Returns the latency below which a fraction p of the recorded values fall.
+// Values recorded concurrently may or may not be included.
+//-----------------------------------------------------------------------------
+uint64_t LatencyHistogram::percentile (double p) const {
+    uint64_t n = count();
+    if (n == 0) {
+        return 0;
+    }
+
+    uint64_t target = static_cast<uint64_t>(p * n);
+    if (target < 1) {
+        target = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return bucket_value(i);
+        }
+    }
+    return max_latency();
+}
+
+void LatencyHistogram::reset (void) {
+    for (int i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+    total_count.store(0, std::memory_order_relaxed);
+    total_ns.store(0, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
+}
+
+//=============================================================================
+// Metrics
+//=============================================================================
+
+Metrics::Metrics (void) {
+    start_ns.store(now_ns(), std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Metrics::reset
+// ----------------------------------------------------------------------------
+// Clears every metric. Called at the start of each scan so throughput is
+// measured from the scan's start.
+//-----------------------------------------------------------------------------
+void Metrics::reset (void) {
+    for (int i = 0; i < NUM_SCAN_STAGES; i++) {
+        stages[i].items.reset();
+        stages[i].latency.reset();
+    }
+    proc_queue_depth.reset();
+    insrt_queue_depth.reset();
+    analysis_queue_depth.reset();
+    dirs_pruned.reset();
+    files_new.reset();
+    files_modified.reset();
+    files_missing.reset();
+    records_allocated.reset();
+    start_ns.store(now_ns(), std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Metrics::to_json
+// ----------------------------------------------------------------------------
+// Dumps a snapshot of every metric as a JSON object. Latencies are reported
+// in nanoseconds and throughput in items per second since the last reset.
+//-----------------------------------------------------------------------------
+std::string Metrics::to_json (void) const {
+
+    char buffer[512];
+    std::string json;
+
+    double elapsed_s = (now_ns() - start_ns.load(std::memory_order_relaxed)) / 1e9;
+    snprintf(buffer, sizeof(buffer), "{\"elapsed_s\":%.3f,\"stages\":{", elapsed_s);
+    json += buffer;
+
+    for (int i = 0; i < NUM_SCAN_STAGES; i++) {
+        const StageMetrics &stage = stages[i];
+        uint64_t items = stage.items.get();
+        snprintf(buffer, sizeof(buffer),
+            "%s\"%s\":{\"items\":%llu,\"per_second\":%.1f,"
+            "\"latency_ns\":{\"count\":%llu,\"mean\":%.0f,"
+            "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}}",
+            i ? "," : "",
+            stage_names[i],
+            static_cast<unsigned long long>(items),
+            elapsed_s > 0 ? items / elapsed_s : 0.0,
+            static_cast<unsigned long long>(stage.latency.count()),
+            stage.latency.mean(),
+            static_cast<unsigned long long>(stage.latency.percentile(0.50)),
+            static_cast<unsigned long long>(stage.latency.percentile(0.90)),
+            static_cast<unsigned long long>(stage.latency.percentile(0.99)),
+            static_cast<unsigned long long>(stage.latency.max_latency())
+        );
+        json += buffer;
+    }
+
+    snprintf(buffer, sizeof(buffer),
+        "},\"queues\":{"
+        "\"proc_queue\":{\"depth\":%lld,\"peak\":%lld},"
+        "\"insrt_queue\":{\"depth\":%lld,\"peak\":%lld},"
+        "\"analysis_queue\":{\"depth\":%lld,\"peak\":%lld}},",
+        static_cast<long long>(proc_queue_depth.get()),
+        static_cast<long long>(proc_queue_depth.peak()),
+        static_cast<long long>(insrt_queue_depth.get()),
+        static_cast<long long>(insrt_queue_depth.peak()),
+        static_cast<long long>(analysis_queue_depth.get()),
+        static_cast<long long>(analysis_queue_depth.peak())
+    );
+    json += buffer;
+
+    snprintf(buffer, sizeof(buffer),
+        "\"counters\":{\"dirs_pruned\":%llu,\"files_new\":%llu,"
+        "\"files_modified\":%llu,\"files_missing\":%llu,"
+        "\"records_allocated\":%llu}}",
+        static_cast<unsigned long long>(dirs_pruned.get()),
+        static_cast<unsigned long long>(files_new.get()),
+        static_cast<unsigned long long>(files_modified.get()),
+        static_cast<unsigned long long>(files_missing.get()),
+        static_cast<unsigned long long>(records_allocated.get())
+    );
+    json += buffer;
+
+    return json;
+}
+
+//=============================================================================
+// ScopedTimer
+//=============================================================================
+
+ScopedTimer::ScopedTimer (ScanStage stage, uint64_t items) {
+    this->stage = stage;
+    this->items = items;
+    this->start = std::chrono::steady_clock::now();
+}
+
+ScopedTimer::~ScopedTimer (void) {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    uint64_t ns = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    metrics.stages[stage].latency.record(ns);
+    metrics.stages[stage].items.add(items);
+}
+
+void ScopedTimer::set_items (uint64_t items) {
+    this->items = items;
+}
@@ -0,0 +1,97 @@
+#include "QueryCache.h"
+
+QueryCache::QueryCache (size_t max_bytes) {
+    this->num_bytes = 0;
+    this->max_bytes = max_bytes;
+    this->current_epoch = 0;
+}
+
+//-----------------------------------------------------------------------------
+// QueryCache::find
+// ----------------------------------------------------------------------------
+// Returns the set cached for key, or nullptr, and marks it recently used.
+//-----------------------------------------------------------------------------
+CandidateSet QueryCache::find (const std::string &key) {
+    std::lock_guard<std::mutex> lock(cache_mtx);
+
+    auto found = by_key.find(key);
+    if (found == by_key.end()) {
+        return nullptr;
+    }
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->ids;
+}
+
+//-----------------------------------------------------------------------------
+// QueryCache::find_refinable
+// ----------------------------------------------------------------------------
+// Returns the smallest cached set whose key refines accepts, that is the
+// set of a query the new one narrows, or nullptr if there is none.
+//-----------------------------------------------------------------------------
+CandidateSet QueryCache::find_refinable (
+    const std::function<bool (const std::string &key)> &refines) {
+
+    std::lock_guard<std::mutex> lock(cache_mtx);
+
+    auto best = entries.end();
+    for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+        if ((best == entries.end() || entry->ids->size() < best->ids->size()) &&
+            refines(entry->key)) {
+            best = entry;
+        }
+    }
+    if (best == entries.end()) {
+        return nullptr;
+    }
+    entries.splice(entries.begin(), entries, best);
+    return best->ids;
+}
+
+//-----------------------------------------------------------------------------
+// QueryCache::insert
+// ----------------------------------------------------------------------------
+// Caches ids for key, evicting the least recently used sets until the cache
+// fits in max_bytes. A set too large to fit is not cached.
+//-----------------------------------------------------------------------------
+void QueryCache::insert (const std::string &key, CandidateSet ids, uint64_t epoch) {
+
+    size_t bytes = sizeof(Entry) + key.size() + ids->size() * sizeof(int64_t);
+    if (bytes > max_bytes) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    if (epoch != current_epoch) {
+        return;
+    }
+
+    auto found = by_key.find(key);
+    if (found != by_key.end()) {
+        num_bytes -= found->second->bytes;
+        entries.erase(found->second);
+        by_key.erase(found);
+    }
+
+    entries.push_front({key, std::move(ids), bytes});
+    by_key[key] = entries.begin();
+    num_bytes += bytes;
+
+    while (num_bytes > max_bytes) {
+        num_bytes -= entries.back().bytes;
+        by_key.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+uint64_t QueryCache::epoch (void) {
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    return current_epoch;
+}
+
+void QueryCache::clear (void) {
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    entries.clear();
+    by_key.clear();
+    num_bytes = 0;
+    ++current_epoch;
+}
@@ -0,0 +1,93 @@
+#include "QueryExecutor.h"
+
+QueryExecutor::QueryExecutor (void) {
+    this->running = false;
+    this->pending_generation = 0;
+    this->latest = 0;
+}
+
+QueryExecutor::~QueryExecutor (void) {
+    stop();
+}
+
+void QueryExecutor::start (void) {
+    std::lock_guard<std::mutex> lock(executor_mtx);
+    if (running) {
+        return;
+    }
+    running = true;
+    thread = std::thread(&QueryExecutor::run, this);
+}
+
+//-----------------------------------------------------------------------------
+// QueryExecutor::stop
+// ----------------------------------------------------------------------------
+// Drops the pending query, interrupts the running one and joins the thread.
+//-----------------------------------------------------------------------------
+void QueryExecutor::stop (void) {
+    {
+        std::lock_guard<std::mutex> lock(executor_mtx);
+        if (!running) {
+            return;
+        }
+        running = false;
+        pending = nullptr;
+        latest.fetch_add(1, std::memory_order_relaxed);
+    }
+    executor_cv.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+//-----------------------------------------------------------------------------
+// QueryExecutor::submit
+// ----------------------------------------------------------------------------
+// Replaces the pending query with query. Advancing the latest generation is
+// what interrupts the running one.
+//-----------------------------------------------------------------------------
+uint64_t QueryExecutor::submit (Query query) {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(executor_mtx);
+        generation = latest.fetch_add(1, std::memory_order_relaxed) + 1;
+        pending = std::move(query);
+        pending_generation = generation;
+    }
+    executor_cv.notify_one();
+    return generation;
+}
+
+bool QueryExecutor::is_current (uint64_t generation) const {
+    return latest.load(std::memory_order_relaxed) == generation;
+}
+
+//-----------------------------------------------------------------------------
+// QueryExecutor::run
+// ----------------------------------------------------------------------------
+// Query thread. Takes the pending query, if any, and runs it with its
+// generation set for cancellation.
+//-----------------------------------------------------------------------------
+void QueryExecutor::run (void) {
+
+    while (true) {
+        Query query;
+        uint64_t generation;
+        {
+            std::unique_lock<std::mutex> lock(executor_mtx);
+            executor_cv.wait(lock, [this]() {
+                return pending || !running;
+            });
+            if (!running) {
+                break;
+            }
+            query = std::move(pending);
+            pending = nullptr;
+            generation = pending_generation;
+        }
+
+        set_query_generation(&latest, generation);
+        query(generation);
+        set_query_generation(nullptr, 0);
+    }
+}
@@ -0,0 +1,61 @@
+#include "RecordPool.h"
+
+//-----------------------------------------------------------------------------
+// RecordPool::RecordPool
+// ----------------------------------------------------------------------------
+// Creates an empty pool. The first slab is allocated by the first acquire.
+//-----------------------------------------------------------------------------
+RecordPool::RecordPool (void) {
+    local.reserve(RECORD_SLAB_SIZE);
+    free_list.reserve(RECORD_SLAB_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+// RecordPool::acquire
+// ----------------------------------------------------------------------------
+// Returns an unused record. Fields keep whatever the previous use left in
+// them, so the caller must set every field.
+//-----------------------------------------------------------------------------
+struct FileRecord *RecordPool::acquire (void) {
+
+    // take back everything the insert stage has released in one go
+    if (local.empty()) {
+        std::lock_guard<std::mutex> lock(free_mtx);
+        local.swap(free_list);
+    }
+
+    if (local.empty()) {
+        grow();
+    }
+
+    struct FileRecord *record = local.back();
+    local.pop_back();
+    return record;
+}
+
+//-----------------------------------------------------------------------------
+// RecordPool::release
+// ----------------------------------------------------------------------------
+// Returns a batch of records to the pool and clears the batch.
+//-----------------------------------------------------------------------------
+void RecordPool::release (std::vector<struct FileRecord *> *records) {
+    std::lock_guard<std::mutex> lock(free_mtx);
+    free_list.insert(free_list.end(), records->begin(), records->end());
+    records->clear();
+}
+
+//-----------------------------------------------------------------------------
+// RecordPool::grow
+// ----------------------------------------------------------------------------
+// Allocates another slab and hands all of its records to the acquiring
+// thread.
+//-----------------------------------------------------------------------------
+void RecordPool::grow (void) {
+    slabs.emplace_back(new struct FileRecord[RECORD_SLAB_SIZE]);
+    metrics.records_allocated.add(RECORD_SLAB_SIZE);
+
+    struct FileRecord *slab = slabs.back().get();
+    for (int i = RECORD_SLAB_SIZE - 1; i >= 0; i--) {
+        local.push_back(&slab[i]);
+    }
+}
@@ -10,8 +10,12 @@
 #include "FileRecord.h"
 #include "ThreadSafeQueue.h"
 #include "Scanner.h"
+#include "Watcher.h"
+#include "ScanController.h"
+#include "Analyzer.h"
 #include "AudioFile.h"
 #include "FourierTX.h"
+#include "QueryExecutor.h"
 
 #include <unordered_map>
 #include <omp.h>
@@ -28,9 +32,6 @@
 
 Database db("audio_files.db");
 
-std::unordered_map<fs::path, struct FileRecord> all_files;
-std::vector<struct FileRecord> files_in_scope;
-
 std::string wchar_to_utf8(const std::wstring &wide_string) {
     int size_needed = WideCharToMultiByte(CP_UTF8, 0, wide_string.c_str(), (int)wide_string.size(), NULL, 0, NULL, NULL);
     std::string utf8_string(size_needed, 0);
@@ -42,63 +43,203 @@ std::string wchar_to_utf8(const std::wstring &wide_string) {
 // FLTK Search Results Window
 //=============================================================================
 
-// Callback function for button click events
-void file_button_callback (Fl_Widget *widget, void *data) {
-    Fl_Button *button = (Fl_Button *)widget;
-    // Display the file name when the button is clicked
-    printf("File selected: %s\n", button->label());
-}
+// results are fetched a page at a time as the list is scrolled
+#define SEARCH_PAGE_SIZE 50
+#define SEARCH_ROW_HEIGHT 20
+#define SIMILAR_LIMIT 100
+
+// every search runs on the query thread; typing supersedes the search
+// still running for the previous keystroke
+QueryExecutor query_executor;
+
+class SearchResults;
+
+// rows found on the query thread, handed to the ui thread by Fl::awake
+struct SearchPage {
+    SearchResults *results;
+    uint64_t generation;
+    bool first;
+    SearchCursor cursor;
+    std::vector<struct FileRecord> rows;
+    std::vector<struct FileRecord> fallback;
+};
 
 class SearchResults : public Fl_Scroll {
 public:
     SearchResults (int xpos, int ypos, int xlen, int ylen, const char *label)
         : Fl_Scroll(xpos, ypos, xlen, ylen, label) {
         this->type(Fl_Scroll::VERTICAL_ALWAYS);
+        this->num_rows = 0;
+        this->fallback_next = 0;
+        this->generation = 0;
+        this->loading = false;
     }
 
-    void set_files (std::vector<struct FileRecord> records) {
+    // replaces the list with the first page of results for text once they
+    // arrive; the current rows stay until then
+    void show_search (const char *text) {
+
+        query = text;
+        loading = true;
+        std::string query_text = query;
+        generation = query_executor.submit([this, query_text](uint64_t generation) {
+            SearchPage *page = new SearchPage{this, generation, true};
+            db.search_page(query_text.c_str(), &page->cursor, SEARCH_PAGE_SIZE,
+                [page](const struct FileRecord &file) {
+                    page->rows.push_back(file);
+                });
+
+            // fragments that are not the start of a word, like "hat_op", then
+            // misspellings, like "snre"
+            if (page->rows.empty() && query_executor.is_current(generation)) {
+                db.search_by_substring(&page->fallback, query_text.c_str());
+                if (page->fallback.empty() && query_executor.is_current(generation)) {
+                    db.search_fuzzy(&page->fallback, query_text.c_str());
+                }
+            }
+            post(page);
+        });
+    }
 
-        this->clear();
+    // replaces the list with the files that sound most like file_path
+    void show_similar (const std::string &file_path) {
+
+        query.clear();
+        loading = true;
+        generation = query_executor.submit([this, file_path](uint64_t generation) {
+            SearchPage *page = new SearchPage{this, generation, true};
+            page->cursor.exhausted = true;
+            db.search_similar(&page->fallback, file_path, SIMILAR_LIMIT);
+            post(page);
+        });
+    }
 
-        this->begin();
+    int handle (int event) override {
+        int ret = Fl_Scroll::handle(event);
 
-        //fprintf(stderr, "num files found: %d\n", records.size());
+        // fetch the next page before the end of the list comes into view
+        int rows_below = num_rows - (yposition() + h()) / SEARCH_ROW_HEIGHT;
+        if (rows_below < SEARCH_PAGE_SIZE / 2 && has_more() && !loading) {
+            load_page();
+        }
+        return ret;
+    }
 
-        int y_offset = 10;
-        int num = 0;
+private:
+    // a left click selects a file, a right click lists similar ones
+    static void row_callback (Fl_Widget *widget, void *data) {
+        SearchResults *results = static_cast<SearchResults *>(data);
+        size_t row = static_cast<size_t>(
+            (widget->y() - results->y() + results->yposition()) / SEARCH_ROW_HEIGHT);
+        if (row >= results->row_paths.size()) {
+            return;
+        }
+
+        if (Fl::event_button() == FL_RIGHT_MOUSE) {
+            results->show_similar(results->row_paths[row]);
+        }
+        else {
+            printf("File selected: %s\n", results->row_paths[row].c_str());
+        }
+    }
+
+    // called on the query thread; pages of superseded queries are dropped
+    static void post (SearchPage *page) {
+        if (!query_executor.is_current(page->generation) || Fl::awake(page_ready, page) != 0) {
+            delete page;
+        }
+    }
+
+    // called on the ui thread
+    static void page_ready (void *data) {
+        SearchPage *page = static_cast<SearchPage *>(data);
+        if (page->generation == page->results->generation) {
+            page->results->show_page(page);
+        }
+        delete page;
+    }
 
-        for (auto &record : records) {
-            if (++num >= 100) {
-                break;
+    bool has_more (void) const {
+        return !cursor.exhausted || fallback_next < fallback.size();
+    }
+
+    // appends the next page: from the fallback results if there are any
+    // left, otherwise fetched on the query thread
+    void load_page (void) {
+        if (fallback_next < fallback.size()) {
+            this->begin();
+            for (int i = 0; i < SEARCH_PAGE_SIZE && fallback_next < fallback.size(); i++) {
+                add_row(fallback[fallback_next++]);
             }
+            this->end();
+            this->redraw();
+            return;
+        }
 
-            /*const char *label = wchar_to_utf8(record.file_name.c_str()).c_str();
-            if (!label) {
-                label = "blank_label";
-            }*/
-            const char *label = "test_label";
-            
-            Fl_Button *button = new Fl_Button(50, y_offset, 340, 25, label);
-            button->box(FL_FLAT_BOX);
-            button->labelsize(20);
-            button->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE);
-            button->callback(file_button_callback);
-
-            y_offset += 20; // Adjust spacing between items
+        loading = true;
+        std::string query_text = query;
+        SearchCursor next = cursor;
+        generation = query_executor.submit([this, query_text, next](uint64_t generation) {
+            SearchPage *page = new SearchPage{this, generation, false, next};
+            db.search_page(query_text.c_str(), &page->cursor, SEARCH_PAGE_SIZE,
+                [page](const struct FileRecord &file) {
+                    page->rows.push_back(file);
+                });
+            post(page);
+        });
+    }
+
+    // adds the rows of a page, after clearing the list if it is the first
+    // page of a new search
+    void show_page (SearchPage *page) {
+        if (page->first) {
+            this->clear();
+            this->scroll_to(0, 0);
+            num_rows = 0;
+            row_paths.clear();
+            fallback = std::move(page->fallback);
+            fallback_next = 0;
         }
+        cursor = page->cursor;
+        loading = false;
 
+        this->begin();
+        for (const struct FileRecord &file : page->rows) {
+            add_row(file);
+        }
+        for (int i = 0; i < SEARCH_PAGE_SIZE && fallback_next < fallback.size(); i++) {
+            add_row(fallback[fallback_next++]);
+        }
         this->end();
-        this->resize_content(y_offset);
         this->redraw();
     }
-private:
-    void resize_content(int height) {
-        int content_height = height > h() ? height : h();
-        this->init_sizes(); // Ensure sizes are properly initialized
-        Fl_Box *invisible_box = new Fl_Box(0, 0, w() - 20, content_height);
-        invisible_box->hide();
-        add(invisible_box);
+
+    void add_row (const struct FileRecord &file) {
+        int row_y = y() + num_rows * SEARCH_ROW_HEIGHT - yposition();
+        Fl_Button *button = new Fl_Button(x(), row_y, w() - Fl::scrollbar_size(), 
+            SEARCH_ROW_HEIGHT);
+        button->copy_label(std::string(file.file_name()).c_str());
+        button->box(FL_FLAT_BOX);
+        button->labelsize(14);
+        button->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE);
+        button->callback(row_callback, this);
+        row_paths.push_back(file.file_path);
+        ++num_rows;
     }
+
+    std::string query;
+    SearchCursor cursor;
+    int num_rows;
+    std::vector<std::string> row_paths;
+
+    // substring and fuzzy results, used when the name search finds nothing,
+    // or the results of a similarity search
+    std::vector<struct FileRecord> fallback;
+    size_t fallback_next;
+
+    // the query whose page is awaited; pages of any other are stale
+    uint64_t generation;
+    bool loading;
 };
 SearchResults *search_results = nullptr;
 
@@ -110,13 +251,7 @@ SearchResults *search_results = nullptr;
 static void search_callback (Fl_Widget *widget, void *data) {
     Fl_Input *input = static_cast<Fl_Input *>(widget);
     fprintf(stderr, "%s\n", input->value());
-    std::vector<struct FileRecord> files;
-    db.search_by_name(&files_in_scope, input->value());
-    for (size_t i = 0; i < files.size(); i++) {
-        //files[i].file_name = L"bruh";
-        std::wcout << files[i].file_name << std::endl;
-    }
-    //search_results->set_files(files);
+    search_results->show_search(input->value());
 }
 
 class SearchInput : public Fl_Input {
@@ -182,23 +317,69 @@ int main(int argc, char **argv) {
 
 // SAP
 int main(int argc, char **argv) {
-    // scan the files
+    // move the library to another machine without rescanning it:
+    //   sap --export <root> <archive>
+    //   sap --import <archive> <root>
+    if (argc == 4 && strcmp(argv[1], "--export") == 0) {
+        int64_t num_files = db.export_library(argv[2], argv[3]);
+        fprintf(stderr, "Files Exported: %lld\n", static_cast<long long>(num_files));
+        return num_files < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    if (argc == 4 && strcmp(argv[1], "--import") == 0) {
+        auto start = std::chrono::high_resolution_clock::now();
+        int64_t num_files = db.import_library(argv[2], argv[3]);
+        std::chrono::duration<double, std::milli> duration = 
+            std::chrono::high_resolution_clock::now() - start;
+        fprintf(stderr, "Files Imported: %lld in %f ms\n", 
+            static_cast<long long>(num_files), duration.count());
+        return num_files < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // analyze audio in the background while files are being indexed
+    Analyzer analyzer(&db);
+    analyzer.start();
+
+    // finish one-time migrations and build the in-memory search indexes
+    // without delaying the window
+    std::thread index_loader([]() {
+        db.run_migrations();
+        db.load_search_indexes();
+        db.load_similar_index();
+    });
+
+    // scan the files in the background so the window opens right away
     fprintf(stderr, "Scanning Files...\n");
-    const std::string dir_path = "D:/Samples/Instruments/Guitar";
+    const std::vector<fs::path> roots = {
+        "D:/Samples/Instruments/Guitar"
+    };
     int db_size_before = db.num_rows("audio_files");
     auto start = std::chrono::high_resolution_clock::now();
-    scan_directory(&db, dir_path);
-    auto end = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double, std::milli> duration = end - start;
-    int db_size_after = db.num_rows("audio_files");
 
-    // report scan performance results
-    int num_scanned = db_size_after - db_size_before;
-    fprintf(stderr, "Files Scanned: %d\n", num_scanned);
-    float seconds_elapsed = float(duration.count()) / float(1000.0);
-    fprintf(stderr, "Scan duration: %f\n", seconds_elapsed);
-    float performance = float(num_scanned) / seconds_elapsed;
-    fprintf(stderr, "Scan Performance: %f Files / Second\n", performance);
+    ScanController scanner(&db);
+    scanner.start(roots, [&analyzer, db_size_before, start](bool completed) {
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> duration = end - start;
+        int db_size_after = db.num_rows("audio_files");
+
+        // report scan performance results
+        int num_scanned = db_size_after - db_size_before;
+        fprintf(stderr, "Scan %s\n", completed ? "Complete" : "Cancelled");
+        fprintf(stderr, "Files Scanned: %d\n", num_scanned);
+        float seconds_elapsed = float(duration.count()) / float(1000.0);
+        fprintf(stderr, "Scan duration: %f\n", seconds_elapsed);
+        float performance = float(num_scanned) / seconds_elapsed;
+        fprintf(stderr, "Scan Performance: %f Files / Second\n", performance);
+        fprintf(stderr, "Scan Metrics: %s\n", metrics.to_json().c_str());
+
+        analyzer.wake();
+    });
+
+    // keep the index current while the window is open
+    Watcher watcher(&db);
+    for (const auto &root : roots) {
+        watcher.watch(root);
+    }
+    watcher.start();
 
     Fl_Window *window = new Fl_Window(600, 600, "Search Bar Example");
 
@@ -209,7 +390,18 @@ int main(int argc, char **argv) {
     window->end();
     window->show(argc, argv);
 
-    return Fl::run();
+    // enable Fl::awake, through which the query thread delivers results
+    Fl::lock();
+    query_executor.start();
+
+    int result = Fl::run();
+    query_executor.stop();
+    index_loader.join();
+    scanner.cancel();
+    scanner.wait();
+    watcher.stop();
+    analyzer.stop();
+    return result;
 }
 
 /*
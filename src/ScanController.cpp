@@ -0,0 +1,152 @@
+#include "ScanController.h"
+#include "Scanner.h"
+
+//-----------------------------------------------------------------------------
+// ScanController::ScanController
+// ----------------------------------------------------------------------------
+// Creates an idle controller for scans into db.
+//-----------------------------------------------------------------------------
+ScanController::ScanController (Database *db) {
+    this->db = db;
+    this->running = false;
+    this->paused = false;
+    this->cancelled = false;
+}
+
+//-----------------------------------------------------------------------------
+// ScanController::~ScanController
+// ----------------------------------------------------------------------------
+// Cancels any running scan and waits for it to end.
+//-----------------------------------------------------------------------------
+ScanController::~ScanController (void) {
+    cancel();
+    wait();
+}
+
+//-----------------------------------------------------------------------------
+// ScanController::start
+// ----------------------------------------------------------------------------
+// Starts scanning roots in the background. Returns false if a scan is
+// already running.
+//-----------------------------------------------------------------------------
+bool ScanController::start (const std::vector<fs::path> &roots, FinishedCallback on_finished) {
+
+    // claim the controller in one step so two callers can't both start
+    bool expected = false;
+    if (!running.compare_exchange_strong(expected, true)) {
+        return false;
+    }
+
+    // reap the thread of the previous scan
+    wait();
+
+    paused = false;
+    cancelled = false;
+    try {
+        scan_thread = std::thread(&ScanController::run, this, roots, on_finished);
+    }
+    catch (...) {
+        running = false;
+        throw;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// ScanController::pause / resume / cancel
+// ----------------------------------------------------------------------------
+// Take effect at the next checkpoint of each stage. Cancelling a paused scan
+// also wakes it so it can wind down.
+//-----------------------------------------------------------------------------
+void ScanController::pause (void) {
+    std::lock_guard<std::mutex> lock(state_mtx);
+    paused = true;
+}
+
+void ScanController::resume (void) {
+    {
+        std::lock_guard<std::mutex> lock(state_mtx);
+        paused = false;
+    }
+    state_cv.notify_all();
+}
+
+void ScanController::cancel (void) {
+    {
+        std::lock_guard<std::mutex> lock(state_mtx);
+        cancelled = true;
+    }
+    state_cv.notify_all();
+}
+
+//-----------------------------------------------------------------------------
+// ScanController::wait
+// ----------------------------------------------------------------------------
+// Joins the scan thread. Only called from the thread that owns the
+// controller.
+//-----------------------------------------------------------------------------
+void ScanController::wait (void) {
+    if (scan_thread.joinable()) {
+        scan_thread.join();
+    }
+}
+
+bool ScanController::is_running (void) const {
+    return running;
+}
+
+bool ScanController::is_paused (void) const {
+    return paused;
+}
+
+bool ScanController::is_cancelled (void) const {
+    return cancelled;
+}
+
+//-----------------------------------------------------------------------------
+// ScanController::checkpoint
+// ----------------------------------------------------------------------------
+// Checked by the pipeline between units of work. Costs two atomic loads
+// unless the scan is paused.
+//-----------------------------------------------------------------------------
+bool ScanController::checkpoint (void) {
+
+    if (!paused.load(std::memory_order_relaxed)) {
+        return !cancelled.load(std::memory_order_relaxed);
+    }
+
+    std::unique_lock<std::mutex> lock(state_mtx);
+    state_cv.wait(lock, [this]() {
+        return !paused || cancelled;
+    });
+    return !cancelled;
+}
+
+//-----------------------------------------------------------------------------
+// ScanController::run
+// ----------------------------------------------------------------------------
+// Scan thread. A scan that throws is reported as not completed, so running
+// is always cleared and on_finished always called.
+//-----------------------------------------------------------------------------
+void ScanController::run (std::vector<fs::path> roots, FinishedCallback on_finished) {
+
+    bool failed = false;
+    try {
+        scan_directories(db, roots, this);
+    }
+    catch (const std::exception &e) {
+        errlog("ScanController::run: Scan failed: %s\n", e.what());
+        failed = true;
+    }
+    catch (...) {
+        errlog("ScanController::run: Scan failed with an unknown exception.\n");
+        failed = true;
+    }
+
+    bool completed = !failed && !cancelled;
+    running = false;
+
+    if (on_finished) {
+        on_finished(completed);
+    }
+}
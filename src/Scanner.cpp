@@ -110,90 +110,328 @@ std::wstring concatenate_tags(const std::vector<std::wstring> &tags) {
     return result;
 }
 
+// write_auto_tags produces the same tags as generate_auto_tags followed by
+// concatenate_tags, but works on a UTF-8 name and writes the tags straight
+// into a caller supplied string. No temporary strings are created, so a
+// recycled string that is already large enough is filled without allocating.
+// Every delimiter is ASCII, so splitting on bytes never cuts a multi-byte
+// character; tag length is counted in characters.
+// returns the number of tags written
+int write_auto_tags (std::string_view file_name, std::string *tags) {
+
+    tags->clear();
+    int num_tags = 0;
+    size_t token_bytes = 0;
+    size_t token_chars = 0;
+
+    // keep the current token if it is long enough, otherwise take it back
+    // out along with its separator
+    auto end_token = [&]() {
+        if (token_chars > 2) {
+            ++num_tags;
+        }
+        else if (token_bytes > 0) {
+            tags->resize(tags->size() - token_bytes - (num_tags > 0 ? 1 : 0));
+        }
+        token_bytes = 0;
+        token_chars = 0;
+    };
+
+    for (char ch : file_name) {
+        if (!char_is_delimiter(static_cast<wchar_t>(ch))) [[likely]] {
+            if (token_bytes == 0 && num_tags > 0) {
+                tags->push_back(' ');
+            }
+            // tags are lowercase
+            if (ch >= 'A' && ch <= 'Z') {
+                ch += 'a' - 'A';
+            }
+            tags->push_back(ch);
+            ++token_bytes;
+
+            // continuation bytes do not start a new character
+            if ((static_cast<unsigned char>(ch) & 0xC0) != 0x80) {
+                ++token_chars;
+            }
+        }
+        else {
+            end_token();
+        }
+    }
+    end_token();
+
+    return num_tags;
+}
+
 //=============================================================================
 // queue files
 //=============================================================================
 
-void queue_files (Database *db, const fs::path &dir_path, 
-    ThreadSafeQueue<fs::directory_entry> *proc_queue ) {
-    
-    std::vector<std::thread> threads;
-    std::mutex thread_mtx;
-    int max_threads = 12;
-    int thread_count = 0;
+// keep_going is the cooperative check made between units of work. It blocks
+// while the scan is paused and returns false once it is cancelled. Scans
+// without a controller (e.g. from the Watcher) always keep going.
+static bool keep_going (ScanController *control) {
+    return !control || control->checkpoint();
+}
+
+// List the entries of dir_path, queueing files that require processing and
+// returning its subdirectories. When the scan is journalled, the directory
+// gets a ticket that follows its files through the pipeline, so its state is
+// stored once they are all inserted and the next scan can skip listing it if
+// nothing was added, removed or renamed in it.
+static void list_directory (ScanIndex *index, const fs::path &dir_path,
+    int64_t dir_mtime, std::vector<fs::path> *subdirs,
+    ThreadSafeQueue<ScanItem> *proc_queue) {
+
+    ScopedTimer timer(STAGE_WALK);
+
+    // the walker's own reference keeps the ticket open until listing is done
+    DirectoryTicket *ticket = nullptr;
+    if (index->completed_dirs) {
+        ticket = new DirectoryTicket;
+        ticket->remaining = 1;
+        ticket->abandoned = false;
+    }
 
+    int64_t num_entries = 0;
+    std::exception_ptr failure;
     try {
         for (const auto &entry : fs::directory_iterator(dir_path)) {
-            if (requires_processing(db, &entry)) {
-                proc_queue->push(entry);
-            }
-            else if (entry.is_directory()) {
-                std::lock_guard<std::mutex> lock(thread_mtx);
-                if (thread_count < max_threads) {
-                    threads.emplace_back(&queue_files, db, entry.path(), proc_queue);
-                    ++thread_count;
+            // a partially listed directory is abandoned
+            if (!keep_going(index->control)) {
+                if (ticket) {
+                    ticket->abandoned = true;
                 }
-                else {
-                    queue_files(db, entry.path(), proc_queue);
+                break;
+            }
+            ++num_entries;
+            if (requires_processing(&index->files, &entry)) {
+                if (ticket) {
+                    ticket->remaining.fetch_add(1, std::memory_order_relaxed);
                 }
+                proc_queue->push(ScanItem{entry, ticket});
+            }
+            else if (entry.is_directory()) {
+                subdirs->push_back(entry.path());
+            }
+        }
+    }
+    catch (...) {
+        // a partial listing must not be journalled as complete
+        failure = std::current_exception();
+        dir_mtime = 0;
+    }
+
+    if (ticket) {
+        ticket->state = DirectoryState{
+            dir_path.wstring(),
+            dir_path.parent_path().wstring(),
+            dir_mtime,
+            num_entries
+        };
+        for (const auto &subdir : *subdirs) {
+            ticket->subdirs.push_back(subdir.wstring());
+        }
+        if (release_ticket(ticket)) {
+            index->completed_dirs->push(ticket);
+        }
+    }
+
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+// Walk the tree under dir_path. A subdirectory is handed to a new thread
+// while the device has a walker to spare and is walked inline otherwise, so
+// the number of threads listing a device at once never exceeds its
+// max_walkers. Spawned threads are collected in spawned for the caller to
+// join; a walker gives its slot back as soon as its own walk is done rather
+// than after joining its children.
+static void walk_directory (ScanIndex *index, const fs::path &dir_path,
+    ThreadSafeQueue<ScanItem> *proc_queue, std::vector<std::thread> *spawned) {
+
+    if (!keep_going(index->control)) {
+        return;
+    }
+
+    try {
+        // an unchanged directory is not listed; its files are still indexed
+        // and its subdirectories are known from the last scan
+        std::vector<fs::path> subdirs;
+        std::vector<std::wstring> known_subdirs;
+
+        std::error_code ec;
+        auto last_write = fs::last_write_time(dir_path, ec);
+        int64_t dir_mtime = ec ? 0 : static_cast<int64_t>(last_write.time_since_epoch().count());
+
+        if (dir_mtime != 0 && index->dirs.unchanged(dir_path.wstring(), dir_mtime, &known_subdirs)) {
+            index->files.mark_pruned(dir_path.wstring());
+            metrics.dirs_pruned.add();
+            for (const auto &subdir : known_subdirs) {
+                subdirs.emplace_back(subdir);
             }
         }
+        else {
+            list_directory(index, dir_path, dir_mtime, &subdirs, proc_queue);
+        }
 
-        for (auto &t : threads) {
-            if (t.joinable()) {
-                t.join();
-                std::lock_guard<std::mutex> lock(thread_mtx);
-                --thread_count;
+        for (const auto &subdir : subdirs) {
+            if (take_walker(index->device)) {
+                spawned->emplace_back([index, subdir, proc_queue]() {
+                    std::vector<std::thread> children;
+                    walk_directory(index, subdir, proc_queue, &children);
+                    release_walker(index->device);
+                    for (auto &t : children) {
+                        t.join();
+                    }
+                });
+            }
+            else {
+                walk_directory(index, subdir, proc_queue, spawned);
             }
         }
     }
     catch (const std::exception &e) {
-        fprintf(stderr, "queue_files: Exception caught: %s\n", e.what());
+        fprintf(stderr, "walk_directory: Exception caught: %s\n", e.what());
+        index->files.mark_pruned_tree(dir_path.wstring());
     }
     catch (...) {
-        fprintf(stderr, "queue_files: Unknown exception caught\n");
+        fprintf(stderr, "walk_directory: Unknown exception caught\n");
+        index->files.mark_pruned_tree(dir_path.wstring());
     }
 }
 
-// when the recursive scan is done, stop the process queue
-void queue_all_files (Database *db, const fs::path &dir_path,
-    ThreadSafeQueue<fs::directory_entry> *proc_queue ) {
+// queue every file under dir_path that requires processing, using up to
+// index->device->max_walkers threads
+void queue_files (ScanIndex *index, const fs::path &dir_path, 
+    ThreadSafeQueue<ScanItem> *proc_queue ) {
     
-    queue_files(db, dir_path, proc_queue);
-    proc_queue->stop_producing();
+    std::vector<std::thread> threads;
+    walk_directory(index, dir_path, proc_queue, &threads);
+
+    for (auto &t : threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+}
+
+// remove_missing_files deletes the rows of indexed files under index->root
+// that a finished walk never came across, since they were deleted or moved.
+// Directories that failed to list are skipped (see mark_pruned_tree), and
+// nothing is removed if the root itself cannot be reached.
+// Returns the number of rows removed.
+int remove_missing_files (Database *db, ScanIndex *index) {
+
+    std::error_code ec;
+    if (!fs::is_directory(index->root, ec)) {
+        errlog("remove_missing_files: Root is unreachable, keeping its files.\n");
+        return 0;
+    }
+
+    std::vector<std::wstring> missing;
+    index->files.for_each_missing([&missing](const std::wstring &file_path) {
+        missing.push_back(file_path);
+    });
+    metrics.files_missing.add(missing.size());
+    if (missing.empty()) {
+        return 0;
+    }
+
+    int num_removed = db->remove_files(missing);
+    errlog("remove_missing_files: Removed %d indexed files that no longer exist.\n",
+        num_removed);
+    return num_removed;
+}
+
+// walk the roots on one device in turn; each root's index is loaded just
+// before it is walked so the walker never has to query the database
+void queue_device_files (Database *db, std::vector<ScanIndex *> indexes,
+    ThreadSafeQueue<ScanItem> *proc_queue) {
+
+    for (ScanIndex *index : indexes) {
+        if (!keep_going(index->control)) {
+            return;
+        }
+        if (db->begin_scan(index->root)) {
+            errlog("scan_directories: Resuming interrupted scan of root.\n");
+        }
+        db->load_known_files(index->root, &index->files);
+        db->load_known_directories(index->root, &index->dirs);
+        queue_files(index, index->root, proc_queue);
+    }
 }
 
 //=============================================================================
 // process a file
 //=============================================================================
 
+// last_write_time as a plain integer for storage in the database
+// directory iteration caches this, so no extra stat is needed per file
+int64_t file_mtime (const fs::directory_entry &file) {
+    std::error_code ec;
+    auto mtime = file.last_write_time(ec);
+    if (ec) {
+        return 0;
+    }
+    return static_cast<int64_t>(mtime.time_since_epoch().count());
+}
+
 // Check if file meets the requirements to be analyzed and included in the db
 // Files must exist, be a regular file, and have a .mp3 or .wav extension.
-bool requires_processing (Database *db, const fs::directory_entry *file) {
+// Files already indexed are only processed again if their size or
+// modification time no longer matches the index.
+bool requires_processing (KnownFiles *known, const fs::directory_entry *file) {
     
-    std::wstring path = file->path().wstring();
+    ScopedTimer timer(STAGE_REQUIRES_PROCESSING);
 
-    if (file->is_regular_file() && 
-        validate_file_extension(file) &&
-        !db->entry_exists("audio_files", &path)) {
-        return true;
+    if (!validate_file_extension(file) || !file->is_regular_file()) {
+        return false;
     }
-    else {
+
+    std::error_code ec;
+    int64_t size = static_cast<int64_t>(file->file_size(ec));
+    if (ec) {
         return false;
     }
+
+    FileStatus status = known->check(file->path().wstring(), size, file_mtime(*file));
+    if (status == FileStatus::NEW) {
+        metrics.files_new.add();
+    }
+    else if (status == FileStatus::MODIFIED) {
+        metrics.files_modified.add();
+    }
+    return status != FileStatus::UNCHANGED;
 }
 
+// FileRecords come from the pipeline's RecordPool and are handed back to it
+// by the insert stage, so a steady-state scan allocates no records
+// Once the scan is cancelled, files still queued are dropped and their
+// directories abandoned, so cancelling never waits on a large backlog.
 void process_queued_files (Database *db,
-        ThreadSafeQueue<fs::directory_entry> *proc_queue,
+        ScanController *control,
+        RecordPool *pool,
+        ThreadSafeQueue<ScanItem> *proc_queue,
         ThreadSafeQueue<struct FileRecord *> *insrt_queue) {
 
-    while (!proc_queue->empty() || proc_queue->is_producing()) {
-        
-        fs::directory_entry file;
-        proc_queue->try_pop(file);
-        
-        if (!file.path().empty()) {
-            struct FileRecord *procd_file = process_file(file);
+    // blocks while the queue is empty so an idle pipeline uses no cpu
+    ScanItem item;
+    while (proc_queue->wait_pop_producing(item)) {
+        if (!keep_going(control)) {
+            if (item.ticket) {
+                item.ticket->abandoned = true;
+                if (release_ticket(item.ticket)) {
+                    delete item.ticket;
+                }
+            }
+            continue;
+        }
+        if (!item.entry.path().empty()) {
+            struct FileRecord *procd_file = pool->acquire();
+            process_file(item.entry, procd_file);
+            procd_file->ticket = item.ticket;
             insrt_queue->push(procd_file);
         }
     }
@@ -202,64 +440,84 @@ void process_queued_files (Database *db,
 }
 
 // given a directory entry, find and record attributes in FileRecord struct
-struct FileRecord *process_file (const fs::directory_entry &file) {
-
-    std::string extension = file.path().extension().string();
-    if (extension == std::string(".wav")) {
-        try {
-            WAV wav(file.path());
-            wav.parse();
-            
-            //FourierTX ftx;
-            wav.print_file_path();
-            //ftx.chroma_features(wav.get_samples(), 512);
-            //errlog("\n");
-
-            wav.close();
-        }
-        catch (...) {
-            errlog("Exception thrown\n");
-        }
-    }
+// only what can be derived from the path and directory listing is recorded
+// here so files become searchable right away; audio properties are filled in
+// later by the Analyzer
+// the record may be recycled, so every field is assigned and strings are
+// overwritten in place to reuse their capacity
+void process_file (const fs::directory_entry &file, struct FileRecord *db_entry) {
 
-    // allocate memory for entry parameters
-    struct FileRecord *db_entry = new struct FileRecord;
+    ScopedTimer timer(STAGE_PARSE);
 
     // identification
-    db_entry->file_path = file.path().c_str();
-    db_entry->file_name = file.path().filename().c_str();
-    db_entry->file_size = static_cast<size_t>(fs::file_size(file.path()));
+    // the size and modification time were cached by the directory listing
+    std::error_code ec;
+    path_to_utf8(file.path(), &db_entry->file_path);
+    size_t separator = db_entry->file_path.find_last_of("\\/");
+    db_entry->name_offset = static_cast<uint32_t>(
+        separator == std::string::npos ? 0 : separator + 1);
+    db_entry->file_size = static_cast<size_t>(file.file_size(ec));
+    db_entry->file_mtime = file_mtime(file);
 
     // generate auto tags
-    std::vector<std::wstring> tags = generate_auto_tags(db_entry->file_name);
-    db_entry->num_auto_tags = tags.size();
-    db_entry->auto_tags = concatenate_tags(tags);
+    db_entry->num_auto_tags = write_auto_tags(db_entry->file_name(), &db_entry->auto_tags);
 
-    // default user bpm and key
+    // default user tags, bpm and key
+    db_entry->num_user_tags = 0;
+    db_entry->user_tags.clear();
     db_entry->user_bpm = 0;
     db_entry->user_key = 0;
 
-    // TODO: predict bpm and key
+    // bpm and key are predicted by the Analyzer
     db_entry->auto_bpm = 0;
-    std::string path = to_string(file.path());
-    db_entry->auto_key = 0/*kdet_detect_key(path)*/;
+    db_entry->auto_key = 0;
 
-    return db_entry;
+    db_entry->ticket = nullptr;
 }
 
 //=============================================================================
 // insert_processed_files
 //=============================================================================
+
+// Files are inserted in transactions of TRANSACTION_SIZE. A partial
+// transaction is committed once the queue has held files for
+// TRANSACTION_TIMEOUT_MS, so a trickle of files (e.g. from the Watcher) still
+// reaches the database promptly.
+// Directories in completed_dirs, if given, are journalled with the next
+// transaction. Directories with no files to insert never reach insrt_queue,
+// so in that case the stage also wakes every TRANSACTION_TIMEOUT_MS.
+// The stage waits at its checkpoint while the scan is paused, but files that
+// are already processed are still committed after a cancel.
 void insert_processed_files (Database *db, 
-    ThreadSafeQueue<struct FileRecord *> *insrt_queue) {
+    ScanController *control,
+    RecordPool *pool,
+    ThreadSafeQueue<struct FileRecord *> *insrt_queue,
+    ThreadSafeQueue<DirectoryTicket *> *completed_dirs) {
     
+    auto has_work = [insrt_queue, completed_dirs]() {
+        return !insrt_queue->empty() || (completed_dirs && !completed_dirs->empty());
+    };
+
     while (insrt_queue->is_producing()) {
-        if(insrt_queue->size() >= TRANSACTION_SIZE) {
-            db->insert_files(insrt_queue);
+        if (completed_dirs) {
+            insrt_queue->wait_for_size(1, std::chrono::milliseconds(TRANSACTION_TIMEOUT_MS));
+        }
+        else {
+            insrt_queue->wait_for_size(1);
+        }
+        insrt_queue->wait_for_size(
+            TRANSACTION_SIZE, 
+            std::chrono::milliseconds(TRANSACTION_TIMEOUT_MS)
+        );
+        keep_going(control);
+        if (has_work()) {
+            ScopedTimer timer(STAGE_INSERT, 0);
+            timer.set_items(db->insert_files(insrt_queue, completed_dirs, pool));
         }
     }
-    while (!insrt_queue->empty()) {
-        db->insert_files(insrt_queue);
+    while (has_work()) {
+        ScopedTimer timer(STAGE_INSERT, 0);
+        timer.set_items(db->insert_files(insrt_queue, completed_dirs, pool));
     }
 }
 
@@ -267,11 +525,20 @@ void insert_processed_files (Database *db,
 // Scan
 //=============================================================================
 
-// scan_directory scans, processes, and inserts audio files into the database
-// Three threads are created and the following producer-consumer pipeline runs:
-// 1. dir_path -> proc_queue
-//    queue_all_files recursively drills down dir_pathchecking for
-//    .mp3 and .wav files that are not in the database (see requires_processing)
+// scan_directories scans, processes, and inserts audio files into the database
+// The following producer-consumer pipeline runs:
+// 1. roots -> proc_queue
+//    Roots are grouped by the storage device they live on (see
+//    StorageDevice) and each device gets a thread, queue_device_files, that
+//    walks its roots in turn. Walking a root recursively drills down checking
+//    for .mp3 and .wav files that are new or changed since they were indexed
+//    (see requires_processing). Each device limits how many directories are
+//    listed at once: many for NVMe, very few for spinning disks, so devices
+//    are walked in parallel without thrashing the slow ones.
+//    The index under a root is loaded into a ScanIndex before it is walked
+//    so this stage never touches the database.
+//    Directories whose modification time is unchanged since the last scan
+//    are not listed at all (see KnownDirectories).
 //    Files that require processing are queued in proc_queue.
 // 2. proc_queue -> insrt_queue
 //    process_queued_files pops files from the queue as fs::directory_entry
@@ -281,23 +548,63 @@ void insert_processed_files (Database *db,
 //    insert_processed_files pops FileRecord objects off the insert queue and
 //    inserts their data as entries in the database. Insertions are broken up
 //    into transactions for faster insertion (see DBINT::db_insert_files)
-void
-scan_directory
-(
-    Database *db, 
-    const fs::path& dir_path
-) {
-    
-    ThreadSafeQueue<fs::directory_entry> proc_queue;
+// Stages 2 and 3 are shared by every root, and inserted files are picked up
+// by the one background Analyzer.
+//
+// Each listed directory is journalled in the transaction that inserts its
+// last file (see DirectoryTicket), and each root's scan is journalled in the
+// scans table. If the process dies mid-scan, the next scan skips every
+// directory that was completed and re-lists only the rest; files that were
+// already inserted from those are found unchanged and not reprocessed.
+//
+// A scan run through a ScanController can be paused or cancelled (see
+// ScanController). A cancelled scan is left journalled as interrupted.
+void scan_directories (Database *db, const std::vector<fs::path> &roots,
+    ScanController *control) {
+
+    std::vector<std::unique_ptr<StorageDevice>> devices = group_by_device(roots);
+
+    metrics.reset();
+
+    // shared by the processing and insert stages
+    RecordPool record_pool;
+    ThreadSafeQueue<DirectoryTicket *> completed_dirs;
+
+    ThreadSafeQueue<ScanItem> proc_queue;
+    proc_queue.track_depth(&metrics.proc_queue_depth);
     proc_queue.start_producing();
     
     ThreadSafeQueue<struct FileRecord *> insrt_queue;
+    insrt_queue.track_depth(&metrics.insrt_queue_depth);
     insrt_queue.start_producing();
 
     std::vector<std::thread> threads;
-    threads.emplace_back(&queue_all_files, db, dir_path, &proc_queue);
-    threads.emplace_back(&process_queued_files, db, &proc_queue, &insrt_queue);
-    threads.emplace_back(&insert_processed_files, db, &insrt_queue);
+    threads.emplace_back(&process_queued_files, db, control, &record_pool, &proc_queue, &insrt_queue);
+    threads.emplace_back(&insert_processed_files, db, control, &record_pool, &insrt_queue, &completed_dirs);
+
+    // one index per root, kept until every file under it is inserted
+    std::vector<std::unique_ptr<ScanIndex>> indexes;
+    std::vector<std::thread> walkers;
+    for (auto &device : devices) {
+        std::vector<ScanIndex *> device_indexes;
+        for (const auto &root : device->roots) {
+            indexes.push_back(std::make_unique<ScanIndex>());
+            ScanIndex *index = indexes.back().get();
+            index->root = root;
+            index->device = device.get();
+            index->control = control;
+            index->completed_dirs = &completed_dirs;
+            device_indexes.push_back(index);
+        }
+        walkers.emplace_back(&queue_device_files, db, device_indexes, &proc_queue);
+    }
+
+    // once every device is walked, stopping the process queue cascades
+    // through the rest of the pipeline
+    for (auto &t : walkers) {
+        t.join();
+    }
+    proc_queue.stop_producing();
 
     // Join all threads
     for (auto& t : threads) {
@@ -305,4 +612,34 @@ scan_directory
             t.join();
         }
     }
-}
\ No newline at end of file
+
+    // the walk did not cover the roots, so nothing can be concluded about
+    // directories or files it did not reach
+    if (control && control->is_cancelled()) {
+        errlog("scan_directories: Scan cancelled.\n");
+        return;
+    }
+
+    for (auto &index : indexes) {
+
+        // a root that cannot be reached says nothing about its directories
+        // or files
+        std::error_code ec;
+        if (!fs::is_directory(index->root, ec)) {
+            errlog("scan_directories: Root is unreachable, keeping its files.\n");
+            continue;
+        }
+
+        // every listed directory is journalled by now; the ones never
+        // reached no longer exist
+        db->forget_removed_directories(&index->dirs);
+        db->finish_scan(index->root);
+
+        remove_missing_files(db, index.get());
+    }
+}
+
+// scan_directory scans a single root (see scan_directories)
+void scan_directory (Database *db, const fs::path &dir_path) {
+    scan_directories(db, std::vector<fs::path>{dir_path});
+}
@@ -0,0 +1,111 @@
+#include "StatementCache.h"
+
+//=============================================================================
+// StatementCache
+//=============================================================================
+
+StatementCache::StatementCache (void) {
+    this->db = nullptr;
+}
+
+StatementCache::~StatementCache (void) {
+    close();
+}
+
+//-----------------------------------------------------------------------------
+// StatementCache::open
+// ----------------------------------------------------------------------------
+// Sets the connection statements are prepared on.
+//-----------------------------------------------------------------------------
+void StatementCache::open (sqlite3 *db) {
+    close();
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    this->db = db;
+}
+
+//-----------------------------------------------------------------------------
+// StatementCache::close
+// ----------------------------------------------------------------------------
+// Finalizes every idle statement and detaches from the connection.
+// Statements still checked out are finalized when they are checked in.
+//-----------------------------------------------------------------------------
+void StatementCache::close (void) {
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    this->db = nullptr;
+    for (auto &[sql, stmts] : idle) {
+        for (sqlite3_stmt *stmt : stmts) {
+            sqlite3_finalize(stmt);
+        }
+    }
+    idle.clear();
+}
+
+//-----------------------------------------------------------------------------
+// StatementCache::checkout
+// ----------------------------------------------------------------------------
+// Returns a statement for sql that no other thread is using, or nullptr if
+// sql cannot be prepared. The statement must be checked back in with the
+// same sql.
+//-----------------------------------------------------------------------------
+sqlite3_stmt *StatementCache::checkout (std::string_view sql) {
+
+    {
+        std::lock_guard<std::mutex> lock(cache_mtx);
+        auto it = idle.find(sql);
+        if (it != idle.end() && !it->second.empty()) {
+            sqlite3_stmt *stmt = it->second.back();
+            it->second.pop_back();
+            return stmt;
+        }
+    }
+
+    // the statement will be reused, so ask sqlite to plan for that
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v3(db, sql.data(), static_cast<int>(sql.size()),
+            SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK) {
+        errlog("StatementCache::checkout: Failed to prepare statement: %s\n",
+            sqlite3_errmsg(db));
+        sqlite3_finalize(stmt);
+        return nullptr;
+    }
+    return stmt;
+}
+
+//-----------------------------------------------------------------------------
+// StatementCache::checkin
+// ----------------------------------------------------------------------------
+// Resets a statement and returns it to the idle list for sql.
+//-----------------------------------------------------------------------------
+void StatementCache::checkin (std::string_view sql, sqlite3_stmt *stmt) {
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    if (!db) {
+        sqlite3_finalize(stmt);
+        return;
+    }
+
+    auto it = idle.find(sql);
+    if (it == idle.end()) {
+        it = idle.emplace(std::string(sql), std::vector<sqlite3_stmt *>()).first;
+    }
+    it->second.push_back(stmt);
+}
+
+//=============================================================================
+// CachedStatement
+//=============================================================================
+
+CachedStatement::CachedStatement (StatementCache *cache, std::string_view sql) {
+    this->cache = cache;
+    this->sql = sql;
+    this->stmt = cache->checkout(sql);
+}
+
+CachedStatement::~CachedStatement (void) {
+    if (stmt) {
+        cache->checkin(sql, stmt);
+    }
+}
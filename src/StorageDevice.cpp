@@ -0,0 +1,151 @@
+#include "StorageDevice.h"
+
+//=============================================================================
+// walker budget
+//=============================================================================
+
+// take_walker claims a walker from the device's budget if one is free
+bool take_walker (StorageDevice *device) {
+    int available = device->free_walkers.load(std::memory_order_relaxed);
+    while (available > 0) {
+        if (device->free_walkers.compare_exchange_weak(available, available - 1,
+                std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// release_walker returns a walker taken with take_walker
+void release_walker (StorageDevice *device) {
+    device->free_walkers.fetch_add(1, std::memory_order_relaxed);
+}
+
+//=============================================================================
+// device detection
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+// query_property
+// ----------------------------------------------------------------------------
+// Runs IOCTL_STORAGE_QUERY_PROPERTY for one property of a device.
+//-----------------------------------------------------------------------------
+static bool query_property (HANDLE handle, STORAGE_PROPERTY_ID property,
+    void *descriptor, DWORD descriptor_size) {
+
+    STORAGE_PROPERTY_QUERY query = {};
+    query.PropertyId = property;
+    query.QueryType = PropertyStandardQuery;
+
+    DWORD bytes = 0;
+    return DeviceIoControl(handle, IOCTL_STORAGE_QUERY_PROPERTY,
+        &query, sizeof(query), descriptor, descriptor_size, &bytes, NULL) != 0;
+}
+
+//-----------------------------------------------------------------------------
+// probe_device
+// ----------------------------------------------------------------------------
+// Identifies the device a path is stored on and what kind of device it is.
+// The id is the physical disk number when the volume sits on a single disk,
+// otherwise the volume's GUID name. Devices that cannot be queried (e.g.
+// network shares) are UNKNOWN and identified by their volume path.
+//-----------------------------------------------------------------------------
+void probe_device (const fs::path &path, StorageDevice *device) {
+
+    device->kind = DeviceKind::UNKNOWN;
+    device->id.clear();
+
+    wchar_t mount_point[MAX_PATH];
+    if (!GetVolumePathNameW(fs::absolute(path).c_str(), mount_point, MAX_PATH)) {
+        errlog("probe_device: Cannot find volume.\n");
+        device->id = path.root_name().wstring();
+    }
+    else {
+        device->id = mount_point;
+
+        wchar_t volume_name[MAX_PATH];
+        if (GetVolumeNameForVolumeMountPointW(mount_point, volume_name, MAX_PATH)) {
+
+            // the volume device is opened without the trailing separator
+            std::wstring volume = volume_name;
+            device->id = volume;
+            if (!volume.empty() && volume.back() == L'\\') {
+                volume.pop_back();
+            }
+
+            HANDLE handle = CreateFileW(volume.c_str(), 0,
+                FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+
+            if (handle != INVALID_HANDLE_VALUE) {
+                STORAGE_DEVICE_NUMBER number = {};
+                DWORD bytes = 0;
+                if (DeviceIoControl(handle, IOCTL_STORAGE_GET_DEVICE_NUMBER,
+                        NULL, 0, &number, sizeof(number), &bytes, NULL)) {
+                    device->id = L"disk" + std::to_wstring(number.DeviceNumber);
+                }
+
+                STORAGE_DEVICE_DESCRIPTOR descriptor = {};
+                DEVICE_SEEK_PENALTY_DESCRIPTOR seek_penalty = {};
+                if (query_property(handle, StorageDeviceProperty,
+                        &descriptor, sizeof(descriptor)) &&
+                    descriptor.BusType == BusTypeNvme) {
+                    device->kind = DeviceKind::NVME;
+                }
+                else if (query_property(handle, StorageDeviceSeekPenaltyProperty,
+                        &seek_penalty, sizeof(seek_penalty))) {
+                    device->kind = seek_penalty.IncursSeekPenalty ? DeviceKind::HDD : DeviceKind::SSD;
+                }
+
+                CloseHandle(handle);
+            }
+        }
+    }
+
+    switch (device->kind) {
+    case DeviceKind::NVME:
+        device->max_walkers = DEVICE_WALKERS_NVME;
+        break;
+    case DeviceKind::SSD:
+        device->max_walkers = DEVICE_WALKERS_SSD;
+        break;
+    case DeviceKind::HDD:
+        device->max_walkers = DEVICE_WALKERS_HDD;
+        break;
+    default:
+        device->max_walkers = DEVICE_WALKERS_UNKNOWN;
+        break;
+    }
+    device->free_walkers = device->max_walkers - 1;
+}
+
+//-----------------------------------------------------------------------------
+// group_by_device
+// ----------------------------------------------------------------------------
+// Groups scan roots by the device they are stored on, keeping the roots of
+// each device in the order they were given.
+//-----------------------------------------------------------------------------
+std::vector<std::unique_ptr<StorageDevice>> group_by_device (
+    const std::vector<fs::path> &roots) {
+
+    std::vector<std::unique_ptr<StorageDevice>> devices;
+
+    for (const auto &root : roots) {
+        auto probed = std::make_unique<StorageDevice>();
+        probe_device(root, probed.get());
+
+        StorageDevice *device = nullptr;
+        for (auto &existing : devices) {
+            if (existing->id == probed->id) {
+                device = existing.get();
+                break;
+            }
+        }
+        if (!device) {
+            devices.push_back(std::move(probed));
+            device = devices.back().get();
+        }
+        device->roots.push_back(root);
+    }
+
+    return devices;
+}
@@ -46,4 +46,65 @@ quit
     void
 ){
     std::exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
+
+//-----------------------------------------------------------------------------
+// path_to_utf8
+// ----------------------------------------------------------------------------
+// Writes a path as UTF-8 into an existing string, reusing its capacity.
+// Windows paths are UTF-16 and are encoded here directly rather than through
+// a temporary u8string. An unpaired surrogate, which Windows allows in file
+// names, is encoded as if it were a code point so the path still round trips.
+//-----------------------------------------------------------------------------
+void path_to_utf8 (const fs::path &path, std::string *utf8) {
+
+    const auto &native = path.native();
+    utf8->clear();
+
+    if constexpr (sizeof(fs::path::value_type) == 1) {
+        utf8->append(native.begin(), native.end());
+        return;
+    }
+
+    for (size_t i = 0; i < native.size(); i++) {
+        uint32_t cp = static_cast<uint32_t>(native[i]);
+
+        // combine a surrogate pair into one code point
+        if (cp >= 0xD800 && cp < 0xDC00 && i + 1 < native.size()) {
+            uint32_t low = static_cast<uint32_t>(native[i + 1]);
+            if (low >= 0xDC00 && low < 0xE000) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                ++i;
+            }
+        }
+
+        if (cp < 0x80) {
+            utf8->push_back(static_cast<char>(cp));
+        }
+        else if (cp < 0x800) {
+            utf8->push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            utf8->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+        else if (cp < 0x10000) {
+            utf8->push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            utf8->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            utf8->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+        else {
+            utf8->push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            utf8->push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            utf8->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            utf8->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// utf8_to_path
+// ----------------------------------------------------------------------------
+// Makes a path from UTF-8 text, such as a path read from the database.
+//-----------------------------------------------------------------------------
+fs::path utf8_to_path (std::string_view utf8) {
+    return fs::path(std::u8string_view(
+        reinterpret_cast<const char8_t *>(utf8.data()), utf8.size()));
+}
@@ -0,0 +1,411 @@
+#include "TagIndex.h"
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+
+TagIndex::TagIndex (void) {
+    this->loaded = false;
+}
+
+//=============================================================================
+// loading
+//=============================================================================
+
+void TagIndex::clear (void) {
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    tag_ids.clear();
+    lists.clear();
+    vocabulary.clear();
+    loaded = false;
+}
+
+void TagIndex::add_tag (int64_t tag_id, std::string_view name) {
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    if (tag_ids.emplace(std::string(name), tag_id).second) {
+        vocabulary.insert(name, tag_id);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// TagIndex::load
+// ----------------------------------------------------------------------------
+// Adds a batch of postings read from file_tags. Batches read in primary key
+// order are already grouped by tag and sorted by file, so they are appended
+// as they are.
+//-----------------------------------------------------------------------------
+void TagIndex::load (const std::vector<TagPosting> &postings) {
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+
+    for (const TagPosting &posting : postings) {
+        PostingList &list = lists[posting.tag_id];
+        if (list.empty() || list.back() < posting.file_id) {
+            list.push_back(posting.file_id);
+        }
+        else if (!std::binary_search(list.begin(), list.end(), posting.file_id)) {
+            list.insert(std::lower_bound(list.begin(), list.end(), posting.file_id),
+                posting.file_id);
+        }
+    }
+}
+
+void TagIndex::set_loaded (void) {
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    loaded = true;
+}
+
+bool TagIndex::is_loaded (void) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+    return loaded;
+}
+
+//=============================================================================
+// updates
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+// TagIndex::group
+// ----------------------------------------------------------------------------
+// Sorts postings by tag and then by file so each tag's files form one sorted
+// run.
+//-----------------------------------------------------------------------------
+void TagIndex::group (std::vector<TagPosting> *postings) {
+    std::sort(postings->begin(), postings->end(), 
+        [](const TagPosting &a, const TagPosting &b) {
+            return a.tag_id != b.tag_id ? a.tag_id < b.tag_id : a.file_id < b.file_id;
+        });
+}
+
+//-----------------------------------------------------------------------------
+// TagIndex::apply
+// ----------------------------------------------------------------------------
+// Applies the postings added and removed by one transaction. Each affected
+// list is rewritten once by merging in its sorted run of changes, so a large
+// batch costs a single pass over each list rather than one per posting.
+// Freshly scanned files have ids above any already indexed, and their run is
+// simply appended.
+//-----------------------------------------------------------------------------
+void TagIndex::apply (const std::vector<TagPosting> &added, 
+    const std::vector<TagPosting> &removed) {
+
+    std::vector<TagPosting> add_runs(added);
+    std::vector<TagPosting> remove_runs(removed);
+    group(&add_runs);
+    group(&remove_runs);
+
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    PostingList merged;
+    std::vector<int64_t> run;
+
+    // calls visit with each tag and its sorted run of file ids
+    auto for_each_run = [&run](const std::vector<TagPosting> &postings, auto visit) {
+        for (size_t i = 0; i < postings.size(); ) {
+            int64_t tag_id = postings[i].tag_id;
+            run.clear();
+            for (; i < postings.size() && postings[i].tag_id == tag_id; i++) {
+                run.push_back(postings[i].file_id);
+            }
+            visit(tag_id);
+        }
+    };
+
+    for_each_run(remove_runs, [&](int64_t tag_id) {
+        auto found = lists.find(tag_id);
+        if (found == lists.end()) {
+            return;
+        }
+        PostingList &list = found->second;
+        merged.clear();
+        std::set_difference(list.begin(), list.end(), run.begin(), run.end(),
+            std::back_inserter(merged));
+        list.swap(merged);
+    });
+
+    for_each_run(add_runs, [&](int64_t tag_id) {
+        PostingList &list = lists[tag_id];
+        if (list.empty() || list.back() < run.front()) {
+            list.insert(list.end(), run.begin(), run.end());
+            list.erase(std::unique(list.end() - run.size(), list.end()), list.end());
+            return;
+        }
+        merged.clear();
+        std::set_union(list.begin(), list.end(), run.begin(), run.end(),
+            std::back_inserter(merged));
+        list.swap(merged);
+    });
+}
+
+//=============================================================================
+// queries
+//=============================================================================
+
+// the posting list of a tag, or nullptr if no file carries it
+// called with index_mtx held
+const TagIndex::PostingList *TagIndex::find (const std::string &tag) const {
+    auto id = tag_ids.find(tag);
+    if (id == tag_ids.end()) {
+        return nullptr;
+    }
+    auto list = lists.find(id->second);
+    if (list == lists.end() || list->second.empty()) {
+        return nullptr;
+    }
+    return &list->second;
+}
+
+//-----------------------------------------------------------------------------
+// TagIndex::match
+// ----------------------------------------------------------------------------
+// Returns the sorted ids of the files carrying every tag in all_of and none
+// in none_of. Required lists are intersected shortest first, so the working
+// set only ever shrinks from the size of the rarest tag. At least one tag
+// must be required; a query of exclusions alone matches nothing.
+//-----------------------------------------------------------------------------
+std::vector<int64_t> TagIndex::match (const std::vector<std::string> &all_of,
+    const std::vector<std::string> &none_of) {
+
+    std::vector<int64_t> result;
+    std::vector<int64_t> scratch;
+    if (all_of.empty()) {
+        return result;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+
+    std::vector<const PostingList *> required;
+    for (const std::string &tag : all_of) {
+        const PostingList *list = find(tag);
+        if (!list) {
+            return result;
+        }
+        required.push_back(list);
+    }
+    std::sort(required.begin(), required.end(), 
+        [](const PostingList *a, const PostingList *b) {
+            return a->size() < b->size();
+        });
+
+    result = *required[0];
+    for (size_t i = 1; i < required.size() && !result.empty(); i++) {
+        scratch.clear();
+        std::set_intersection(result.begin(), result.end(), 
+            required[i]->begin(), required[i]->end(), std::back_inserter(scratch));
+        result.swap(scratch);
+    }
+
+    for (const std::string &tag : none_of) {
+        const PostingList *list = find(tag);
+        if (!list || result.empty()) {
+            continue;
+        }
+        scratch.clear();
+        std::set_difference(result.begin(), result.end(), 
+            list->begin(), list->end(), std::back_inserter(scratch));
+        result.swap(scratch);
+    }
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// TagIndex::filter
+// ----------------------------------------------------------------------------
+// Returns the candidates that carry every tag in all_of and none in none_of,
+// looking each up in the sorted posting lists. Used to refine the result of
+// a tag search that this one adds tags to (see QueryCache).
+//-----------------------------------------------------------------------------
+std::vector<int64_t> TagIndex::filter (const std::vector<int64_t> &candidates,
+    const std::vector<std::string> &all_of, const std::vector<std::string> &none_of) {
+
+    std::vector<int64_t> result;
+
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+
+    std::vector<const PostingList *> required;
+    for (const std::string &tag : all_of) {
+        const PostingList *list = find(tag);
+        if (!list) {
+            return result;
+        }
+        required.push_back(list);
+    }
+    std::vector<const PostingList *> excluded;
+    for (const std::string &tag : none_of) {
+        const PostingList *list = find(tag);
+        if (list) {
+            excluded.push_back(list);
+        }
+    }
+
+    auto carries = [](const PostingList *list, int64_t file_id) {
+        return std::binary_search(list->begin(), list->end(), file_id);
+    };
+    for (int64_t file_id : candidates) {
+        bool keep = true;
+        for (const PostingList *list : required) {
+            keep = keep && carries(list, file_id);
+        }
+        for (const PostingList *list : excluded) {
+            keep = keep && !carries(list, file_id);
+        }
+        if (keep) {
+            result.push_back(file_id);
+        }
+    }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// TagIndex::match_fuzzy
+// ----------------------------------------------------------------------------
+// Returns the ids of up to limit files that, for every word, carry a tag
+// within a few edits of it. Short words allow fewer edits: none up to
+// FUZZY_EXACT_LENGTH bytes, one up to FUZZY_CLOSE_LENGTH and two beyond.
+// A file scores the sum of its closest distance to each word, and files are
+// returned lowest score first.
+//
+// The vocabulary tree finds the similar tags of each word without looking at
+// any file. The word whose similar tags cover the fewest files seeds the
+// candidates, and every other word only probes its lists for them, so no
+// file outside the seed lists is ever scored.
+//-----------------------------------------------------------------------------
+std::vector<int64_t> TagIndex::match_fuzzy (const std::vector<std::string> &words,
+    size_t limit) {
+
+    struct Similar {
+        std::vector<std::pair<const PostingList *, int>> lists;
+        size_t num_files = 0;
+    };
+
+    std::vector<int64_t> result;
+    if (words.empty() || limit == 0) {
+        return result;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+
+    std::vector<Similar> similar(words.size());
+    for (size_t i = 0; i < words.size(); i++) {
+        size_t length = words[i].size();
+        int max_distance = length <= FUZZY_EXACT_LENGTH ? 0 :
+                           length <= FUZZY_CLOSE_LENGTH ? 1 : 2;
+
+        vocabulary.search(words[i], max_distance, [&](int64_t tag_id, int distance) {
+            auto list = lists.find(tag_id);
+            if (list != lists.end() && !list->second.empty()) {
+                similar[i].lists.emplace_back(&list->second, distance);
+                similar[i].num_files += list->second.size();
+            }
+        });
+        if (similar[i].lists.empty()) {
+            return result;
+        }
+    }
+    std::sort(similar.begin(), similar.end(), [](const Similar &a, const Similar &b) {
+        return a.num_files < b.num_files;
+    });
+
+    // seed with every file of the rarest word, keeping its closest distance
+    std::vector<std::pair<int64_t, int>> candidates;
+    candidates.reserve(similar[0].num_files);
+    for (const auto &[list, distance] : similar[0].lists) {
+        for (int64_t file_id : *list) {
+            candidates.emplace_back(file_id, distance);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end(),
+        [](const auto &a, const auto &b) {
+            return a.first == b.first;
+        }), candidates.end());
+
+    // every other word must also be matched; add its closest distance
+    for (size_t i = 1; i < similar.size() && !candidates.empty(); i++) {
+        size_t kept = 0;
+        for (auto &candidate : candidates) {
+            int closest = -1;
+            for (const auto &[list, distance] : similar[i].lists) {
+                if ((closest < 0 || distance < closest) &&
+                    std::binary_search(list->begin(), list->end(), candidate.first)) {
+                    closest = distance;
+                }
+            }
+            if (closest >= 0) {
+                candidates[kept++] = {candidate.first, candidate.second + closest};
+            }
+        }
+        candidates.resize(kept);
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(), 
+        [](const auto &a, const auto &b) {
+            return a.second < b.second;
+        });
+    for (size_t i = 0; i < candidates.size() && result.size() < limit; i++) {
+        result.push_back(candidates[i].first);
+    }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// TagIndex::num_files
+// ----------------------------------------------------------------------------
+// Returns the number of files carrying a tag.
+//-----------------------------------------------------------------------------
+size_t TagIndex::num_files (const std::string &tag) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+    const PostingList *list = find(tag);
+    return list ? list->size() : 0;
+}
+
+//=============================================================================
+// snapshots
+//=============================================================================
+
+void TagIndex::for_each_tag (const std::function<void (int64_t tag_id, std::string_view name)> &visit) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+    for (const auto &tag : tag_ids) {
+        visit(tag.second, tag.first);
+    }
+}
+
+void TagIndex::for_each_list (const std::function<void (int64_t tag_id, 
+    const std::vector<int64_t> &file_ids)> &visit) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+    for (const auto &list : lists) {
+        if (!list.second.empty()) {
+            visit(list.first, list.second);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// TagIndex::restore_tags / restore_lists
+// ----------------------------------------------------------------------------
+// Bulk loads tags and posting lists from the arrays of a snapshot. Names are
+// a concatenated blob; name i spans name_offsets[i] to name_offsets[i + 1].
+// Lists are laid out the same way and are copied as they are, already
+// sorted.
+//-----------------------------------------------------------------------------
+void TagIndex::restore_tags (const int64_t *tag_ids, const uint64_t *name_offsets,
+    const char *names, size_t num_tags) {
+
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    this->tag_ids.reserve(num_tags);
+    for (size_t i = 0; i < num_tags; i++) {
+        std::string_view name(names + name_offsets[i], name_offsets[i + 1] - name_offsets[i]);
+        if (this->tag_ids.emplace(std::string(name), tag_ids[i]).second) {
+            vocabulary.insert(name, tag_ids[i]);
+        }
+    }
+}
+
+void TagIndex::restore_lists (const int64_t *tag_ids, const uint64_t *offsets,
+    const int64_t *file_ids, size_t num_lists) {
+
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    lists.reserve(num_lists);
+    for (size_t i = 0; i < num_lists; i++) {
+        lists[tag_ids[i]].assign(file_ids + offsets[i], file_ids + offsets[i + 1]);
+    }
+}
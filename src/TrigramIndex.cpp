@@ -0,0 +1,374 @@
+#include "TrigramIndex.h"
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+
+TrigramIndex::TrigramIndex (void) {
+    this->num_names = 0;
+    this->loaded = false;
+}
+
+//=============================================================================
+// trigrams
+//=============================================================================
+
+// fold lowercases ASCII letters, as write_auto_tags does for tags
+void TrigramIndex::fold (std::string_view text, std::string *folded) {
+    folded->assign(text);
+    for (char &ch : *folded) {
+        if (ch >= 'A' && ch <= 'Z') {
+            ch += 'a' - 'A';
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// TrigramIndex::trigrams
+// ----------------------------------------------------------------------------
+// Packs every run of three bytes in folded text into a 24 bit key and
+// returns the distinct keys in sorted order.
+//-----------------------------------------------------------------------------
+void TrigramIndex::trigrams (std::string_view folded, std::vector<uint32_t> *keys) {
+    keys->clear();
+    for (size_t i = 0; i + 3 <= folded.size(); i++) {
+        keys->push_back(
+            static_cast<uint32_t>(static_cast<unsigned char>(folded[i])) << 16 |
+            static_cast<uint32_t>(static_cast<unsigned char>(folded[i + 1])) << 8 |
+            static_cast<uint32_t>(static_cast<unsigned char>(folded[i + 2]))
+        );
+    }
+    std::sort(keys->begin(), keys->end());
+    keys->erase(std::unique(keys->begin(), keys->end()), keys->end());
+}
+
+//-----------------------------------------------------------------------------
+// TrigramIndex::index_name
+// ----------------------------------------------------------------------------
+// Stores the folded name of a file and appends its postings. A file that is
+// already indexed under the same name is left alone. Called with index_mtx
+// held.
+//-----------------------------------------------------------------------------
+void TrigramIndex::index_name (uint32_t file_id, std::string_view name,
+    std::vector<Posting> *postings) {
+
+    if (file_id >= names.size()) {
+        names.resize(std::max<size_t>(file_id + 1, names.size() * 2));
+    }
+
+    std::string folded;
+    fold(name, &folded);
+    if (folded.empty() || names[file_id] == folded) {
+        return;
+    }
+    if (names[file_id].empty()) {
+        ++num_names;
+    }
+    names[file_id] = std::move(folded);
+
+    std::vector<uint32_t> keys;
+    trigrams(names[file_id], &keys);
+    for (uint32_t key : keys) {
+        postings->push_back({key, file_id});
+    }
+}
+
+//=============================================================================
+// loading
+//=============================================================================
+
+void TrigramIndex::clear (void) {
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    names.clear();
+    lists.clear();
+    num_names = 0;
+    loaded = false;
+}
+
+//-----------------------------------------------------------------------------
+// TrigramIndex::load
+// ----------------------------------------------------------------------------
+// Adds a batch of files. Batches read in id order append to the end of every
+// posting list, so nothing is sorted while loading.
+//-----------------------------------------------------------------------------
+void TrigramIndex::load (const std::vector<std::pair<int64_t, std::string>> &files) {
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+
+    std::vector<Posting> postings;
+    for (const auto &file : files) {
+        postings.clear();
+        index_name(static_cast<uint32_t>(file.first), file.second, &postings);
+        for (const Posting &posting : postings) {
+            PostingList &list = lists[posting.trigram];
+            if (list.empty() || list.back() < posting.file_id) {
+                list.push_back(posting.file_id);
+            }
+            else if (!std::binary_search(list.begin(), list.end(), posting.file_id)) {
+                list.insert(std::lower_bound(list.begin(), list.end(), posting.file_id),
+                    posting.file_id);
+            }
+        }
+    }
+}
+
+void TrigramIndex::set_loaded (void) {
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    loaded = true;
+}
+
+bool TrigramIndex::is_loaded (void) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+    return loaded;
+}
+
+size_t TrigramIndex::size (void) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+    return num_names;
+}
+
+//=============================================================================
+// updates
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+// TrigramIndex::apply
+// ----------------------------------------------------------------------------
+// Applies the files added and removed by one transaction. Postings are
+// grouped by trigram so each affected list is merged once per batch; new
+// files have the highest ids and are appended.
+//-----------------------------------------------------------------------------
+void TrigramIndex::apply (const std::vector<std::pair<int64_t, std::string>> &added,
+    const std::vector<int64_t> &removed) {
+
+    auto by_trigram = [](const Posting &a, const Posting &b) {
+        return a.trigram != b.trigram ? a.trigram < b.trigram : a.file_id < b.file_id;
+    };
+
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+
+    // the postings of a removed file come from its stored name
+    std::vector<Posting> remove_runs;
+    std::vector<uint32_t> keys;
+    for (int64_t id : removed) {
+        uint32_t file_id = static_cast<uint32_t>(id);
+        if (file_id >= names.size() || names[file_id].empty()) {
+            continue;
+        }
+        trigrams(names[file_id], &keys);
+        for (uint32_t key : keys) {
+            remove_runs.push_back({key, file_id});
+        }
+        names[file_id].clear();
+        names[file_id].shrink_to_fit();
+        --num_names;
+    }
+
+    std::vector<Posting> add_runs;
+    for (const auto &file : added) {
+        index_name(static_cast<uint32_t>(file.first), file.second, &add_runs);
+    }
+
+    std::sort(remove_runs.begin(), remove_runs.end(), by_trigram);
+    std::sort(add_runs.begin(), add_runs.end(), by_trigram);
+
+    PostingList merged;
+    PostingList run;
+
+    // calls visit with each trigram and its sorted run of file ids
+    auto for_each_run = [&run](const std::vector<Posting> &postings, auto visit) {
+        for (size_t i = 0; i < postings.size(); ) {
+            uint32_t trigram = postings[i].trigram;
+            run.clear();
+            for (; i < postings.size() && postings[i].trigram == trigram; i++) {
+                run.push_back(postings[i].file_id);
+            }
+            visit(trigram);
+        }
+    };
+
+    for_each_run(remove_runs, [&](uint32_t trigram) {
+        auto found = lists.find(trigram);
+        if (found == lists.end()) {
+            return;
+        }
+        merged.clear();
+        std::set_difference(found->second.begin(), found->second.end(), 
+            run.begin(), run.end(), std::back_inserter(merged));
+        if (merged.empty()) {
+            lists.erase(found);
+        }
+        else {
+            found->second.swap(merged);
+        }
+    });
+
+    for_each_run(add_runs, [&](uint32_t trigram) {
+        PostingList &list = lists[trigram];
+        if (list.empty() || list.back() < run.front()) {
+            list.insert(list.end(), run.begin(), run.end());
+            return;
+        }
+        merged.clear();
+        std::set_union(list.begin(), list.end(), run.begin(), run.end(),
+            std::back_inserter(merged));
+        list.swap(merged);
+    });
+}
+
+//=============================================================================
+// queries
+//=============================================================================
+
+//-----------------------------------------------------------------------------
+// TrigramIndex::match
+// ----------------------------------------------------------------------------
+// Returns the ids of up to limit files whose name contains query, ignoring
+// ASCII case. Queries of three bytes or more are answered from the posting
+// lists, rarest trigram first. Shorter queries have no trigram to look up
+// and fall back to checking names in id order, giving up after
+// TRIGRAM_SHORT_SCAN_LIMIT names so a one letter query stays cheap.
+//-----------------------------------------------------------------------------
+std::vector<int64_t> TrigramIndex::match (std::string_view query, size_t limit) {
+
+    std::vector<int64_t> result;
+    std::string folded;
+    fold(query, &folded);
+    if (folded.empty() || limit == 0) {
+        return result;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+
+    if (folded.size() < 3) {
+        size_t checked = 0;
+        for (size_t id = 0; id < names.size() && checked < TRIGRAM_SHORT_SCAN_LIMIT; id++) {
+            if (names[id].empty()) {
+                continue;
+            }
+            ++checked;
+            if (names[id].find(folded) != std::string::npos) {
+                result.push_back(static_cast<int64_t>(id));
+                if (result.size() == limit) {
+                    break;
+                }
+            }
+        }
+        return result;
+    }
+
+    std::vector<uint32_t> keys;
+    trigrams(folded, &keys);
+
+    std::vector<const PostingList *> required;
+    for (uint32_t key : keys) {
+        auto found = lists.find(key);
+        if (found == lists.end()) {
+            return result;
+        }
+        required.push_back(&found->second);
+    }
+    std::sort(required.begin(), required.end(), 
+        [](const PostingList *a, const PostingList *b) {
+            return a->size() < b->size();
+        });
+
+    PostingList candidates = *required[0];
+    PostingList scratch;
+    for (size_t i = 1; i < required.size() && !candidates.empty(); i++) {
+        scratch.clear();
+        std::set_intersection(candidates.begin(), candidates.end(),
+            required[i]->begin(), required[i]->end(), std::back_inserter(scratch));
+        candidates.swap(scratch);
+    }
+
+    // every trigram present does not make a substring; check the name
+    for (uint32_t file_id : candidates) {
+        if (names[file_id].find(folded) != std::string::npos) {
+            result.push_back(file_id);
+            if (result.size() == limit) {
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// TrigramIndex::filter
+// ----------------------------------------------------------------------------
+// Returns the candidates whose name contains query, ignoring ASCII case, by
+// checking each stored name. Used to refine the result of a query that
+// query extends (see QueryCache).
+//-----------------------------------------------------------------------------
+std::vector<int64_t> TrigramIndex::filter (const std::vector<int64_t> &candidates,
+    std::string_view query) {
+
+    std::vector<int64_t> result;
+    std::string folded;
+    fold(query, &folded);
+    if (folded.empty()) {
+        return result;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+    for (int64_t file_id : candidates) {
+        if (file_id >= 0 && static_cast<size_t>(file_id) < names.size() &&
+            names[file_id].find(folded) != std::string::npos) {
+            result.push_back(file_id);
+        }
+    }
+    return result;
+}
+
+//=============================================================================
+// snapshots
+//=============================================================================
+
+void TrigramIndex::for_each_name (const std::function<void (uint32_t file_id, std::string_view folded)> &visit) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+    for (size_t id = 0; id < names.size(); id++) {
+        if (!names[id].empty()) {
+            visit(static_cast<uint32_t>(id), names[id]);
+        }
+    }
+}
+
+void TrigramIndex::for_each_list (const std::function<void (uint32_t trigram, 
+    const std::vector<uint32_t> &file_ids)> &visit) {
+    std::shared_lock<std::shared_mutex> lock(index_mtx);
+    for (const auto &list : lists) {
+        visit(list.first, list.second);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// TrigramIndex::restore_names / restore_lists
+// ----------------------------------------------------------------------------
+// Bulk loads folded names and posting lists from the arrays of a snapshot,
+// laid out as in TagIndex::restore_tags. Nothing is folded or split again.
+//-----------------------------------------------------------------------------
+void TrigramIndex::restore_names (const uint32_t *file_ids, const uint64_t *name_offsets,
+    const char *names, size_t num_names) {
+
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    if (num_names > 0) {
+        this->names.resize(std::max<size_t>(this->names.size(), file_ids[num_names - 1] + 1));
+    }
+    for (size_t i = 0; i < num_names; i++) {
+        std::string &name = this->names[file_ids[i]];
+        if (name.empty()) {
+            ++this->num_names;
+        }
+        name.assign(names + name_offsets[i], name_offsets[i + 1] - name_offsets[i]);
+    }
+}
+
+void TrigramIndex::restore_lists (const uint32_t *trigrams, const uint64_t *offsets,
+    const uint32_t *file_ids, size_t num_lists) {
+
+    std::unique_lock<std::shared_mutex> lock(index_mtx);
+    lists.reserve(num_lists);
+    for (size_t i = 0; i < num_lists; i++) {
+        lists[trigrams[i]].assign(file_ids + offsets[i], file_ids + offsets[i + 1]);
+    }
+}
@@ -0,0 +1,446 @@
+#include "Watcher.h"
+
+#define WATCH_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME | \
+                      FILE_NOTIFY_CHANGE_DIR_NAME  | \
+                      FILE_NOTIFY_CHANGE_SIZE      | \
+                      FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+// one wait handle is reserved for the stop event
+#define WATCH_MAX_ROOTS 63
+
+//-----------------------------------------------------------------------------
+// Watcher::Watcher
+// ----------------------------------------------------------------------------
+// Creates a watcher that applies changes to db. Nothing is watched until
+// roots are registered and start is called.
+//-----------------------------------------------------------------------------
+Watcher::Watcher (Database *db) {
+    this->db = db;
+    this->running = false;
+    this->stop_event = CreateEventW(NULL, TRUE, FALSE, NULL);
+}
+
+//-----------------------------------------------------------------------------
+// Watcher::~Watcher
+// ----------------------------------------------------------------------------
+// Stops watching and releases every directory handle.
+//-----------------------------------------------------------------------------
+Watcher::~Watcher (void) {
+    stop();
+
+    for (WatchedRoot *root : roots) {
+        CloseHandle(root->overlapped.hEvent);
+        CloseHandle(root->dir_handle);
+        delete root;
+    }
+    roots.clear();
+
+    CloseHandle(stop_event);
+}
+
+//-----------------------------------------------------------------------------
+// Watcher::watch
+// ----------------------------------------------------------------------------
+// Opens a directory for change notifications. Changes anywhere in the
+// subtree under root are reported.
+//-----------------------------------------------------------------------------
+bool Watcher::watch (const fs::path &root) {
+
+    if (running) {
+        errlog("Watcher::watch: Roots must be registered before start.\n");
+        return false;
+    }
+    if (roots.size() >= WATCH_MAX_ROOTS) {
+        errlog("Watcher::watch: Too many roots.\n");
+        return false;
+    }
+
+    HANDLE dir_handle = CreateFileW(
+        root.c_str(),
+        FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+        NULL
+    );
+
+    if (dir_handle == INVALID_HANDLE_VALUE) {
+        errlog("Watcher::watch: Cannot open directory.\n");
+        return false;
+    }
+
+    WatchedRoot *watched = new WatchedRoot;
+    watched->path = root;
+    watched->dir_handle = dir_handle;
+    memset(&watched->overlapped, 0, sizeof(OVERLAPPED));
+    watched->overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    watched->buffer.resize(WATCH_BUFFER_SIZE / sizeof(DWORD));
+
+    roots.push_back(watched);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Watcher::start
+// ----------------------------------------------------------------------------
+// Starts the watch thread along with the processing and insertion stages of
+// the scan pipeline. The pipeline threads block on their queues while no
+// files are changing.
+//-----------------------------------------------------------------------------
+void Watcher::start (void) {
+
+    if (running) {
+        return;
+    }
+
+    for (WatchedRoot *root : roots) {
+        request_changes(root);
+    }
+
+    ResetEvent(stop_event);
+    proc_queue.start_producing();
+    insrt_queue.start_producing();
+
+    threads.emplace_back(&process_queued_files, db, nullptr, &record_pool, &proc_queue, &insrt_queue);
+    threads.emplace_back(&insert_processed_files, db, nullptr, &record_pool, &insrt_queue, nullptr);
+    threads.emplace_back(&Watcher::run, this);
+
+    running = true;
+}
+
+//-----------------------------------------------------------------------------
+// Watcher::stop
+// ----------------------------------------------------------------------------
+// Stops the watch thread, applies any pending events and drains the pipeline.
+//-----------------------------------------------------------------------------
+void Watcher::stop (void) {
+
+    if (!running) {
+        return;
+    }
+
+    // the watch thread flushes pending events on its way out
+    SetEvent(stop_event);
+    threads.back().join();
+    threads.pop_back();
+
+    // stopping the process queue cascades to the insert queue
+    proc_queue.stop_producing();
+    for (auto &t : threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    threads.clear();
+
+    // outstanding reads reference the root buffers; wait for them to cancel
+    for (WatchedRoot *root : roots) {
+        DWORD bytes = 0;
+        CancelIoEx(root->dir_handle, &root->overlapped);
+        GetOverlappedResult(root->dir_handle, &root->overlapped, &bytes, TRUE);
+    }
+
+    running = false;
+}
+
+//-----------------------------------------------------------------------------
+// Watcher::request_changes
+// ----------------------------------------------------------------------------
+// Issues an asynchronous read of the next batch of changes under a root. The
+// root's event is signalled when the batch is ready.
+//-----------------------------------------------------------------------------
+bool Watcher::request_changes (WatchedRoot *root) {
+
+    BOOL result = ReadDirectoryChangesW(
+        root->dir_handle,
+        root->buffer.data(),
+        static_cast<DWORD>(root->buffer.size() * sizeof(DWORD)),
+        TRUE,
+        WATCH_FILTER,
+        NULL,
+        &root->overlapped,
+        NULL
+    );
+
+    if (!result) {
+        errlog("Watcher::request_changes: Failed to watch directory.\n");
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Watcher::read_changes
+// ----------------------------------------------------------------------------
+// Records every change in a completed batch and re-arms the root. A batch of
+// zero bytes means the system buffer overflowed and changes were dropped, in
+// which case the root is rescanned instead.
+//-----------------------------------------------------------------------------
+void Watcher::read_changes (WatchedRoot *root) {
+
+    DWORD bytes = 0;
+    if (!GetOverlappedResult(root->dir_handle, &root->overlapped, &bytes, FALSE)) {
+        if (GetLastError() == ERROR_NOTIFY_ENUM_DIR) {
+            bytes = 0;
+        }
+        else {
+            errlog("Watcher::read_changes: Failed to read changes.\n");
+            request_changes(root);
+            return;
+        }
+    }
+
+    if (bytes == 0) {
+        request_changes(root);
+        rescan(root->path);
+        return;
+    }
+
+    // a rename is reported as its old name followed by its new name. An old
+    // name without a new one was moved out of the root, and a new name
+    // without an old one was moved in.
+    fs::path renamed_from;
+
+    const BYTE *cursor = reinterpret_cast<const BYTE *>(root->buffer.data());
+    while (true) {
+        const FILE_NOTIFY_INFORMATION *info =
+            reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(cursor);
+
+        std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+
+        if (!renamed_from.empty() && info->Action != FILE_ACTION_RENAMED_NEW_NAME) {
+            record(renamed_from, WatchAction::REMOVED);
+            renamed_from.clear();
+        }
+
+        switch (info->Action) {
+        case FILE_ACTION_ADDED:
+            record(root->path / name, WatchAction::ADDED);
+            break;
+        case FILE_ACTION_MODIFIED:
+            record(root->path / name, WatchAction::MODIFIED);
+            break;
+        case FILE_ACTION_REMOVED:
+            record(root->path / name, WatchAction::REMOVED);
+            break;
+        case FILE_ACTION_RENAMED_OLD_NAME:
+            renamed_from = root->path / name;
+            break;
+        case FILE_ACTION_RENAMED_NEW_NAME:
+            if (renamed_from.empty()) {
+                record(root->path / name, WatchAction::ADDED);
+            }
+            else {
+                rename(renamed_from, root->path / name);
+                renamed_from.clear();
+            }
+            break;
+        default:
+            break;
+        }
+
+        if (info->NextEntryOffset == 0) {
+            break;
+        }
+        cursor += info->NextEntryOffset;
+    }
+
+    if (!renamed_from.empty()) {
+        record(renamed_from, WatchAction::REMOVED);
+    }
+
+    request_changes(root);
+}
+
+//-----------------------------------------------------------------------------
+// path_under
+// ----------------------------------------------------------------------------
+// Returns true if path is dir_path or lies anywhere under it.
+//-----------------------------------------------------------------------------
+static bool path_under (const fs::path &path, const fs::path &dir_path) {
+    const fs::path::string_type &text = path.native();
+    const fs::path::string_type &dir = dir_path.native();
+    return text.compare(0, dir.size(), dir) == 0 &&
+           (text.size() == dir.size() || text[dir.size()] == fs::path::preferred_separator);
+}
+
+//-----------------------------------------------------------------------------
+// Watcher::rename
+// ----------------------------------------------------------------------------
+// Moves the entries of a renamed file or directory in place, so the rows
+// keep everything stored for them, rather than removing and adding them
+// again. Pending events follow the path. Events pending for whatever the
+// rename replaced are dropped, since its rows are gone. A renamed file is
+// then processed again, as its auto tags come from its name.
+//-----------------------------------------------------------------------------
+void Watcher::rename (const fs::path &old_path, const fs::path &new_path) {
+
+    db->rename_path(old_path, new_path);
+
+    std::vector<std::pair<fs::path, WatchAction>> moved;
+    for (auto it = pending.begin(); it != pending.end(); ) {
+        if (path_under(it->first, old_path)) {
+            fs::path::string_type moved_path = new_path.native() + 
+                it->first.native().substr(old_path.native().size());
+            moved.emplace_back(fs::path(moved_path), it->second);
+            it = pending.erase(it);
+        }
+        else if (path_under(it->first, new_path)) {
+            it = pending.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    for (const auto &[path, action] : moved) {
+        record(path, action);
+    }
+    record(new_path, WatchAction::MODIFIED);
+}
+
+//-----------------------------------------------------------------------------
+// Watcher::record
+// ----------------------------------------------------------------------------
+// Coalesces an event with any pending event for the same path. Only the net
+// effect is kept: a file that is added and then modified is added once, and
+// a file that is modified and then removed is only removed. Renames are
+// applied as they arrive (see rename).
+//-----------------------------------------------------------------------------
+void Watcher::record (const fs::path &path, WatchAction action) {
+
+    if (pending.empty()) {
+        oldest_pending = std::chrono::steady_clock::now();
+    }
+
+    auto it = pending.find(path);
+    if (it == pending.end()) {
+        pending.emplace(path, action);
+        return;
+    }
+
+    switch (action) {
+    case WatchAction::ADDED:
+    case WatchAction::REMOVED:
+        it->second = action;
+        break;
+    case WatchAction::MODIFIED:
+        if (it->second == WatchAction::REMOVED) {
+            it->second = WatchAction::ADDED;
+        }
+        break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Watcher::rescan
+// ----------------------------------------------------------------------------
+// Walks a directory and queues every file that is new or changed. Used for
+// directories moved into a root and after the change buffer overflows.
+// Files deleted while events were being dropped are only found by their
+// absence, so the indexed files the walk did not come across are removed,
+// as after a scan.
+//-----------------------------------------------------------------------------
+void Watcher::rescan (const fs::path &dir_path) {
+    // directory states are left empty so every directory is listed, and
+    // nothing is journalled since the walk covers only part of a root
+    StorageDevice device;
+    probe_device(dir_path, &device);
+
+    ScanIndex index;
+    index.root = dir_path;
+    index.device = &device;
+    db->load_known_files(dir_path, &index.files);
+    queue_files(&index, dir_path, &proc_queue);
+    remove_missing_files(db, &index);
+}
+
+//-----------------------------------------------------------------------------
+// Watcher::flush
+// ----------------------------------------------------------------------------
+// Applies every pending event. Removals go straight to the database; added
+// or modified audio files are queued for processing. A directory that
+// appears is walked, but a directory's own modification events are ignored
+// since its changed children are reported individually.
+//-----------------------------------------------------------------------------
+void Watcher::flush (void) {
+
+    for (const auto &[path, action] : pending) {
+
+        if (action == WatchAction::REMOVED) {
+            db->remove_path(path);
+            continue;
+        }
+
+        std::error_code ec;
+        fs::directory_entry entry(path, ec);
+        if (ec || !entry.exists(ec)) {
+            continue;
+        }
+
+        if (entry.is_directory(ec)) {
+            if (action == WatchAction::ADDED) {
+                rescan(path);
+            }
+        }
+        else if (entry.is_regular_file(ec) && validate_file_extension(&entry)) {
+            proc_queue.push(ScanItem{entry, nullptr});
+        }
+    }
+
+    pending.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Watcher::run
+// ----------------------------------------------------------------------------
+// Watch thread. Sleeps until a root reports changes or stop is called, and
+// flushes pending events once they settle.
+//-----------------------------------------------------------------------------
+void Watcher::run (void) {
+
+    std::vector<HANDLE> events;
+    events.push_back(stop_event);
+    for (WatchedRoot *root : roots) {
+        events.push_back(root->overlapped.hEvent);
+    }
+
+    while (true) {
+
+        // wait indefinitely while idle
+        DWORD timeout = INFINITE;
+        if (!pending.empty()) {
+            auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - oldest_pending).count();
+            long long remaining = WATCH_MAX_DELAY_MS - waited;
+            if (remaining <= 0) {
+                flush();
+                continue;
+            }
+            timeout = static_cast<DWORD>(remaining < WATCH_SETTLE_MS ? remaining : WATCH_SETTLE_MS);
+        }
+
+        DWORD result = WaitForMultipleObjects(
+            static_cast<DWORD>(events.size()),
+            events.data(),
+            FALSE,
+            timeout
+        );
+
+        if (result == WAIT_OBJECT_0) {
+            break;
+        }
+        else if (result == WAIT_TIMEOUT) {
+            flush();
+        }
+        else if (result > WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + events.size()) {
+            read_changes(roots[result - WAIT_OBJECT_0 - 1]);
+        }
+        else {
+            errlog("Watcher::run: Failed waiting for changes.\n");
+            break;
+        }
+    }
+
+    flush();
+}